@@ -0,0 +1,42 @@
+#!/bin/bash
+# Simulated cycles per wall-second of one test at several model thread counts.
+# usage: bench_threads.sh <rtlsim dir> <test dir> <threads>...
+# Each count runs threads<N>/librtlsim.so, VT_SIM_AFFINITY pins it to the
+# first N cores unless already set.
+
+set -e
+
+SIM_DIR=$(realpath "$1")
+TEST_DIR=$(realpath "$2")
+shift 2
+
+RUNTIME_DIR=$(realpath "$SIM_DIR/../runtime")
+TEST=$(basename "$TEST_DIR")
+NCPUS=$(nproc)
+
+printf "%-8s %-12s %-10s %-14s\n" threads cycles seconds cycles/s
+for n in "$@"; do
+  if [ "$n" -gt "$NCPUS" ]; then
+    printf "%-8s skipped, %s cores available\n" "$n" "$NCPUS"
+    continue
+  fi
+  log=$(cd "$TEST_DIR" && \
+    LD_LIBRARY_PATH="$SIM_DIR/threads$n:$RUNTIME_DIR:$LD_LIBRARY_PATH" \
+    VT_SIM_THREADS=$n VT_SIM_AFFINITY=${VT_SIM_AFFINITY:-0-$((n - 1))} \
+    VT_LOG_LEVEL=${VT_LOG_LEVEL:-2} VT_LOG_CATS=${VT_LOG_CATS:-1} \
+    ./"$TEST" 2>&1)
+  # sum over the launches of the test
+  echo "$log" | awk -v n="$n" '
+    /launch: [0-9]+ cycles in/ {
+      for (i = 1; i <= NF; ++i) {
+        if ($(i + 1) == "cycles" && $(i + 2) == "in") cycles += $i
+        if ($(i + 1) == "s,") seconds += $i
+      }
+    }
+    END {
+      if (seconds > 0)
+        printf "%-8s %-12d %-10.3f %-14.0f\n", n, cycles, seconds, cycles / seconds
+      else
+        printf "%-8s no launch reported\n", n
+    }'
+done
@@ -0,0 +1,92 @@
+// Copyright © 2019-2023
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+// Binary checkpoint streams. Values are stored in host byte order, a
+// checkpoint is restored on the machine and build that wrote it.
+
+#define CKPT_MAGIC "VTCKPT04"
+
+template <typename T> inline void ckpt_put(std::ostream &os, const T &value) {
+  static_assert(std::is_trivially_copyable<T>::value, "not a plain value");
+  os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> inline bool ckpt_get(std::istream &is, T &value) {
+  static_assert(std::is_trivially_copyable<T>::value, "not a plain value");
+  return bool(is.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+// bytes left to read, the count of a container is checked against it before
+// anything is allocated for a corrupt or truncated stream
+inline uint64_t ckpt_remaining(std::istream &is) {
+  auto pos = is.tellg();
+  if (pos < 0)
+    return UINT64_MAX;
+  is.seekg(0, std::ios::end);
+  auto end = is.tellg();
+  is.seekg(pos);
+  return (end < pos) ? 0 : uint64_t(end - pos);
+}
+
+template <typename T>
+inline void ckpt_put(std::ostream &os, const std::vector<T> &values) {
+  ckpt_put(os, uint64_t(values.size()));
+  for (auto &value : values) {
+    ckpt_put(os, value);
+  }
+}
+
+template <typename T>
+inline bool ckpt_get(std::istream &is, std::vector<T> &values) {
+  uint64_t size;
+  if (!ckpt_get(is, size) || size > ckpt_remaining(is) / sizeof(T))
+    return false;
+  std::vector<T> temp(size);
+  for (auto &value : temp) {
+    if (!ckpt_get(is, value))
+      return false;
+  }
+  values.swap(temp);
+  return true;
+}
+
+template <typename T>
+inline void ckpt_put(std::ostream &os, const std::deque<T> &values) {
+  ckpt_put(os, uint64_t(values.size()));
+  for (auto &value : values) {
+    ckpt_put(os, value);
+  }
+}
+
+template <typename T>
+inline bool ckpt_get(std::istream &is, std::deque<T> &values) {
+  uint64_t size;
+  if (!ckpt_get(is, size) || size > ckpt_remaining(is) / sizeof(T))
+    return false;
+  std::deque<T> temp(size);
+  for (auto &value : temp) {
+    if (!ckpt_get(is, value))
+      return false;
+  }
+  values.swap(temp);
+  return true;
+}
@@ -29,6 +29,38 @@ struct metadata_buffer_t
   uint32_t knl_gl_offset_z;
   uint32_t knl_print_addr;
   uint32_t knl_print_size;
+  uint32_t knl_start_pc;    // where the warps start, the module entry; 0 for USER_BASE_ADDR
+  // what the kernel uses, all 0 when unreported takes the dispatcher's defaults
+  uint32_t knl_vgprs;       // vector registers per warp
+  uint32_t knl_sgprs;       // scalar registers per warp
+  uint32_t knl_lds_size;    // local memory bytes beyond the warp stacks
+};
+
+// per kernel record of the .ventus.resource.<kernel> section the compiler
+// emits
+struct kernel_resource_t
+{
+  uint16_t vgpr_usage;
+  uint16_t sgpr_usage;
+  uint32_t lds_usage;       // bytes
+};
+
+// what bounds the workgroups resident on an SM
+#define OCCUPANCY_LIMIT_WARPS 0 // hardware warp slots
+#define OCCUPANCY_LIMIT_WGS   1 // workgroup slots of the CTA scheduler
+#define OCCUPANCY_LIMIT_VGPRS 2
+#define OCCUPANCY_LIMIT_SGPRS 3
+#define OCCUPANCY_LIMIT_LDS   4
+
+struct occupancy_t
+{
+  uint32_t warp_size;
+  uint32_t warps_per_wg;
+  uint32_t wgs_per_sm;       // 0 when a workgroup does not fit an SM
+  uint32_t warps_per_sm;
+  uint32_t max_warps_per_sm;
+  uint32_t num_sms;
+  uint32_t limiter;          // OCCUPANCY_LIMIT_*
 };
 
 struct dispatch_info_t {
@@ -53,4 +85,97 @@ struct dispatch_info_t {
   uint32_t gds_baseaddr;
 };
 
+// one range of a batched copy between host and device memory
+struct copy_desc_t
+{
+  uint64_t dev_addr;
+  void* host_ptr;     // read by uploads, written by downloads
+  uint64_t size;
+};
+
+// trace triggers, any of them opens the trace window
+#define TRACE_TRIGGER_WG    0x1 // workgroup trigger_wg is dispatched
+#define TRACE_TRIGGER_PC    0x2 // an instruction at trigger_pc is issued
+#define TRACE_TRIGGER_ADDR  0x4 // memory access to [watch_addr, watch_addr + watch_size)
+
+struct trace_config_t
+{
+  uint32_t enable;        // 0 disables tracing
+  uint32_t depth;         // hierarchy depth to dump, 0 dumps all levels
+  uint64_t start_cycle;   // launch cycle window [start_cycle, stop_cycle)
+  uint64_t stop_cycle;
+  uint32_t trigger_mask;  // TRACE_TRIGGER_*, 0 traces the whole window
+  uint32_t trigger_wg;
+  uint32_t trigger_pc;
+  uint32_t watch_addr;
+  uint32_t watch_size;
+  uint64_t trigger_cycles; // cycles traced after a trigger, 0 = until stop_cycle
+  char filename[256];      // FST output, "trace.fst" when empty
+};
+
+// sampled launches, the workgroups picked run on the RTL and the others on
+// the functional model, which only moves memory forward
+#define SAMPLE_OFF      0 // every workgroup on the RTL
+#define SAMPLE_EVERY    1 // workgroups offset, offset + period, ...
+#define SAMPLE_RANDOM   2 // count workgroups drawn from seed
+#define SAMPLE_LIST     3 // the num_ids workgroups of ids
+#define SAMPLE_MAX_IDS  64
+
+struct sample_config_t
+{
+  uint32_t mode;    // SAMPLE_*
+  uint32_t period;
+  uint32_t offset;
+  uint32_t count;
+  uint32_t seed;
+  uint32_t num_ids;
+  uint32_t ids[SAMPLE_MAX_IDS]; // linear workgroup indices, x fastest
+};
+
+// extrapolation of a sampled launch to the whole grid
+struct sample_estimate_t
+{
+  uint32_t num_workgroups;
+  uint32_t num_sampled;     // workgroups simulated on the RTL
+  uint64_t sampled_cycles;  // cycles the RTL took for them
+  double mean_wg_cycles;    // latency, dispatch to completion, of a sampled
+  double stddev_wg_cycles;  // workgroup; not the spread of est_cycles
+  uint64_t est_cycles;      // sampled_cycles scaled to num_workgroups
+  uint64_t est_cycles_low;  // 95% confidence interval of est_cycles, from
+  uint64_t est_cycles_high; // batch means of the sample's cycles per workgroup
+};
+
+// launch status
+#define VX_LAUNCH_COMPLETED 0 // every workgroup finished
+#define VX_LAUNCH_RUNNING   1
+#define VX_LAUNCH_TIMEOUT   2 // cycle budget exhausted
+#define VX_LAUNCH_HUNG      3 // no commit nor memory traffic for hang_cycles
+#define VX_LAUNCH_ABORTED   4 // stopped by the host
+#define VX_LAUNCH_FAULT     5 // unsupported instruction, functional backend
+#define VX_LAUNCH_CONFLICT  6 // parallel models wrote the same bytes differently
+
+// performance counters of the last launch, see vx_perf_query
+#define VX_PERF_CYCLES              0
+#define VX_PERF_INSTRS              1  // issued instructions, per SM
+#define VX_PERF_WARP_INSTRS         2  // issued instructions, per SM * NUM_WARP + warp
+#define VX_PERF_WRITEBACKS          3  // register writebacks, per SM
+#define VX_PERF_ICACHE_HITS         4  // per SM
+#define VX_PERF_ICACHE_MISSES       5
+#define VX_PERF_DCACHE_HITS         6
+#define VX_PERF_DCACHE_MISSES       7
+#define VX_PERF_DCACHE_MSHR_STALLS  8  // cycles a miss waited for a free MSHR
+#define VX_PERF_SMEM_ACCESSES       9
+#define VX_PERF_L2_HITS             10 // per L2 slice
+#define VX_PERF_L2_MISSES           11
+#define VX_PERF_CTAS                12 // completed workgroups
+#define VX_PERF_CTA_LATENCY         13 // sum of dispatch to completion cycles
+#define VX_PERF_CTA_LATENCY_MAX     14
+#define VX_PERF_COUNT               15
+
+#define VX_PERF_ALL                 0xffffffff // index summing every unit
+
+// defaults for the launch limits, VT_MAX_CYCLES and VT_HANG_CYCLES override
+#define DEFAULT_MAX_CYCLES  0      // 0 = unlimited
+#define DEFAULT_HANG_CYCLES 100000 // 0 disables the watchdog
+
 #endif
\ No newline at end of file
@@ -11,136 +11,621 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <emulator.h>
 #include <memory.h>
 #include <processor.h>
 #include <ventus_runtime.h>
 #include <vt_config.h>
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <future>
 #include <iostream>
 #include <list>
+#include <mutex>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+
+// batched copies and fills move pieces of this size, spread over host threads
+// once a transfer reaches COPY_PARALLEL_MIN bytes
+#define COPY_PIECE_SIZE   0x100000  // 1 MB
+#define COPY_PARALLEL_MIN 0x1000000 // 16 MB
+#define COPY_MAX_THREADS  8
+
+// execution backends, VT_BACKEND selects one when the device is opened
+#define VT_BACKEND_RTL  0 // cycle-accurate Verilator model
+#define VT_BACKEND_FUNC 1 // functional emulator, no timing
 
 class vt_device {
 public:
-  vt_device() : ram_(), m_first(true) { processor_.attach_ram(&ram_); }
+  vt_device()
+      : ram_(), processor_(nullptr), emulator_(nullptr),
+        status_(VX_LAUNCH_COMPLETED), csr_knl_addr_(0), launch_id_(0),
+        callback_(nullptr), callback_arg_(nullptr), parallel_(1),
+        last_models_(1), limits_set_(false), max_cycles_(0), hang_cycles_(0) {
+    const char *backend = getenv("VT_BACKEND");
+    if (backend && 0 == strcmp(backend, "func")) {
+      emulator_ = new Emulator();
+      emulator_->attach_ram(&ram_);
+    } else {
+      if (backend && *backend && strcmp(backend, "rtl")) {
+        VT_LOG(LOG_LEVEL_WARN, LOG_CAT_RT, "unknown VT_BACKEND '%s', using rtl", backend);
+      }
+      processor_ = new Processor();
+      processor_->attach_ram(&ram_);
+      if (const char *parallel = getenv("VT_PARALLEL")) {
+        parallel_ = std::max<uint32_t>(strtoul(parallel, nullptr, 0), 1);
+      }
+    }
+  }
 
   ~vt_device() {
+    std::unique_lock<std::mutex> lock(mutex_);
     if (future_.valid()) {
-      future_.wait();
+      // do not keep a stuck launch running past close
+      if (processor_) {
+        processor_->abort();
+        for (auto shard : shards_) {
+          shard->abort();
+        }
+      } else {
+        emulator_->abort();
+      }
+    }
+    this->launch_wait(lock);
+    ram_.free(PDS_BASE_ADDR);
+    delete processor_;
+    delete emulator_;
+    for (auto shard : shards_) {
+      delete shard;
     }
   }
 
-  int init() { return 0; }
+
+  int init() {
+    // keep the workgroup private segment out of the allocator's way
+    if (!ram_.reserve(PDS_BASE_ADDR, PDS_MEM_SIZE))
+      return -1;
+    if (processor_) {
+      processor_->private_segment(PDS_BASE_ADDR);
+    } else {
+      emulator_->private_segment(PDS_BASE_ADDR);
+    }
+    return 0;
+  }
 
   int get_caps(uint32_t caps_id, uint64_t *value) {
+    // the configuration the model was built with, see vt_hw_config.h
     uint64_t _value;
-    // switch (caps_id) {
-    // case VX_CAPS_VERSION:
-    //   _value = IMPLEMENTATION_ID;
-    //   break;
-    // case VX_CAPS_NUM_THREADS:
-    //   _value = NUM_THREADS;
-    //   break;
-    // case VX_CAPS_NUM_WARPS:
-    //   _value = NUM_WARPS;
-    //   break;
-    // case VX_CAPS_NUM_CORES:
-    //   _value = NUM_CORES * NUM_CLUSTERS;
-    //   break;
-    // case VX_CAPS_CACHE_LINE_SIZE:
-    //   _value = CACHE_BLOCK_SIZE;
-    //   break;
-    // case VX_CAPS_GLOBAL_MEM_SIZE:
-    //   _value = GLOBAL_MEM_SIZE;
-    //   break;
-    // case VX_CAPS_LOCAL_MEM_SIZE:
-    //   _value = (1 << LMEM_LOG_SIZE);
-    //   break;
-    // case VX_CAPS_ISA_FLAGS:
-    //   _value = ((uint64_t(MISA_EXT))<<32) | ((log2floor(XLEN)-4) << 30) |
-    //   MISA_STD; break;
-    // case VX_CAPS_NUM_MEM_BANKS:
-    //   _value = PLATFORM_MEMORY_NUM_BANKS;
-    //   break;
-    // case VX_CAPS_MEM_BANK_SIZE:
-    //   _value = 1ull << (MEM_ADDR_WIDTH / PLATFORM_MEMORY_NUM_BANKS);
-    //   break;
-    // default:
-    //   std::cout << "invalid caps id: " << caps_id << std::endl;
-    //   std::abort();
-    //   return -1;
-    // }
+    switch (caps_id) {
+    case VX_CAPS_VERSION:
+      _value = 0; // define.v carries no revision
+      break;
+    case VX_CAPS_NUM_THREADS:
+      _value = hw::NUM_THREAD;
+      break;
+    case VX_CAPS_NUM_WARPS:
+      _value = hw::NUM_WARP;
+      break;
+    case VX_CAPS_NUM_CORES:
+      _value = hw::NUM_SM;
+      break;
+    case VX_CAPS_CACHE_LINE_SIZE:
+      _value = hw::DCACHE_BLOCKWORDS * hw::BYTESOFWORD;
+      break;
+    case VX_CAPS_GLOBAL_MEM_SIZE:
+      _value = GLOBAL_MEM_SIZE;
+      break;
+    case VX_CAPS_LOCAL_MEM_SIZE:
+      _value = hw::NUMBER_LDS_SLOTS;
+      break;
+    case VX_CAPS_ISA_FLAGS:
+      // misa layout, RV32IMAF with the vector extension
+      _value = (uint64_t(hw::XLEN == 64 ? 2 : 1) << 30) | (1ull << ('I' - 'A')) |
+               (1ull << ('M' - 'A')) | (1ull << ('A' - 'A')) | (1ull << ('F' - 'A')) |
+               (1ull << ('V' - 'A'));
+      break;
+    case VX_CAPS_NUM_MEM_BANKS:
+      _value = hw::NUM_L2CACHE;
+      break;
+    case VX_CAPS_MEM_BANK_SIZE:
+      _value = GLOBAL_MEM_SIZE / hw::NUM_L2CACHE;
+      break;
+    default:
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_RT, "invalid caps id: %u", caps_id);
+      return -1;
+    }
     *value = _value;
     return 0;
   }
 
-  int mem_alloc(uint64_t *dev_addr, uint64_t size) {
-    if (m_first) {
-        size = 0x10000000ul;
-        m_first = false;
-    }
-    return ram_.alloc(dev_addr, size) ? 0 : -1;
+  int mem_alloc(uint64_t *dev_addr, uint64_t size, uint64_t alignment = 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ram_.alloc(dev_addr, size, alignment) ? 0 : -1;
+  }
+
+  int mem_reserve(uint64_t dev_addr, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ram_.reserve(dev_addr, size) ? 0 : -1;
   }
 
-  int mem_free(uint64_t dev_addr) { return ram_.free(dev_addr); }
+  int mem_free(uint64_t dev_addr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ram_.free(dev_addr) ? 0 : -1;
+  }
 
-  int mem_info(uint64_t *mem_free, uint64_t *mem_used) const { return 0; }
+  int mem_info(uint64_t *mem_free, uint64_t *mem_used) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ram_.mem_info(mem_free, mem_used);
+    return 0;
+  }
 
-  int upload(uint64_t dest_addr, const void *src, uint64_t size) {
-    if (dest_addr + size > GLOBAL_MEM_SIZE)
+  int mem_map(uint64_t dev_addr, uint64_t size, void **host_ptr) {
+    auto ptr = ram_.host_ptr(dev_addr, size);
+    if (ptr == nullptr)
       return -1;
-
-    ram_.write(dest_addr, src, size);
+    *host_ptr = ptr;
     return 0;
   }
 
+  int upload(uint64_t dest_addr, const void *src, uint64_t size) {
+    copy_desc_t desc = {dest_addr, const_cast<void *>(src), size};
+    return this->upload_batch(&desc, 1);
+  }
+
   int download(void *dest, uint64_t src_addr, uint64_t size) {
-    if (src_addr + size > GLOBAL_MEM_SIZE)
+    copy_desc_t desc = {src_addr, dest, size};
+    return this->download_batch(&desc, 1);
+  }
+
+  int upload_batch(const copy_desc_t *descs, uint32_t count) {
+    if (!this->check_ranges(descs, count))
+      return -1;
+    return this->copy_pieces(descs, count, COPY_PIECE_SIZE,
+                             [&](const copy_desc_t &desc, uint64_t offset, uint64_t size) {
+                               return ram_.write(desc.dev_addr + offset,
+                                                 (const uint8_t *)desc.host_ptr + offset, size);
+                             });
+  }
+
+  int download_batch(const copy_desc_t *descs, uint32_t count) {
+    if (!this->check_ranges(descs, count))
+      return -1;
+    return this->copy_pieces(descs, count, COPY_PIECE_SIZE,
+                             [&](const copy_desc_t &desc, uint64_t offset, uint64_t size) {
+                               return ram_.read(desc.dev_addr + offset,
+                                                (uint8_t *)desc.host_ptr + offset, size);
+                             });
+  }
+
+  int fill(uint64_t dest_addr, const void *pattern, uint32_t pattern_size, uint64_t size) {
+    if (0 == pattern_size || 0 != (size % pattern_size) || !in_range(dest_addr, size))
       return -1;
+    // pieces start on a pattern boundary
+    uint64_t piece_size = std::max<uint64_t>(COPY_PIECE_SIZE - COPY_PIECE_SIZE % pattern_size, pattern_size);
+    copy_desc_t desc = {dest_addr, nullptr, size};
+    return this->copy_pieces(&desc, 1, piece_size,
+                             [&](const copy_desc_t &desc, uint64_t offset, uint64_t size) {
+                               return ram_.fill(desc.dev_addr + offset, pattern, pattern_size, size);
+                             });
+  }
 
-    ram_.read(src_addr, dest, size);
+  int trace_config(const trace_config_t &config) {
+    // ensure prior run completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    // the functional backend has no waveforms
+    if (processor_) {
+      processor_->trace_config(config);
+    }
     return 0;
   }
 
-  int start(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+  int limits(uint64_t max_cycles, uint64_t hang_cycles) {
     // ensure prior run completed
-    if (future_.valid()) {
-      future_.wait();
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (processor_) {
+      processor_->limits(max_cycles, hang_cycles);
+      for (auto shard : shards_) {
+        shard->limits(max_cycles, hang_cycles);
+      }
+      limits_set_ = true;
+      max_cycles_ = max_cycles;
+      hang_cycles_ = hang_cycles;
+    } else {
+      // the budget counts warp instructions there, nothing can hang
+      emulator_->limits(max_cycles);
     }
+    return 0;
+  }
 
-    // start new run
-    future_ = std::async(std::launch::async, [metadata, csr_knl_addr, this] {
-      processor_.run(metadata, csr_knl_addr);
-    });
+  // launch receives the completion of this launch alone, its status
+  int start(metadata_buffer_t metadata, uint64_t csr_knl_addr,
+            std::shared_future<int> *launch = nullptr) {
+    // ensure prior run completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+
+    // start new run, the launch owns its metadata block
+    csr_knl_addr_ = csr_knl_addr;
+    status_ = VX_LAUNCH_RUNNING;
+    ++launch_id_;
+    uint32_t models = processor_ ? this->launch_models(metadata) : 1;
+    last_models_ = models;
+    auto callback = this->take_callback();
+    future_ = std::async(std::launch::async, [metadata, csr_knl_addr, models, callback, this] {
+      int status;
+      if (emulator_) {
+        status = emulator_->run(metadata, csr_knl_addr);
+      } else if (models > 1) {
+        status = this->run_parallel(metadata, csr_knl_addr, models);
+      } else {
+        status = processor_->run(metadata, csr_knl_addr);
+      }
+      callback(status);
+      return status;
+    }).share();
+    if (launch) {
+      *launch = future_;
+    }
 
     return 0;
   }
 
   int ready_wait(uint64_t timeout) {
-    if (!future_.valid())
-      return 0;
-    uint64_t timeout_sec = timeout / 1000;
-    std::chrono::seconds wait_time(1);
-    for (;;) {
-      // wait for 1 sec and check status
-      auto status = future_.wait_for(wait_time);
-      if (status == std::future_status::ready)
-        break;
-      if (0 == timeout_sec--)
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (future_.valid()) {
+      // wait on a copy, other threads keep using the device meanwhile; the
+      // launch thread signals completion, there is no polling
+      auto future = future_;
+      lock.unlock();
+      if (timeout >= VX_MAX_TIMEOUT) {
+        future.wait();
+      } else if (future.wait_for(std::chrono::milliseconds(timeout)) !=
+                 std::future_status::ready) {
         return -1;
+      }
+      lock.lock();
+      this->launch_collect();
+      // the status of the launch waited for, another may have started since
+      return (future.get() == VX_LAUNCH_COMPLETED) ? 0 : -1;
+    }
+    // a launch stopped by its budget or the watchdog is not a success
+    return (status_ == VX_LAUNCH_COMPLETED) ? 0 : -1;
+  }
+
+  int checkpoint(const char *filename) {
+    // only between launches, use checkpoint_at within one
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (!this->rtl_only("checkpoints"))
+      return -1;
+    return processor_->save(filename);
+  }
+
+  int checkpoint_at(uint64_t cycle, const char *filename) {
+    // ensure prior run completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (!this->rtl_only("checkpoints"))
+      return -1;
+    if (parallel_ > 1 && cycle != 0) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_RT, "launches split over %u models cannot be checkpointed",
+             parallel_);
+      return -1;
     }
+    processor_->checkpoint_at(cycle, filename);
+    return 0;
+  }
+
+  int restore(const char *filename) {
+    // ensure prior run completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (!this->rtl_only("checkpoints"))
+      return -1;
+    int ret = processor_->restore(filename, &csr_knl_addr_);
+    if (ret < 0)
+      return -1;
+    if (ret == 1) {
+      // carry on with the launch the checkpoint was taken in
+      status_ = VX_LAUNCH_RUNNING;
+      ++launch_id_;
+      auto callback = this->take_callback();
+      future_ = std::async(std::launch::async, [callback, this] {
+        int status = processor_->resume();
+        callback(status);
+        return status;
+      }).share();
+    }
+    return 0;
+  }
+
+  int sample(const sample_config_t &config) {
+    // ensure prior run completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (!this->rtl_only("sampled launches"))
+      return -1;
+    processor_->sample_config(config);
+    return 0;
+  }
+
+  int sample_estimate(sample_estimate_t *estimate) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (!this->rtl_only("sampled launches"))
+      return -1;
+    return processor_->sample_estimate(estimate);
+  }
+
+  int parallel(uint32_t num_models) {
+    // ensure prior run completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (!this->rtl_only("parallel launches") || num_models == 0)
+      return -1;
+    parallel_ = num_models;
+    return 0;
+  }
+
+  int launch_callback(vx_launch_callback_t callback, void *arg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callback_ = callback;
+    callback_arg_ = arg;
+    return 0;
+  }
+
+  int occupancy(dim3 block, const kernel_resource_t *resources, occupancy_t *occupancy) {
+    // a property of the hardware configuration, whatever the backend
+    return Processor::occupancy(block, resources, occupancy);
+  }
+
+  int perf_query(uint32_t counter, uint32_t index, uint64_t *value) {
+    // counters are final once the launch completed
+    std::unique_lock<std::mutex> lock(mutex_);
+    this->launch_wait(lock);
+    if (emulator_)
+      return emulator_->perf_query(counter, index, value);
+    // a parallel launch adds up its models, as if they ran one after the other
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < last_models_; ++i) {
+      auto model = i ? shards_[i - 1] : processor_;
+      uint64_t part;
+      if (model->perf_query(counter, index, &part))
+        return -1;
+      total = (counter == VX_PERF_CTA_LATENCY_MAX) ? std::max(total, part) : total + part;
+    }
+    *value = total;
+    return 0;
+  }
+
+  int launch_status(int *status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->launch_collect();
+    *status = status_;
     return 0;
   }
 
 private:
+  // written so that a huge address or size cannot wrap around
+  static bool in_range(uint64_t dev_addr, uint64_t size) {
+    return size <= GLOBAL_MEM_SIZE && dev_addr <= GLOBAL_MEM_SIZE - size;
+  }
+
+  bool check_ranges(const copy_desc_t *descs, uint32_t count) const {
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!in_range(descs[i].dev_addr, descs[i].size) ||
+          (descs[i].size && nullptr == descs[i].host_ptr))
+        return false;
+    }
+    return true;
+  }
+
+  // one loop over pieces of up to piece_size bytes of every range, dealt to
+  // host threads when the transfer is large; copy returns false on failure
+  template <typename F>
+  int copy_pieces(const copy_desc_t *descs, uint32_t count, uint64_t piece_size, const F &copy) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      total += descs[i].size;
+    }
+    uint64_t num_threads = 1;
+    if (total >= COPY_PARALLEL_MIN) {
+      num_threads = std::min<uint64_t>({std::max(std::thread::hardware_concurrency(), 1u),
+                                        COPY_MAX_THREADS, total / piece_size});
+    }
+
+    std::mutex piece_mutex;
+    uint32_t next_desc = 0;
+    uint64_t next_offset = 0;
+    std::atomic<bool> ok(true);
+    auto worker = [&] {
+      for (;;) {
+        uint32_t i;
+        uint64_t offset, size;
+        {
+          // skip the ranges done or empty and hand out the next piece
+          std::lock_guard<std::mutex> lock(piece_mutex);
+          while (next_desc < count && next_offset >= descs[next_desc].size) {
+            ++next_desc;
+            next_offset = 0;
+          }
+          if (next_desc >= count)
+            return;
+          i = next_desc;
+          offset = next_offset;
+          size = std::min(piece_size, descs[i].size - offset);
+          next_offset += size;
+        }
+        if (!copy(descs[i], offset, size)) {
+          ok = false;
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (uint64_t t = 1; t < num_threads; ++t) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    return ok ? 0 : -1;
+  }
+
+  bool rtl_only(const char *feature) const {
+    if (processor_)
+      return true;
+    VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_RT, "%s need the rtl backend", feature);
+    return false;
+  }
+
+  // models the next launch is split over, one per workgroup at most; the
+  // extra ones are created on first use and kept
+  uint32_t launch_models(const metadata_buffer_t &metadata) {
+    uint32_t num_wgs = (metadata.knl_gl_size_x / metadata.knl_lc_size_x) *
+                       (metadata.knl_gl_size_y / metadata.knl_lc_size_y) *
+                       (metadata.knl_gl_size_z / metadata.knl_lc_size_z);
+    uint32_t models = std::max<uint32_t>(std::min(parallel_, num_wgs), 1);
+    while (shards_.size() + 1 < models) {
+      auto shard = new Processor();
+      shard->private_segment(PDS_BASE_ADDR);
+      if (limits_set_) {
+        shard->limits(max_cycles_, hang_cycles_);
+      }
+      shards_.push_back(shard);
+    }
+    return models;
+  }
+
+  // Each model runs a contiguous range of the grid on its own thread against
+  // a copy-on-write view of the memory, the views are merged once all are
+  // done. Workgroups communicating through memory (atomics, flags) break
+  // this: two models writing the same bytes, as the memory port sees the
+  // writes, fail the launch and leave the memory as it was before it.
+  int run_parallel(metadata_buffer_t metadata, uint64_t csr_knl_addr, uint32_t models) {
+    uint32_t num_wgs = (metadata.knl_gl_size_x / metadata.knl_lc_size_x) *
+                       (metadata.knl_gl_size_y / metadata.knl_lc_size_y) *
+                       (metadata.knl_gl_size_z / metadata.knl_lc_size_z);
+    auto time_start = std::chrono::steady_clock::now();
+    std::vector<Processor *> procs(models);
+    std::vector<PhysicalMemory *> views(models);
+    std::vector<int> status(models, VX_LAUNCH_COMPLETED);
+    // set by the first model to fail, the others stop at their next check,
+    // even those that have not started yet
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < models; ++i) {
+      procs[i] = i ? shards_[i - 1] : processor_;
+      views[i] = new PhysicalMemory(&ram_);
+      procs[i]->attach_ram(views[i]);
+    }
+    for (uint32_t i = 0; i < models; ++i) {
+      std::vector<uint32_t> workgroups;
+      for (uint32_t wg = uint64_t(num_wgs) * i / models;
+           wg < uint64_t(num_wgs) * (i + 1) / models; ++wg) {
+        workgroups.push_back(wg);
+      }
+      threads.emplace_back([&, i, workgroups] {
+        status[i] = procs[i]->run(metadata, csr_knl_addr, workgroups, &failed);
+        if (status[i] != VX_LAUNCH_COMPLETED) {
+          // the launch failed, no need for the others to finish
+          failed = true;
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    // a model that failed aborted the others, report its status
+    int result = VX_LAUNCH_COMPLETED;
+    for (auto s : status) {
+      if (s != VX_LAUNCH_COMPLETED &&
+          (result == VX_LAUNCH_COMPLETED || result == VX_LAUNCH_ABORTED))
+        result = s;
+    }
+    // the private segments are reused by the workgroups of every model
+    if (result == VX_LAUNCH_COMPLETED && ram_.merge(views, PDS_BASE_ADDR, PDS_MEM_SIZE) != 0) {
+      result = VX_LAUNCH_CONFLICT;
+    }
+    for (uint32_t i = 0; i < models; ++i) {
+      procs[i]->attach_ram(&ram_);
+      delete views[i];
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - time_start;
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_RT, "parallel launch: %u workgroups over %u models in %.3f s",
+           num_wgs, models, elapsed.count());
+    return result;
+  }
+
+  // the registered callback goes with the launch being started
+  std::function<void(int)> take_callback() {
+    auto callback = callback_;
+    auto arg = callback_arg_;
+    callback_ = nullptr;
+    callback_arg_ = nullptr;
+    return [callback, arg, this](int status) {
+      if (callback) {
+        callback(this, status, arg);
+      }
+    };
+  }
+
+  // take the result of a finished launch and release its metadata
+  void launch_collect() {
+    if (future_.valid() &&
+        future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      status_ = future_.get();
+      future_ = std::shared_future<int>();
+    }
+    if (!future_.valid() && csr_knl_addr_) {
+      ram_.free(csr_knl_addr_);
+      csr_knl_addr_ = 0;
+    }
+  }
+
+  // wait until no launch runs, the lock is dropped while waiting so that
+  // memory calls from other threads proceed
+  void launch_wait(std::unique_lock<std::mutex> &lock) {
+    while (future_.valid()) {
+      auto future = future_;
+      uint64_t launch_id = launch_id_;
+      lock.unlock();
+      future.wait();
+      lock.lock();
+      if (launch_id == launch_id_) {
+        this->launch_collect();
+      }
+    }
+    this->launch_collect();
+  }
+
   PhysicalMemory ram_;
-  Processor processor_;
-  std::future<void> future_;
-  bool m_first;
+  Processor *processor_; // the backend in use, the other is null
+  Emulator *emulator_;
+  std::shared_future<int> future_;
+  int status_;
+  uint64_t csr_knl_addr_; // metadata block of the last launch
+  uint64_t launch_id_;
+  vx_launch_callback_t callback_; // for the next launch
+  void *callback_arg_;
+  mutable std::mutex mutex_; // launch state and allocations
+
+  uint32_t parallel_;               // models a launch is split over, VT_PARALLEL
+  uint32_t last_models_;            // models the last launch ran on
+  std::vector<Processor *> shards_; // models besides processor_
+  bool limits_set_;                 // limits apply to the shards created later
+  uint64_t max_cycles_;
+  uint64_t hang_cycles_;
 };
@@ -0,0 +1,1048 @@
+// Copyright © 2019-2023
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "emulator.h"
+#include "memory.h"
+#include "vt_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+constexpr uint32_t WARP_SIZE = hw::NUM_THREAD;
+using hw::NUM_WARP;
+
+#define FULL_MASK 0xffffffffu
+
+// local memory of the running workgroup, CSR_LDS points at its base
+// (lds_base_dispatch_h and NUMBER_LDS_SLOTS of the RTL)
+#define LDS_BASE_ADDR 0x70000000
+#define LDS_MEM_SIZE  hw::NUMBER_LDS_SLOTS
+
+// CSRs, define.v
+using hw::CSR_FCSR;
+using hw::CSR_FRM;
+using hw::CSR_RPC;
+using hw::CSR_VL;
+using hw::CSR_VTYPE;
+constexpr uint32_t CSR_TID = hw::CSR_THREADID;
+constexpr uint32_t CSR_NUMW = hw::CSR_WG_WF_COUNT;
+constexpr uint32_t CSR_NUMT = hw::CSR_WF_SIZE_DISPATCH;
+constexpr uint32_t CSR_KNL = hw::CSR_KNL_BASE;
+constexpr uint32_t CSR_WGID = hw::CSR_WG_ID;
+constexpr uint32_t CSR_WID = hw::CSR_WF_TAG_DISPATCH;
+constexpr uint32_t CSR_LDS = hw::CSR_LDS_BASE_DISPATCH;
+constexpr uint32_t CSR_PDS = hw::CSR_PDS_BASEADDR;
+constexpr uint32_t CSR_GID_X = hw::CSR_WG_ID_X;
+constexpr uint32_t CSR_GID_Y = hw::CSR_WG_ID_Y;
+constexpr uint32_t CSR_GID_Z = hw::CSR_WG_ID_Z;
+
+// major opcodes
+#define OPC_LOAD      0x03
+#define OPC_LOAD_FP   0x07 // vector loads
+#define OPC_CUSTOM0   0x0b // endprg, barrier, vadd12.vi, vsub12.vi
+#define OPC_MISC_MEM  0x0f
+#define OPC_OP_IMM    0x13
+#define OPC_AUIPC     0x17
+#define OPC_STORE     0x23
+#define OPC_STORE_FP  0x27 // vector stores
+#define OPC_OP        0x33
+#define OPC_LUI       0x37
+#define OPC_MADD      0x43
+#define OPC_MSUB      0x47
+#define OPC_NMSUB     0x4b
+#define OPC_NMADD     0x4f
+#define OPC_OP_FP     0x53
+#define OPC_OP_V      0x57
+#define OPC_VBRANCH   0x5b // vbeq .. vbgeu, join, setrpc
+#define OPC_BRANCH    0x63
+#define OPC_JALR      0x67
+#define OPC_JAL       0x6f
+#define OPC_SYSTEM    0x73
+#define OPC_VMEM12    0x7b // vlw12.v, vsw12.v and their widths
+
+// OP-V categories (funct3)
+#define OPIVV 0
+#define OPFVV 1
+#define OPMVV 2
+#define OPIVI 3
+#define OPIVX 4
+#define OPFVF 5
+#define OPMVX 6
+#define OPCFG 7
+
+// why a warp stopped running
+enum warp_stop_t { WARP_BARRIER, WARP_EXIT, WARP_FAULT, WARP_TIMEOUT, WARP_ABORT };
+
+static uint64_t env_u64(const char *name, uint64_t default_value) {
+  const char *value = std::getenv(name);
+  if (value == nullptr || *value == 0)
+    return default_value;
+  return std::strtoull(value, nullptr, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static inline float as_f32(uint32_t value) {
+  float f;
+  memcpy(&f, &value, 4);
+  return f;
+}
+
+static inline uint32_t as_u32(float value) {
+  uint32_t u;
+  memcpy(&u, &value, 4);
+  return u;
+}
+
+// RISC-V division, defined for a zero divisor and overflow
+static inline uint32_t rv_div(uint32_t a, uint32_t b) {
+  if (b == 0)
+    return FULL_MASK;
+  if (a == 0x80000000u && b == FULL_MASK)
+    return a;
+  return uint32_t(int32_t(a) / int32_t(b));
+}
+
+static inline uint32_t rv_divu(uint32_t a, uint32_t b) {
+  return (b == 0) ? FULL_MASK : a / b;
+}
+
+static inline uint32_t rv_rem(uint32_t a, uint32_t b) {
+  if (b == 0)
+    return a;
+  if (a == 0x80000000u && b == FULL_MASK)
+    return 0;
+  return uint32_t(int32_t(a) % int32_t(b));
+}
+
+static inline uint32_t rv_remu(uint32_t a, uint32_t b) {
+  return (b == 0) ? a : a % b;
+}
+
+static inline uint32_t rv_mulh(uint32_t a, uint32_t b) {
+  return uint32_t((int64_t(int32_t(a)) * int64_t(int32_t(b))) >> 32);
+}
+
+static inline uint32_t rv_mulhu(uint32_t a, uint32_t b) {
+  return uint32_t((uint64_t(a) * uint64_t(b)) >> 32);
+}
+
+static inline uint32_t rv_mulhsu(uint32_t a, uint32_t b) {
+  return uint32_t((int64_t(int32_t(a)) * int64_t(uint64_t(b))) >> 32);
+}
+
+// rounding of rm (RNE, RTZ, RDN, RUP, RMM), 7 defers to frm
+static inline float rv_round(float value, uint32_t rm) {
+  switch (rm) {
+  case 1: return std::trunc(value);
+  case 2: return std::floor(value);
+  case 3: return std::ceil(value);
+  case 4: return std::round(value);
+  default: return std::nearbyint(value);
+  }
+}
+
+// saturating conversions, NaN converts to the largest value
+static inline uint32_t rv_f2i(float value, uint32_t rm) {
+  if (std::isnan(value))
+    return 0x7fffffff;
+  float r = rv_round(value, rm);
+  if (r >= 2147483648.0f)
+    return 0x7fffffff;
+  if (r < -2147483648.0f)
+    return 0x80000000u;
+  return uint32_t(int32_t(r));
+}
+
+static inline uint32_t rv_f2u(float value, uint32_t rm) {
+  if (std::isnan(value))
+    return FULL_MASK;
+  float r = rv_round(value, rm);
+  if (r >= 4294967296.0f)
+    return FULL_MASK;
+  if (r <= 0.0f)
+    return 0;
+  return uint32_t(r);
+}
+
+static inline uint32_t rv_fmin(uint32_t a, uint32_t b) {
+  float fa = as_f32(a), fb = as_f32(b);
+  if (std::isnan(fa))
+    return std::isnan(fb) ? 0x7fc00000 : b;
+  if (std::isnan(fb))
+    return a;
+  return (fa < fb || (fa == fb && (a >> 31))) ? a : b;
+}
+
+static inline uint32_t rv_fmax(uint32_t a, uint32_t b) {
+  float fa = as_f32(a), fb = as_f32(b);
+  if (std::isnan(fa))
+    return std::isnan(fb) ? 0x7fc00000 : b;
+  if (std::isnan(fb))
+    return a;
+  return (fa > fb || (fa == fb && !(b >> 31))) ? a : b;
+}
+
+static inline uint32_t rv_fclass(uint32_t a) {
+  float f = as_f32(a);
+  bool sign = a >> 31;
+  if (std::isinf(f))
+    return sign ? 0x001 : 0x080;
+  if (std::isnan(f))
+    return (a & 0x00400000) ? 0x200 : 0x100;
+  if (f == 0.0f)
+    return sign ? 0x008 : 0x010;
+  if (std::fpclassify(f) == FP_SUBNORMAL)
+    return sign ? 0x004 : 0x020;
+  return sign ? 0x002 : 0x040;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class Emulator::Impl {
+public:
+  Impl() : ram_(nullptr), info_(), lds_(LDS_MEM_SIZE, 0), instrs_(0), abort_(false) {
+    max_instrs_ = env_u64("VT_MAX_CYCLES", DEFAULT_MAX_CYCLES);
+    this->perf_reset();
+  }
+
+  void attach_ram(PhysicalMemory *ram) { ram_ = ram; }
+
+  void limits(uint64_t max_instrs) { max_instrs_ = max_instrs; }
+
+  void private_segment(uint32_t base_addr) { info_.pds_baseaddr = base_addr; }
+
+  void abort() { abort_ = true; }
+
+  void launch(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+    this->parse_metadata(metadata, csr_knl_addr);
+    instrs_ = 0;
+    abort_ = false;
+    this->perf_reset();
+  }
+
+  int run(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+    this->launch(metadata, csr_knl_addr);
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t num_wgs = info_.dim_grid.x * info_.dim_grid.y * info_.dim_grid.z;
+    int status = VX_LAUNCH_COMPLETED;
+    for (uint32_t i = 0; i < num_wgs && status == VX_LAUNCH_COMPLETED; ++i) {
+      status = this->run_workgroup(i);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "launch: %lu instructions in %.3f s, %u workgroups, functional",
+           instrs_, seconds, (uint32_t)perf_[VX_PERF_CTAS][0]);
+    return status;
+  }
+
+  int perf_query(uint32_t counter, uint32_t index, uint64_t *value) const {
+    if (counter >= VX_PERF_COUNT)
+      return -1;
+    auto &units = perf_[counter];
+    if (index == VX_PERF_ALL) {
+      uint64_t total = 0;
+      for (auto count : units) {
+        total += count;
+      }
+      *value = total;
+      return 0;
+    }
+    if (index >= units.size())
+      return -1;
+    *value = units[index];
+    return 0;
+  }
+
+  int run_workgroup(uint32_t index) {
+    info_.wg_id = index;
+    info_.grid_idx.x = index % info_.dim_grid.x;
+    info_.grid_idx.y = (index / info_.dim_grid.x) % info_.dim_grid.y;
+    info_.grid_idx.z = index / (info_.dim_grid.x * info_.dim_grid.y);
+
+    for (uint32_t i = 0; i < info_.num_warps; ++i) {
+      auto &w = warps_[i];
+      uint32_t lanes = std::min<uint32_t>(num_threads_ - i * WARP_SIZE, WARP_SIZE);
+      w.id = i;
+      w.pc = info_.start_pc;
+      w.full_mask = (lanes == WARP_SIZE) ? FULL_MASK : ((1u << lanes) - 1);
+      w.mask = w.full_mask;
+      w.rpc = 0;
+      w.done = false;
+      w.at_barrier = false;
+      memset(w.x, 0, sizeof(w.x));
+      memset(w.v, 0, sizeof(w.v));
+      w.stack.clear();
+      w.csrs.clear();
+    }
+
+    // the warps take turns, each runs until it reaches a barrier or ends;
+    // the barrier opens once every warp still running waits at it
+    for (;;) {
+      uint32_t live = 0;
+      for (auto &w : warps_) {
+        if (w.done)
+          continue;
+        if (!w.at_barrier) {
+          switch (this->run_warp(w)) {
+          case WARP_FAULT:
+            return VX_LAUNCH_FAULT;
+          case WARP_TIMEOUT:
+            return VX_LAUNCH_TIMEOUT;
+          case WARP_ABORT:
+            return VX_LAUNCH_ABORTED;
+          default:
+            break;
+          }
+        }
+        if (!w.done)
+          ++live;
+      }
+      if (live == 0)
+        break;
+      for (auto &w : warps_) {
+        w.at_barrier = false;
+      }
+    }
+    perf_[VX_PERF_CTAS][0]++;
+    return VX_LAUNCH_COMPLETED;
+  }
+
+private:
+  struct simt_entry_t {
+    uint32_t rpc;  // join that pops the entry
+    uint32_t pc;   // where the lanes of the entry resume
+    uint32_t mask;
+  };
+
+  struct warp_t {
+    uint32_t id;
+    uint32_t pc;
+    uint32_t mask;      // active lanes
+    uint32_t full_mask; // lanes of the warp
+    uint32_t rpc;       // reconvergence pc of the next divergent branch
+    bool done;
+    bool at_barrier;
+    uint32_t x[32];
+    uint32_t v[32][WARP_SIZE];
+    std::vector<simt_entry_t> stack;
+    std::unordered_map<uint32_t, uint32_t> csrs; // written CSRs
+  };
+
+  void parse_metadata(const metadata_buffer_t &metadata, uint64_t csr_knl_addr) {
+    info_.dim_grid.x = metadata.knl_gl_size_x / metadata.knl_lc_size_x;
+    info_.dim_grid.y = metadata.knl_gl_size_y / metadata.knl_lc_size_y;
+    info_.dim_grid.z = metadata.knl_gl_size_z / metadata.knl_lc_size_z;
+    // a partial last warp runs with the lanes past the workgroup disabled
+    num_threads_ = metadata.knl_lc_size_x * metadata.knl_lc_size_y * metadata.knl_lc_size_z;
+    info_.num_warps = (num_threads_ + WARP_SIZE - 1) / WARP_SIZE;
+    info_.warp_size = WARP_SIZE;
+    info_.start_pc = metadata.knl_start_pc ? metadata.knl_start_pc : USER_BASE_ADDR;
+    info_.csr_knl = (uint32_t)csr_knl_addr;
+    warps_.resize(info_.num_warps);
+  }
+
+  void perf_reset() {
+    for (uint32_t i = 0; i < VX_PERF_COUNT; ++i) {
+      perf_[i].assign((i == VX_PERF_WARP_INSTRS) ? NUM_WARP : 1, 0);
+    }
+  }
+
+  int run_warp(warp_t &w) {
+    uint64_t count = 0;
+    int stop;
+    for (;;) {
+      if (abort_) {
+        stop = WARP_ABORT;
+        break;
+      }
+      if (max_instrs_ && instrs_ + count >= max_instrs_) {
+        stop = WARP_TIMEOUT;
+        break;
+      }
+      uint32_t inst = 0;
+      ram_->read(w.pc, &inst, 4);
+      ++count;
+      stop = this->step(w, inst);
+      if (stop >= 0)
+        break;
+    }
+    instrs_ += count;
+    perf_[VX_PERF_INSTRS][0] += count;
+    perf_[VX_PERF_WARP_INSTRS][std::min<uint32_t>(w.id, NUM_WARP - 1)] += count;
+    return stop;
+  }
+
+  // memory of the workgroup, the local memory window is served here
+  template <typename T> T load(uint32_t addr) {
+    T value;
+    if (addr - LDS_BASE_ADDR <= LDS_MEM_SIZE - sizeof(T)) {
+      memcpy(&value, &lds_[addr - LDS_BASE_ADDR], sizeof(T));
+    } else {
+      ram_->read(addr, &value, sizeof(T));
+    }
+    return value;
+  }
+
+  template <typename T> void store(uint32_t addr, T value) {
+    if (addr - LDS_BASE_ADDR <= LDS_MEM_SIZE - sizeof(T)) {
+      memcpy(&lds_[addr - LDS_BASE_ADDR], &value, sizeof(T));
+    } else {
+      ram_->write(addr, &value, sizeof(T));
+    }
+  }
+
+  uint32_t load_width(uint32_t addr, uint32_t funct3) {
+    switch (funct3) {
+    case 0: return uint32_t(int32_t(this->load<int8_t>(addr)));
+    case 1: return uint32_t(int32_t(this->load<int16_t>(addr)));
+    case 4: return this->load<uint8_t>(addr);
+    case 5: return this->load<uint16_t>(addr);
+    default: return this->load<uint32_t>(addr);
+    }
+  }
+
+  void store_width(uint32_t addr, uint32_t value, uint32_t funct3) {
+    switch (funct3 & 3) {
+    case 0: this->store<uint8_t>(addr, value); break;
+    case 1: this->store<uint16_t>(addr, value); break;
+    default: this->store<uint32_t>(addr, value); break;
+    }
+  }
+
+  uint32_t csr_read(const warp_t &w, uint32_t addr) const {
+    switch (addr) {
+    case CSR_TID: return w.id * WARP_SIZE;
+    case CSR_NUMW: return info_.num_warps;
+    case CSR_NUMT: return WARP_SIZE;
+    case CSR_KNL: return info_.csr_knl;
+    case CSR_WGID: return info_.wg_id;
+    case CSR_WID: return w.id;
+    case CSR_LDS: return LDS_BASE_ADDR;
+    case CSR_PDS: return info_.pds_baseaddr;
+    case CSR_GID_X: return info_.grid_idx.x;
+    case CSR_GID_Y: return info_.grid_idx.y;
+    case CSR_GID_Z: return info_.grid_idx.z;
+    case CSR_RPC: return w.rpc;
+    default: {
+      auto it = w.csrs.find(addr);
+      return (it != w.csrs.end()) ? it->second : 0;
+    }
+    }
+  }
+
+  void csr_write(warp_t &w, uint32_t addr, uint32_t value) {
+    if (addr == CSR_RPC) {
+      w.rpc = value;
+    } else if (addr < CSR_TID || addr > CSR_GID_Z) {
+      // the dispatch CSRs are read-only
+      w.csrs[addr] = value;
+    }
+  }
+
+  void fault(const warp_t &w, uint32_t inst) {
+    VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM,
+           "functional: unsupported instruction 0x%08x at pc 0x%08x (workgroup %u, warp %u)",
+           inst, w.pc, info_.wg_id, w.id);
+  }
+
+  // executes one instruction, returns WARP_* when the warp stops, -1 to go on
+  int step(warp_t &w, uint32_t inst) {
+    uint32_t opcode = inst & 0x7f;
+    uint32_t rd = (inst >> 7) & 0x1f;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t rs1 = (inst >> 15) & 0x1f;
+    uint32_t rs2 = (inst >> 20) & 0x1f;
+    uint32_t funct7 = inst >> 25;
+    uint32_t imm_i = uint32_t(int32_t(inst) >> 20);
+    uint32_t imm_s = (uint32_t(int32_t(inst) >> 25) << 5) | rd;
+    uint32_t imm_b = (uint32_t(int32_t(inst) >> 31) << 12) | (((inst >> 7) & 1) << 11) |
+                     (((inst >> 25) & 0x3f) << 5) | (((inst >> 8) & 0xf) << 1);
+    uint32_t imm_j = (uint32_t(int32_t(inst) >> 31) << 20) | (inst & 0xff000) |
+                     (((inst >> 20) & 1) << 11) | (((inst >> 21) & 0x3ff) << 1);
+    uint32_t *x = w.x;
+    uint32_t a = x[rs1], b = x[rs2];
+    uint32_t next_pc = w.pc + 4;
+    uint32_t result = 0;
+    bool write_rd = true;
+
+    switch (opcode) {
+    case OPC_LUI:
+      result = inst & 0xfffff000;
+      break;
+    case OPC_AUIPC:
+      result = w.pc + (inst & 0xfffff000);
+      break;
+    case OPC_JAL:
+      result = next_pc;
+      next_pc = w.pc + imm_j;
+      break;
+    case OPC_JALR:
+      result = next_pc;
+      next_pc = (a + imm_i) & ~1u;
+      break;
+    case OPC_BRANCH: {
+      bool taken;
+      switch (funct3) {
+      case 0: taken = (a == b); break;
+      case 1: taken = (a != b); break;
+      case 4: taken = (int32_t(a) < int32_t(b)); break;
+      case 5: taken = (int32_t(a) >= int32_t(b)); break;
+      case 6: taken = (a < b); break;
+      case 7: taken = (a >= b); break;
+      default: this->fault(w, inst); return WARP_FAULT;
+      }
+      if (taken)
+        next_pc = w.pc + imm_b;
+      write_rd = false;
+    } break;
+    case OPC_LOAD:
+      if (funct3 == 3 || funct3 > 5) {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      result = this->load_width(a + imm_i, funct3);
+      break;
+    case OPC_STORE:
+      if (funct3 > 2) {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      this->store_width(a + imm_s, b, funct3);
+      write_rd = false;
+      break;
+    case OPC_OP_IMM: {
+      uint32_t shamt = rs2;
+      switch (funct3) {
+      case 0: result = a + imm_i; break;
+      case 1: result = a << shamt; break;
+      case 2: result = int32_t(a) < int32_t(imm_i); break;
+      case 3: result = a < imm_i; break;
+      case 4: result = a ^ imm_i; break;
+      case 5: result = (funct7 & 0x20) ? uint32_t(int32_t(a) >> shamt) : (a >> shamt); break;
+      case 6: result = a | imm_i; break;
+      default: result = a & imm_i; break;
+      }
+    } break;
+    case OPC_OP:
+      if (funct7 == 0x01) {
+        switch (funct3) {
+        case 0: result = a * b; break;
+        case 1: result = rv_mulh(a, b); break;
+        case 2: result = rv_mulhsu(a, b); break;
+        case 3: result = rv_mulhu(a, b); break;
+        case 4: result = rv_div(a, b); break;
+        case 5: result = rv_divu(a, b); break;
+        case 6: result = rv_rem(a, b); break;
+        default: result = rv_remu(a, b); break;
+        }
+      } else if (funct7 == 0x00 || funct7 == 0x20) {
+        switch (funct3) {
+        case 0: result = funct7 ? a - b : a + b; break;
+        case 1: result = a << (b & 31); break;
+        case 2: result = int32_t(a) < int32_t(b); break;
+        case 3: result = a < b; break;
+        case 4: result = a ^ b; break;
+        case 5: result = funct7 ? uint32_t(int32_t(a) >> (b & 31)) : (a >> (b & 31)); break;
+        case 6: result = a | b; break;
+        default: result = a & b; break;
+        }
+      } else {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      break;
+    case OPC_MISC_MEM:
+      // memory is coherent at every access
+      write_rd = false;
+      break;
+    case OPC_SYSTEM: {
+      if (funct3 == 0 || funct3 == 4) {
+        // ecall/ebreak, nothing to trap to
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      uint32_t csr = inst >> 20;
+      uint32_t src = (funct3 & 4) ? rs1 : a;
+      result = this->csr_read(w, csr);
+      switch (funct3 & 3) {
+      case 1: this->csr_write(w, csr, src); break;
+      case 2: if (rs1) this->csr_write(w, csr, result | src); break;
+      default: if (rs1) this->csr_write(w, csr, result & ~src); break;
+      }
+    } break;
+    case OPC_OP_FP:
+      if (!this->exec_fp(w, inst, &result)) {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      break;
+    case OPC_MADD:
+    case OPC_MSUB:
+    case OPC_NMSUB:
+    case OPC_NMADD: {
+      if (funct7 & 3) {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      float fa = as_f32(a), fb = as_f32(b), fc = as_f32(x[inst >> 27]);
+      switch (opcode) {
+      case OPC_MADD: result = as_u32(std::fma(fa, fb, fc)); break;
+      case OPC_MSUB: result = as_u32(std::fma(fa, fb, -fc)); break;
+      case OPC_NMSUB: result = as_u32(std::fma(-fa, fb, fc)); break;
+      default: result = as_u32(std::fma(-fa, fb, -fc)); break;
+      }
+    } break;
+    case OPC_CUSTOM0:
+      write_rd = false;
+      if (funct3 == 4) {
+        if (funct7 == 0x00) {
+          // endprg
+          w.done = true;
+          w.pc = next_pc;
+          return WARP_EXIT;
+        }
+        if (funct7 == 0x02 || funct7 == 0x03) {
+          // barrier, barriersub
+          w.at_barrier = true;
+          w.pc = next_pc;
+          return WARP_BARRIER;
+        }
+      } else if (funct3 == 0 || funct3 == 1) {
+        // vadd12.vi, vsub12.vi
+        uint32_t imm = (funct3 == 0) ? imm_i : -imm_i;
+        const uint32_t *vs = w.v[rs1];
+        this->vexec(w, rd, [&](uint32_t l) { return vs[l] + imm; });
+        break;
+      }
+      this->fault(w, inst);
+      return WARP_FAULT;
+    case OPC_VBRANCH:
+      write_rd = false;
+      if (funct3 == 3) {
+        // setrpc
+        w.rpc = a + imm_i;
+      } else if (funct3 == 2) {
+        // join, pops the entry waiting at this pc
+        if (!w.stack.empty() && w.stack.back().rpc == w.pc) {
+          next_pc = w.stack.back().pc;
+          w.mask = w.stack.back().mask;
+          w.stack.pop_back();
+        }
+        if (w.stack.empty()) {
+          w.mask = w.full_mask;
+        }
+      } else {
+        next_pc = this->vbranch(w, funct3, rs1, rs2, imm_b);
+      }
+      break;
+    case OPC_OP_V:
+      // vsetvli and vmv.x.s write their scalar result themselves
+      write_rd = false;
+      if (!this->exec_opv(w, inst)) {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      break;
+    case OPC_VMEM12: {
+      // per lane address vs1 + imm, loads take the I immediate, stores the S
+      const uint32_t *base = w.v[rs1];
+      write_rd = false;
+      if (funct3 == 3 || funct3 >= 6) {
+        // vsh12 011, vsw12 110, vsb12 111
+        uint32_t size = (funct3 == 3) ? 1 : ((funct3 == 6) ? 2 : 0);
+        const uint32_t *data = w.v[rs2];
+        this->for_lanes(w.mask, [&](uint32_t l) { this->store_width(base[l] + imm_s, data[l], size); });
+      } else {
+        uint32_t *vd = w.v[rd];
+        this->for_lanes(w.mask, [&](uint32_t l) { vd[l] = this->load_width(base[l] + imm_i, funct3); });
+      }
+    } break;
+    case OPC_LOAD_FP:
+    case OPC_STORE_FP:
+      write_rd = false;
+      if (!this->exec_vmem(w, inst)) {
+        this->fault(w, inst);
+        return WARP_FAULT;
+      }
+      break;
+    default:
+      this->fault(w, inst);
+      return WARP_FAULT;
+    }
+
+    if (write_rd && rd != 0) {
+      x[rd] = result;
+    }
+    w.pc = next_pc;
+    return -1;
+  }
+
+  // divergent branches follow the SIMT stack of the RTL (simt_stack.v): the
+  // smaller side runs first, the other side and the reconvergence entry wait
+  // on the stack for the join at rpc
+  uint32_t vbranch(warp_t &w, uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t imm) {
+    const uint32_t *va = w.v[rs1], *vb = w.v[rs2];
+    uint32_t taken = 0;
+    for (uint32_t l = 0; l < WARP_SIZE; ++l) {
+      bool cond;
+      switch (funct3) {
+      case 0: cond = (va[l] == vb[l]); break;
+      case 1: cond = (va[l] != vb[l]); break;
+      case 4: cond = (int32_t(va[l]) < int32_t(vb[l])); break;
+      case 5: cond = (int32_t(va[l]) >= int32_t(vb[l])); break;
+      case 6: cond = (va[l] < vb[l]); break;
+      default: cond = (va[l] >= vb[l]); break;
+      }
+      taken |= uint32_t(cond) << l;
+    }
+    uint32_t target = w.pc + imm;
+    uint32_t else_mask = taken & w.mask;
+    uint32_t if_mask = ~taken & w.mask;
+    if (else_mask == 0)
+      return w.pc + 4;
+    if (if_mask == 0)
+      return target;
+    w.stack.push_back({w.rpc, w.rpc, w.mask});
+    if (__builtin_popcount(if_mask) < __builtin_popcount(else_mask)) {
+      w.stack.push_back({w.rpc, target, else_mask});
+      w.mask = if_mask;
+      return w.pc + 4;
+    }
+    w.stack.push_back({w.rpc, w.pc + 4, if_mask});
+    w.mask = else_mask;
+    return target;
+  }
+
+  template <typename F> static void for_lanes(uint32_t mask, F f) {
+    for (uint32_t l = 0; l < WARP_SIZE; ++l) {
+      if ((mask >> l) & 1)
+        f(l);
+    }
+  }
+
+  // vd = op(lane) on the active lanes; every lane is computed and merged
+  // under the mask so that the loops stay branch-free and vectorize
+  template <typename F> static void vexec(warp_t &w, uint32_t vd, F op) {
+    uint32_t result[WARP_SIZE];
+    for (uint32_t l = 0; l < WARP_SIZE; ++l) {
+      result[l] = op(l);
+    }
+    uint32_t *dst = w.v[vd];
+    for (uint32_t l = 0; l < WARP_SIZE; ++l) {
+      dst[l] = ((w.mask >> l) & 1) ? result[l] : dst[l];
+    }
+  }
+
+  // scalar single precision on the integer registers (Zfinx)
+  bool exec_fp(warp_t &w, uint32_t inst, uint32_t *result) {
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t rs2 = (inst >> 20) & 0x1f;
+    uint32_t funct7 = inst >> 25;
+    uint32_t a = w.x[(inst >> 15) & 0x1f], b = w.x[rs2];
+    float fa = as_f32(a), fb = as_f32(b);
+    uint32_t rm = (funct3 == 7) ? (this->csr_read(w, CSR_FRM) & 7) : funct3;
+    switch (funct7) {
+    case 0x00: *result = as_u32(fa + fb); break;
+    case 0x04: *result = as_u32(fa - fb); break;
+    case 0x08: *result = as_u32(fa * fb); break;
+    case 0x0c: *result = as_u32(fa / fb); break;
+    case 0x2c: *result = as_u32(std::sqrt(fa)); break;
+    case 0x10:
+      switch (funct3) {
+      case 0: *result = (a & 0x7fffffff) | (b & 0x80000000); break;
+      case 1: *result = (a & 0x7fffffff) | (~b & 0x80000000); break;
+      case 2: *result = a ^ (b & 0x80000000); break;
+      default: return false;
+      }
+      break;
+    case 0x14:
+      *result = (funct3 == 0) ? rv_fmin(a, b) : rv_fmax(a, b);
+      break;
+    case 0x50:
+      switch (funct3) {
+      case 0: *result = (fa <= fb); break;
+      case 1: *result = (fa < fb); break;
+      case 2: *result = (fa == fb); break;
+      default: return false;
+      }
+      break;
+    case 0x60:
+      *result = (rs2 == 0) ? rv_f2i(fa, rm) : rv_f2u(fa, rm);
+      break;
+    case 0x68:
+      *result = (rs2 == 0) ? as_u32(float(int32_t(a))) : as_u32(float(a));
+      break;
+    case 0x70:
+      if (funct3 != 1)
+        return false;
+      *result = rv_fclass(a);
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  // OP-V, one element per lane; vsetvli answers the warp width
+  bool exec_opv(warp_t &w, uint32_t inst) {
+    uint32_t vd = (inst >> 7) & 0x1f;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t rs1 = (inst >> 15) & 0x1f;
+    uint32_t vs2 = (inst >> 20) & 0x1f;
+    uint32_t funct6 = inst >> 26;
+    bool vm = (inst >> 25) & 1;
+
+    if (funct3 == OPCFG) {
+      uint32_t avl, vtype;
+      if ((inst >> 30) == 3) {
+        avl = rs1;
+        vtype = (inst >> 20) & 0x3ff;
+      } else {
+        avl = (rs1 == 0) ? WARP_SIZE : w.x[rs1];
+        vtype = (inst >> 31) ? w.x[vs2] : ((inst >> 20) & 0x7ff);
+      }
+      uint32_t vl = std::min<uint32_t>(avl, WARP_SIZE);
+      w.csrs[CSR_VL] = vl;
+      w.csrs[CSR_VTYPE] = vtype;
+      if (vd)
+        w.x[vd] = vl;
+      return true;
+    }
+
+    // the second operand, broadcast for the scalar and immediate forms
+    uint32_t opb[WARP_SIZE];
+    switch (funct3) {
+    case OPIVV:
+    case OPFVV:
+    case OPMVV:
+      memcpy(opb, w.v[rs1], sizeof(opb));
+      break;
+    case OPIVI:
+      std::fill(opb, opb + WARP_SIZE, uint32_t(int32_t(rs1 << 27) >> 27));
+      break;
+    default:
+      std::fill(opb, opb + WARP_SIZE, w.x[rs1]);
+      break;
+    }
+    const uint32_t *opa = w.v[vs2];
+    const uint32_t *acc = w.v[vd];
+
+    if (funct3 == OPIVV || funct3 == OPIVI || funct3 == OPIVX) {
+      switch (funct6) {
+      case 0x00: this->vexec(w, vd, [&](uint32_t l) { return opa[l] + opb[l]; }); break;
+      case 0x02: this->vexec(w, vd, [&](uint32_t l) { return opa[l] - opb[l]; }); break;
+      case 0x03: this->vexec(w, vd, [&](uint32_t l) { return opb[l] - opa[l]; }); break;
+      case 0x04: this->vexec(w, vd, [&](uint32_t l) { return std::min(opa[l], opb[l]); }); break;
+      case 0x05: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(std::min(int32_t(opa[l]), int32_t(opb[l]))); }); break;
+      case 0x06: this->vexec(w, vd, [&](uint32_t l) { return std::max(opa[l], opb[l]); }); break;
+      case 0x07: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(std::max(int32_t(opa[l]), int32_t(opb[l]))); }); break;
+      case 0x09: this->vexec(w, vd, [&](uint32_t l) { return opa[l] & opb[l]; }); break;
+      case 0x0a: this->vexec(w, vd, [&](uint32_t l) { return opa[l] | opb[l]; }); break;
+      case 0x0b: this->vexec(w, vd, [&](uint32_t l) { return opa[l] ^ opb[l]; }); break;
+      case 0x17: {
+        // vmv.v.*, or vmerge under the per-lane condition in v0
+        const uint32_t *v0 = w.v[0];
+        this->vexec(w, vd, [&](uint32_t l) { return (vm || (v0[l] & 1)) ? opb[l] : opa[l]; });
+      } break;
+      // comparisons leave 0/1 in every lane, the per-thread predicate
+      case 0x18: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(opa[l] == opb[l]); }); break;
+      case 0x19: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(opa[l] != opb[l]); }); break;
+      case 0x1a: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(opa[l] < opb[l]); }); break;
+      case 0x1b: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(int32_t(opa[l]) < int32_t(opb[l])); }); break;
+      case 0x1c: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(opa[l] <= opb[l]); }); break;
+      case 0x1d: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(int32_t(opa[l]) <= int32_t(opb[l])); }); break;
+      case 0x1e: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(opa[l] > opb[l]); }); break;
+      case 0x1f: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(int32_t(opa[l]) > int32_t(opb[l])); }); break;
+      case 0x25: this->vexec(w, vd, [&](uint32_t l) { return opa[l] << (opb[l] & 31); }); break;
+      case 0x28: this->vexec(w, vd, [&](uint32_t l) { return opa[l] >> (opb[l] & 31); }); break;
+      case 0x29: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(int32_t(opa[l]) >> (opb[l] & 31)); }); break;
+      default: return false;
+      }
+      return true;
+    }
+
+    if (funct3 == OPMVV || funct3 == OPMVX) {
+      switch (funct6) {
+      case 0x10:
+        if (funct3 == OPMVV && rs1 == 0) {
+          // vmv.x.s
+          if (vd)
+            w.x[vd] = opa[0];
+        } else if (funct3 == OPMVX && vs2 == 0) {
+          // vmv.s.x
+          w.v[vd][0] = opb[0];
+        } else {
+          return false;
+        }
+        break;
+      case 0x14:
+        if (funct3 != OPMVV || rs1 != 0x11)
+          return false;
+        // vid.v
+        this->vexec(w, vd, [](uint32_t l) { return l; });
+        break;
+      case 0x20: this->vexec(w, vd, [&](uint32_t l) { return rv_divu(opa[l], opb[l]); }); break;
+      case 0x21: this->vexec(w, vd, [&](uint32_t l) { return rv_div(opa[l], opb[l]); }); break;
+      case 0x22: this->vexec(w, vd, [&](uint32_t l) { return rv_remu(opa[l], opb[l]); }); break;
+      case 0x23: this->vexec(w, vd, [&](uint32_t l) { return rv_rem(opa[l], opb[l]); }); break;
+      case 0x24: this->vexec(w, vd, [&](uint32_t l) { return rv_mulhu(opa[l], opb[l]); }); break;
+      case 0x25: this->vexec(w, vd, [&](uint32_t l) { return opa[l] * opb[l]; }); break;
+      case 0x26: this->vexec(w, vd, [&](uint32_t l) { return rv_mulhsu(opa[l], opb[l]); }); break;
+      case 0x27: this->vexec(w, vd, [&](uint32_t l) { return rv_mulh(opa[l], opb[l]); }); break;
+      case 0x29: this->vexec(w, vd, [&](uint32_t l) { return opb[l] * acc[l] + opa[l]; }); break;
+      case 0x2b: this->vexec(w, vd, [&](uint32_t l) { return opa[l] - opb[l] * acc[l]; }); break;
+      case 0x2d: this->vexec(w, vd, [&](uint32_t l) { return opb[l] * opa[l] + acc[l]; }); break;
+      case 0x2f: this->vexec(w, vd, [&](uint32_t l) { return acc[l] - opb[l] * opa[l]; }); break;
+      default: return false;
+      }
+      return true;
+    }
+
+    // OPFVV, OPFVF
+    auto fa = [&](uint32_t l) { return as_f32(opa[l]); };
+    auto fb = [&](uint32_t l) { return as_f32(opb[l]); };
+    auto fd = [&](uint32_t l) { return as_f32(acc[l]); };
+    uint32_t rm = this->csr_read(w, CSR_FRM) & 7;
+    switch (funct6) {
+    case 0x00: this->vexec(w, vd, [&](uint32_t l) { return as_u32(fa(l) + fb(l)); }); break;
+    case 0x02: this->vexec(w, vd, [&](uint32_t l) { return as_u32(fa(l) - fb(l)); }); break;
+    case 0x27: this->vexec(w, vd, [&](uint32_t l) { return as_u32(fb(l) - fa(l)); }); break;
+    case 0x24: this->vexec(w, vd, [&](uint32_t l) { return as_u32(fa(l) * fb(l)); }); break;
+    case 0x20: this->vexec(w, vd, [&](uint32_t l) { return as_u32(fa(l) / fb(l)); }); break;
+    case 0x21: this->vexec(w, vd, [&](uint32_t l) { return as_u32(fb(l) / fa(l)); }); break;
+    case 0x04: this->vexec(w, vd, [&](uint32_t l) { return rv_fmin(opa[l], opb[l]); }); break;
+    case 0x06: this->vexec(w, vd, [&](uint32_t l) { return rv_fmax(opa[l], opb[l]); }); break;
+    case 0x08: this->vexec(w, vd, [&](uint32_t l) { return (opa[l] & 0x7fffffff) | (opb[l] & 0x80000000); }); break;
+    case 0x09: this->vexec(w, vd, [&](uint32_t l) { return (opa[l] & 0x7fffffff) | (~opb[l] & 0x80000000); }); break;
+    case 0x0a: this->vexec(w, vd, [&](uint32_t l) { return opa[l] ^ (opb[l] & 0x80000000); }); break;
+    case 0x17: {
+      // vfmv.v.f, or vfmerge under v0
+      const uint32_t *v0 = w.v[0];
+      this->vexec(w, vd, [&](uint32_t l) { return (vm || (v0[l] & 1)) ? opb[l] : opa[l]; });
+    } break;
+    case 0x18: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(fa(l) == fb(l)); }); break;
+    case 0x19: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(fa(l) <= fb(l)); }); break;
+    case 0x1b: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(fa(l) < fb(l)); }); break;
+    case 0x1c: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(fa(l) != fb(l)); }); break;
+    case 0x1d: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(fa(l) > fb(l)); }); break;
+    case 0x1f: this->vexec(w, vd, [&](uint32_t l) { return uint32_t(fa(l) >= fb(l)); }); break;
+    case 0x12:
+      // VFUNARY0, the conversions
+      switch (rs1) {
+      case 0x00: this->vexec(w, vd, [&](uint32_t l) { return rv_f2u(fa(l), rm); }); break;
+      case 0x01: this->vexec(w, vd, [&](uint32_t l) { return rv_f2i(fa(l), rm); }); break;
+      case 0x02: this->vexec(w, vd, [&](uint32_t l) { return as_u32(float(opa[l])); }); break;
+      case 0x03: this->vexec(w, vd, [&](uint32_t l) { return as_u32(float(int32_t(opa[l]))); }); break;
+      case 0x06: this->vexec(w, vd, [&](uint32_t l) { return rv_f2u(fa(l), 1); }); break;
+      case 0x07: this->vexec(w, vd, [&](uint32_t l) { return rv_f2i(fa(l), 1); }); break;
+      default: return false;
+      }
+      break;
+    case 0x13:
+      if (rs1 != 0)
+        return false;
+      this->vexec(w, vd, [&](uint32_t l) { return as_u32(std::sqrt(fa(l))); });
+      break;
+    case 0x28: this->vexec(w, vd, [&](uint32_t l) { return as_u32(std::fma(fd(l), fb(l), fa(l))); }); break;
+    case 0x2a: this->vexec(w, vd, [&](uint32_t l) { return as_u32(std::fma(fd(l), fb(l), -fa(l))); }); break;
+    case 0x2c: this->vexec(w, vd, [&](uint32_t l) { return as_u32(std::fma(fb(l), fa(l), fd(l))); }); break;
+    case 0x2d: this->vexec(w, vd, [&](uint32_t l) { return as_u32(-std::fma(fb(l), fa(l), fd(l))); }); break;
+    case 0x2e: this->vexec(w, vd, [&](uint32_t l) { return as_u32(std::fma(fb(l), fa(l), -fd(l))); }); break;
+    case 0x2f: this->vexec(w, vd, [&](uint32_t l) { return as_u32(-std::fma(fb(l), fa(l), -fd(l))); }); break;
+    default: return false;
+    }
+    return true;
+  }
+
+  // RVV loads and stores, element l belongs to lane l
+  bool exec_vmem(warp_t &w, uint32_t inst) {
+    uint32_t vd = (inst >> 7) & 0x1f;
+    uint32_t width = (inst >> 12) & 0x7;
+    uint32_t rs1 = (inst >> 15) & 0x1f;
+    uint32_t rs2 = (inst >> 20) & 0x1f;
+    uint32_t mop = (inst >> 26) & 0x3;
+    uint32_t nf = inst >> 29;
+    bool store = ((inst & 0x7f) == OPC_STORE_FP);
+    uint32_t funct3, size;
+    switch (width) {
+    case 0: funct3 = store ? 0 : 4; size = 1; break;
+    case 5: funct3 = store ? 1 : 5; size = 2; break;
+    case 6: funct3 = 2; size = 4; break;
+    default: return false;
+    }
+    if (nf != 0 || (mop == 0 && rs2 != 0))
+      return false;
+
+    uint32_t base = w.x[rs1];
+    uint32_t addr[WARP_SIZE];
+    for (uint32_t l = 0; l < WARP_SIZE; ++l) {
+      switch (mop) {
+      case 0: addr[l] = base + l * size; break;
+      case 2: addr[l] = base + l * w.x[rs2]; break;
+      default: addr[l] = base + w.v[rs2][l]; break;
+      }
+    }
+    uint32_t *data = w.v[vd];
+    if (store) {
+      this->for_lanes(w.mask, [&](uint32_t l) { this->store_width(addr[l], data[l], funct3); });
+    } else {
+      this->for_lanes(w.mask, [&](uint32_t l) { data[l] = this->load_width(addr[l], funct3); });
+    }
+    return true;
+  }
+
+  PhysicalMemory *ram_;
+  dispatch_info_t info_;
+  uint32_t num_threads_;
+  std::vector<warp_t> warps_;
+  std::vector<uint8_t> lds_;
+  std::vector<uint64_t> perf_[VX_PERF_COUNT];
+  uint64_t instrs_;
+  uint64_t max_instrs_;
+  std::atomic<bool> abort_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+Emulator::Emulator() : impl_(new Impl()) {}
+
+Emulator::~Emulator() { delete impl_; }
+
+void Emulator::attach_ram(PhysicalMemory *ram) { impl_->attach_ram(ram); }
+
+void Emulator::limits(uint64_t max_instrs) { impl_->limits(max_instrs); }
+
+void Emulator::private_segment(uint32_t base_addr) { impl_->private_segment(base_addr); }
+
+int Emulator::run(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+  return impl_->run(metadata, csr_knl_addr);
+}
+
+void Emulator::launch(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+  impl_->launch(metadata, csr_knl_addr);
+}
+
+int Emulator::run_workgroup(uint32_t index) { return impl_->run_workgroup(index); }
+
+void Emulator::abort() { impl_->abort(); }
+
+int Emulator::perf_query(uint32_t counter, uint32_t index, uint64_t *value) const {
+  return impl_->perf_query(counter, index, value);
+}
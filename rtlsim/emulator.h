@@ -0,0 +1,50 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <stdint.h>
+
+#include "memory.h"
+#include "common.h"
+
+// Instruction-level functional model of the GPGPU, the fast alternative to
+// the RTL behind the same device. Workgroups run one after the other, the
+// warps of a workgroup take turns between barriers and every vector
+// instruction is applied to all active lanes of its warp at once. There is
+// no timing: the cycle counters stay zero and the cycle budget bounds the
+// number of warp instructions instead.
+class Emulator {
+public:
+  Emulator();
+  ~Emulator();
+
+  void attach_ram(PhysicalMemory* ram);
+
+  // warp instruction budget of the next launches, 0 = unlimited
+  void limits(uint64_t max_instrs);
+
+  // base of the private segment handed to the workgroups (pds_baseaddr)
+  void private_segment(uint32_t base_addr);
+
+  // returns the launch status, VX_LAUNCH_*
+  int run(metadata_buffer_t metadata, uint64_t csr_knl_addr);
+
+  // set up a launch without running it, run_workgroup then runs its
+  // workgroups one at a time, in any order
+  void launch(metadata_buffer_t metadata, uint64_t csr_knl_addr);
+
+  // workgroup index of the grid (x fastest), returns VX_LAUNCH_*
+  int run_workgroup(uint32_t index);
+
+  // stop a running launch from another thread
+  void abort();
+
+  // VX_PERF_INSTRS, VX_PERF_WARP_INSTRS and VX_PERF_CTAS of the last launch,
+  // the timing counters read zero
+  int perf_query(uint32_t counter, uint32_t index, uint64_t* value) const;
+
+private:
+  class Impl;
+  Impl* impl_;
+};
+
+#endif
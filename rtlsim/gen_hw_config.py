@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+# Generate the C++ view of the hardware configuration from define.v.
+#
+# usage: gen_hw_config.py define.v vt_hw_config.h
+#
+# Every `define that evaluates to an integer becomes a constexpr of namespace
+# hw, under its Verilog name; the rest (instruction encodings with don't care
+# bits, strings) is left out. The output is only rewritten when it changes so
+# the sources depending on it are not rebuilt for nothing.
+
+import os
+import re
+import sys
+
+DEFINE_RE = re.compile(r'^\s*`define\s+([A-Za-z_]\w*)\s*(.*)$')
+TOKEN_RE = re.compile(r"""
+    \s*(?:
+      (?P<num>(?:\d[\d_]*)?\s*'[sS]?[bBoOdDhH]\s*[0-9a-fA-FxXzZ?_]+ | \d[\d_]*)
+    | (?P<macro>`[A-Za-z_]\w*)
+    | (?P<func>\$[A-Za-z_]\w*)
+    | (?P<op>&&|\|\||<<<|>>>|<<|>>|<=|>=|==|!=|[-+*/%&|^~!<>?:()])
+    )""", re.VERBOSE)
+
+BINARY = [
+    ('||',), ('&&',), ('|',), ('^',), ('&',), ('==', '!='),
+    ('<', '>', '<=', '>='), ('<<', '>>', '<<<', '>>>'), ('+', '-'), ('*', '/', '%'),
+]
+
+
+class Unsupported(Exception):
+    pass
+
+
+def strip_comments(text):
+    text = re.sub(r'/\*.*?\*/', ' ', text, flags=re.S)
+    return re.sub(r'//.*', '', text)
+
+
+def literal(text):
+    text = text.replace('_', '').replace(' ', '')
+    if "'" not in text:
+        return int(text)
+    base = text.split("'")[1].lstrip('sS')
+    digits = base[1:]
+    if re.search(r'[xXzZ?]', digits):
+        raise Unsupported(text)
+    return int(digits, {'b': 2, 'o': 8, 'd': 10, 'h': 16}[base[0].lower()])
+
+
+def clog2(value):
+    return max(value - 1, 0).bit_length()
+
+
+class Parser:
+    def __init__(self, text, lookup):
+        self.tokens = []
+        pos = 0
+        text = text.strip()
+        while pos < len(text):
+            match = TOKEN_RE.match(text, pos)
+            if not match or match.end() == pos:
+                raise Unsupported(text)
+            self.tokens.append((match.lastgroup, match.group(match.lastgroup)))
+            pos = match.end()
+            while pos < len(text) and text[pos].isspace():
+                pos += 1
+        self.pos = 0
+        self.lookup = lookup
+
+    def peek(self):
+        return self.tokens[self.pos][1] if self.pos < len(self.tokens) else None
+
+    def take(self, expected=None):
+        if self.pos >= len(self.tokens):
+            raise Unsupported('end of expression')
+        kind, value = self.tokens[self.pos]
+        if expected is not None and value != expected:
+            raise Unsupported(value)
+        self.pos += 1
+        return kind, value
+
+    def parse(self):
+        value = self.ternary()
+        if self.pos != len(self.tokens):
+            raise Unsupported(self.peek())
+        return value
+
+    def ternary(self):
+        cond = self.binary(0)
+        if self.peek() != '?':
+            return cond
+        self.take('?')
+        then = self.ternary()
+        self.take(':')
+        other = self.ternary()
+        return then if cond else other
+
+    def binary(self, level):
+        if level == len(BINARY):
+            return self.unary()
+        value = self.binary(level + 1)
+        while self.peek() in BINARY[level]:
+            op = self.take()[1]
+            rhs = self.binary(level + 1)
+            value = {
+                '||': lambda a, b: int(bool(a) or bool(b)),
+                '&&': lambda a, b: int(bool(a) and bool(b)),
+                '|': lambda a, b: a | b, '^': lambda a, b: a ^ b, '&': lambda a, b: a & b,
+                '==': lambda a, b: int(a == b), '!=': lambda a, b: int(a != b),
+                '<': lambda a, b: int(a < b), '>': lambda a, b: int(a > b),
+                '<=': lambda a, b: int(a <= b), '>=': lambda a, b: int(a >= b),
+                '<<': lambda a, b: a << b, '>>': lambda a, b: a >> b,
+                '<<<': lambda a, b: a << b, '>>>': lambda a, b: a >> b,
+                '+': lambda a, b: a + b, '-': lambda a, b: a - b, '*': lambda a, b: a * b,
+                '/': lambda a, b: a // b, '%': lambda a, b: a % b,
+            }[op](value, rhs)
+        return value
+
+    def unary(self):
+        op = self.peek()
+        if op in ('-', '+', '!', '~'):
+            self.take()
+            value = self.unary()
+            return {'-': -value, '+': value, '!': int(not value), '~': ~value}[op]
+        return self.primary()
+
+    def primary(self):
+        kind, value = self.take()
+        if kind == 'num':
+            return literal(value)
+        if kind == 'macro':
+            return self.lookup(value[1:])
+        if kind == 'func':
+            if value != '$clog2':
+                raise Unsupported(value)
+            self.take('(')
+            arg = self.ternary()
+            self.take(')')
+            return clog2(arg)
+        if value == '(':
+            inner = self.ternary()
+            self.take(')')
+            return inner
+        raise Unsupported(value)
+
+
+def evaluate(defines):
+    values = {}
+    busy = set()
+
+    def lookup(name):
+        if name in values:
+            if values[name] is None:
+                raise Unsupported(name)
+            return values[name]
+        if name not in defines or name in busy:
+            raise Unsupported(name)
+        busy.add(name)
+        try:
+            values[name] = Parser(defines[name], lookup).parse()
+        except (Unsupported, ValueError, ZeroDivisionError, KeyError):
+            values[name] = None
+        busy.discard(name)
+        if values[name] is None:
+            raise Unsupported(name)
+        return values[name]
+
+    for name in defines:
+        try:
+            lookup(name)
+        except Unsupported:
+            pass
+    return values
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s define.v vt_hw_config.h' % sys.argv[0])
+    source, output = sys.argv[1], sys.argv[2]
+
+    defines = {}
+    with open(source) as f:
+        for line in strip_comments(f.read()).splitlines():
+            match = DEFINE_RE.match(line)
+            if match and match.group(2).strip():
+                defines[match.group(1)] = match.group(2)
+    values = evaluate(defines)
+
+    lines = [
+        '// Generated from %s by gen_hw_config.py, do not edit' % os.path.basename(source),
+        '',
+        '#ifndef VT_HW_CONFIG_H',
+        '#define VT_HW_CONFIG_H',
+        '',
+        '#include <cstdint>',
+        '',
+        'namespace hw {',
+        '',
+    ]
+    for name in defines:
+        value = values.get(name)
+        if value is None or value < 0 or value >= (1 << 64):
+            continue
+        ctype = 'uint32_t' if value < (1 << 32) else 'uint64_t'
+        suffix = 'u' if value < (1 << 32) else 'ull'
+        lines.append('constexpr %s %s = %d%s;' % (ctype, name, value, suffix))
+    lines += ['', '} // namespace hw', '', '#endif', '']
+    text = '\n'.join(lines)
+
+    if os.path.exists(output):
+        with open(output) as f:
+            if f.read() == text:
+                return
+    with open(output, 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
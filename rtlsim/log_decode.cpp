@@ -0,0 +1,120 @@
+// Offline decoder for the binary logs written when VT_LOG_FILE is set.
+//
+// usage: vt_logdecode <log file> [level] [category mask]
+
+#include "logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct decoded_site_t {
+  std::string file;
+  std::string format;
+  uint32_t line;
+  uint8_t level;
+  uint8_t cat;
+};
+
+static const char *s_level_names[] = {"trace", "debug", "info", "warn", "error", "fatal"};
+
+template <typename T> static bool read_value(FILE *fp, T *value) {
+  return fread(value, sizeof(T), 1, fp) == 1;
+}
+
+static bool read_string(FILE *fp, std::string *str) {
+  uint16_t len;
+  if (!read_value(fp, &len))
+    return false;
+  str->resize(len);
+  return len == 0 || fread(&(*str)[0], 1, len, fp) == len;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <log file> [level] [category mask]\n", argv[0]);
+    return -1;
+  }
+  uint32_t min_level = (argc > 2) ? std::strtoul(argv[2], nullptr, 0) : 0;
+  uint32_t cats = (argc > 3) ? std::strtoul(argv[3], nullptr, 0) : LOG_CAT_ALL;
+
+  FILE *fp = fopen(argv[1], "rb");
+  if (fp == nullptr) {
+    fprintf(stderr, "cannot open %s\n", argv[1]);
+    return -1;
+  }
+
+  char magic[8];
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, "VTLOG001", sizeof(magic)) != 0) {
+    fprintf(stderr, "%s is not a ventus log file\n", argv[1]);
+    fclose(fp);
+    return -1;
+  }
+
+  // sites are numbered in the order they are defined, before their first
+  // record; anything else is a corrupt file
+  std::vector<decoded_site_t> sites;
+  const char *corrupt = nullptr;
+  long offset = 0;
+  int type;
+  while ((type = fgetc(fp)) != EOF) {
+    offset = ftell(fp) - 1;
+    if (type == 'S') {
+      uint32_t id;
+      decoded_site_t site;
+      if (!read_value(fp, &id) || !read_value(fp, &site.line) ||
+          !read_value(fp, &site.level) || !read_value(fp, &site.cat) ||
+          !read_string(fp, &site.file) || !read_string(fp, &site.format))
+        break;
+      if (id != sites.size()) {
+        corrupt = "site out of sequence";
+        break;
+      }
+      if (site.level > LOG_LEVEL_FATAL) {
+        corrupt = "invalid site level";
+        break;
+      }
+      sites.push_back(site);
+    } else if (type == 'R') {
+      uint32_t id;
+      uint64_t time, cycle;
+      uint8_t nargs, strlen;
+      uint64_t args[vt_log::MAX_ARGS];
+      char strbuf[vt_log::MAX_STRBUF];
+      if (!read_value(fp, &id) || !read_value(fp, &time) ||
+          !read_value(fp, &cycle) || !read_value(fp, &nargs) ||
+          nargs > vt_log::MAX_ARGS ||
+          fread(args, sizeof(uint64_t), nargs, fp) != nargs ||
+          !read_value(fp, &strlen) || strlen > vt_log::MAX_STRBUF ||
+          fread(strbuf, 1, strlen, fp) != strlen)
+        break;
+      if (id >= sites.size()) {
+        corrupt = "record of an undefined site";
+        break;
+      }
+      if (strlen != 0 && strbuf[strlen - 1] != 0) {
+        corrupt = "unterminated record strings";
+        break;
+      }
+      const decoded_site_t &site = sites[id];
+      if (site.level < min_level || (site.cat & cats) == 0)
+        continue;
+      char msg[1024];
+      vt_log::format(msg, sizeof(msg), site.format.c_str(), args, nargs, strbuf, strlen);
+      printf("%lu.%09lu %8lu [%s] %s:%d %s\n", time / 1000000000, time % 1000000000,
+             cycle, s_level_names[site.level], site.file.c_str(), site.line, msg);
+    } else {
+      corrupt = "unknown entry type";
+      break;
+    }
+  }
+
+  fclose(fp);
+  if (corrupt) {
+    fprintf(stderr, "corrupt log entry at offset %ld: %s\n", offset, corrupt);
+    return -1;
+  }
+  return 0;
+}
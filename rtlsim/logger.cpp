@@ -0,0 +1,322 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace vt_log {
+
+static uint8_t env_u8(const char *name, uint8_t default_value) {
+  const char *value = std::getenv(name);
+  return (value && *value) ? std::strtoul(value, nullptr, 0) : default_value;
+}
+
+// set before any thread can log, records are filtered from the first one
+std::atomic<uint8_t> g_level(env_u8("VT_LOG_LEVEL", LOG_LEVEL_INFO));
+std::atomic<uint8_t> g_cats(env_u8("VT_LOG_CATS", LOG_CAT_ALL));
+thread_local uint64_t t_cycle = 0;
+
+static const char *s_level_names[] = {"trace", "debug", "info", "warn", "error", "fatal"};
+
+// binary stream: "VTLOG001" header followed by entries
+//   site:   u8 'S', u32 id, u32 line, u8 level, u8 cat,
+//           u16 len + file, u16 len + format
+//   record: u8 'R', u32 site id, u64 time, u64 cycle, u8 nargs,
+//           u64 args[nargs], u8 strlen + strbuf
+static const char s_magic[8] = {'V', 'T', 'L', 'O', 'G', '0', '0', '1'};
+
+// Bounded multi-producer ring (Vyukov), drained by a single writer thread.
+class Logger {
+public:
+  static Logger &instance() {
+    // never destroyed, static destructors may still log
+    static Logger *logger = new Logger();
+    return *logger;
+  }
+
+  void submit(record_t &record) {
+    record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    record.cycle = t_cycle;
+    if (stopped_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      this->emit(record);
+      return;
+    }
+    this->start();
+    uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    slot_t *slot;
+    for (;;) {
+      slot = &slots_[pos & (RING_SIZE - 1)];
+      uint64_t seq = slot->seq.load(std::memory_order_acquire);
+      int64_t diff = (int64_t)seq - (int64_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        // ring full, never block the simulation
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->record = record;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    if (record.site->level >= LOG_LEVEL_ERROR) {
+      this->flush();
+    }
+  }
+
+  void flush() {
+    if (!started_.load(std::memory_order_acquire))
+      return;
+    uint64_t target = enqueue_pos_.load(std::memory_order_acquire);
+    while (written_.load(std::memory_order_acquire) < target &&
+           !stopped_.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+  void shutdown() {
+    if (stopped_.exchange(true))
+      return;
+    if (writer_.joinable()) {
+      writer_.join();
+    }
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    this->drain();
+    if (file_) {
+      fclose(file_);
+      file_ = nullptr;
+    }
+    fflush(stdout);
+  }
+
+private:
+  static constexpr uint64_t RING_SIZE = 65536;
+
+  struct slot_t {
+    std::atomic<uint64_t> seq;
+    record_t record;
+  };
+
+  Logger() : slots_(new slot_t[RING_SIZE]) {
+    for (uint64_t i = 0; i < RING_SIZE; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    if (const char *filename = std::getenv("VT_LOG_FILE")) {
+      file_ = fopen(filename, "wb");
+      if (file_) {
+        fwrite(s_magic, 1, sizeof(s_magic), file_);
+      } else {
+        fprintf(stderr, "[warn] cannot open log file %s\n", filename);
+      }
+    }
+  }
+
+  void start() {
+    if (started_.load(std::memory_order_acquire))
+      return;
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (started_.load(std::memory_order_relaxed))
+      return;
+    writer_ = std::thread([this] { this->run(); });
+    std::atexit([] { Logger::instance().shutdown(); });
+    started_.store(true, std::memory_order_release);
+  }
+
+  void run() {
+    while (!stopped_.load(std::memory_order_acquire)) {
+      bool idle;
+      {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        idle = (0 == this->drain());
+      }
+      if (idle) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  // write out every queued record, caller holds write_mutex_
+  uint64_t drain() {
+    uint64_t count = 0;
+    for (;;) {
+      slot_t *slot = &slots_[dequeue_pos_ & (RING_SIZE - 1)];
+      if (slot->seq.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+        break;
+      this->emit(slot->record);
+      slot->seq.store(dequeue_pos_ + RING_SIZE, std::memory_order_release);
+      ++dequeue_pos_;
+      ++count;
+    }
+    uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+      fprintf(stderr, "[warn] log ring full, %lu events dropped\n", dropped);
+    }
+    if (count) {
+      if (file_) {
+        fflush(file_);
+      } else {
+        fflush(stdout);
+      }
+    }
+    written_.store(dequeue_pos_, std::memory_order_release);
+    return count;
+  }
+
+  void emit(const record_t &record) {
+    const site_t *site = record.site;
+    if (file_ == nullptr) {
+      char msg[1024];
+      format(msg, sizeof(msg), site->format, record.args, record.nargs,
+             record.strbuf, record.strlen);
+      printf("[%s] %s:%d %s\n", s_level_names[site->level], site->file,
+             site->line, msg);
+      return;
+    }
+    auto it = site_ids_.find(site);
+    uint32_t id;
+    if (it == site_ids_.end()) {
+      id = site_ids_.size();
+      site_ids_[site] = id;
+      uint16_t file_len = strlen(site->file);
+      uint16_t format_len = strlen(site->format);
+      fputc('S', file_);
+      fwrite(&id, sizeof(id), 1, file_);
+      fwrite(&site->line, sizeof(site->line), 1, file_);
+      fwrite(&site->level, 1, 1, file_);
+      fwrite(&site->cat, 1, 1, file_);
+      fwrite(&file_len, sizeof(file_len), 1, file_);
+      fwrite(site->file, 1, file_len, file_);
+      fwrite(&format_len, sizeof(format_len), 1, file_);
+      fwrite(site->format, 1, format_len, file_);
+    } else {
+      id = it->second;
+    }
+    fputc('R', file_);
+    fwrite(&id, sizeof(id), 1, file_);
+    fwrite(&record.time, sizeof(record.time), 1, file_);
+    fwrite(&record.cycle, sizeof(record.cycle), 1, file_);
+    fwrite(&record.nargs, 1, 1, file_);
+    fwrite(record.args, sizeof(uint64_t), record.nargs, file_);
+    fwrite(&record.strlen, 1, 1, file_);
+    fwrite(record.strbuf, 1, record.strlen, file_);
+  }
+
+  slot_t *slots_;
+  std::atomic<uint64_t> enqueue_pos_{0};
+  uint64_t dequeue_pos_ = 0;
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<bool> started_{false};
+  std::atomic<bool> stopped_{false};
+  std::mutex write_mutex_;
+  std::thread writer_;
+  FILE *file_ = nullptr;
+  std::unordered_map<const site_t *, uint32_t> site_ids_;
+};
+
+void submit(record_t &record) { Logger::instance().submit(record); }
+
+void flush() { Logger::instance().flush(); }
+
+int format(char *buf, uint32_t size, const char *fmt, const uint64_t *args,
+           uint32_t nargs, const char *strbuf, uint32_t strlen) {
+  uint32_t pos = 0;
+  uint32_t argi = 0;
+  auto append = [&](int n) {
+    if (n > 0)
+      pos = std::min<uint32_t>(pos + n, size - 1);
+  };
+  buf[0] = 0;
+  for (const char *p = fmt; *p && pos < size - 1;) {
+    if (*p != '%') {
+      buf[pos++] = *p++;
+      buf[pos] = 0;
+      continue;
+    }
+    if (p[1] == '%') {
+      buf[pos++] = '%';
+      buf[pos] = 0;
+      p += 2;
+      continue;
+    }
+    // copy flags, width and precision, drop the length modifier
+    char spec[32];
+    uint32_t len = 0;
+    spec[len++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && len < sizeof(spec) - 4) {
+      spec[len++] = *p++;
+    }
+    while (*p && strchr("hljztL", *p)) {
+      ++p;
+    }
+    char conv = *p ? *p++ : 0;
+    uint64_t arg = (argi < nargs) ? args[argi++] : 0;
+    switch (conv) {
+    case 'd':
+    case 'i':
+      spec[len++] = 'l';
+      spec[len++] = 'l';
+      spec[len++] = conv;
+      spec[len] = 0;
+      append(snprintf(buf + pos, size - pos, spec, (long long)arg));
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      spec[len++] = 'l';
+      spec[len++] = 'l';
+      spec[len++] = conv;
+      spec[len] = 0;
+      append(snprintf(buf + pos, size - pos, spec, (unsigned long long)arg));
+      break;
+    case 'c':
+      spec[len++] = conv;
+      spec[len] = 0;
+      append(snprintf(buf + pos, size - pos, spec, (int)arg));
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+      double d;
+      memcpy(&d, &arg, sizeof(d));
+      spec[len++] = conv;
+      spec[len] = 0;
+      append(snprintf(buf + pos, size - pos, spec, d));
+      break;
+    }
+    case 's':
+      spec[len++] = conv;
+      spec[len] = 0;
+      append(snprintf(buf + pos, size - pos, spec, (arg < strlen) ? (strbuf + arg) : "?"));
+      break;
+    case 'p':
+      append(snprintf(buf + pos, size - pos, "0x%llx", (unsigned long long)arg));
+      break;
+    default:
+      break;
+    }
+  }
+  // messages are printed one per line
+  while (pos > 0 && buf[pos - 1] == '\n') {
+    buf[--pos] = 0;
+  }
+  return pos;
+}
+
+} // namespace vt_log
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// log levels
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_FATAL 5
+
+// compile-time threshold, events below it generate no code at all
+#ifndef VT_LOG_LEVEL
+#ifdef NDEBUG
+#define VT_LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define VT_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// log categories
+#define LOG_CAT_SIM   0x01 // simulation loop
+#define LOG_CAT_HOST  0x02 // workgroup dispatch
+#define LOG_CAT_MEM   0x04 // memory port and physical memory
+#define LOG_CAT_RT    0x08 // runtime API
+#define LOG_CAT_ALL   0xff
+
+#ifndef LOG_CAT_DEFAULT
+#define LOG_CAT_DEFAULT LOG_CAT_SIM
+#endif
+
+// Enabled events are queued on a lock-free ring and written by a background
+// thread, as text on stdout or, when VT_LOG_FILE is set, in the binary format
+// read by vt_logdecode. VT_LOG_LEVEL and VT_LOG_CATS filter at runtime.
+#define VT_LOG(level, cat, format, ...)                                        \
+  do {                                                                         \
+    if constexpr ((level) >= VT_LOG_LEVEL) {                                   \
+      if (vt_log::enabled(level, cat)) {                                       \
+        static const vt_log::site_t _vt_log_site = {format, __FILE__,          \
+                                                    __LINE__, level, cat};     \
+        vt_log::write(_vt_log_site, ##__VA_ARGS__);                            \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+#define DEBUG(format, ...) VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_DEFAULT, format, ##__VA_ARGS__);
+#define INFO(format, ...) VT_LOG(LOG_LEVEL_INFO, LOG_CAT_DEFAULT, format, ##__VA_ARGS__);
+#define WARN(format, ...) VT_LOG(LOG_LEVEL_WARN, LOG_CAT_DEFAULT, format, ##__VA_ARGS__);
+#define ERROR(format, ...) VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_DEFAULT, format, ##__VA_ARGS__);
+#define FATAL(format, ...) VT_LOG(LOG_LEVEL_FATAL, LOG_CAT_DEFAULT, format, ##__VA_ARGS__);
+
+namespace vt_log {
+
+constexpr uint32_t MAX_ARGS = 8;
+constexpr uint32_t MAX_STRBUF = 64;
+
+// static description of a log statement
+struct site_t {
+  const char *format;
+  const char *file;
+  uint32_t line;
+  uint8_t level;
+  uint8_t cat;
+};
+
+struct record_t {
+  const site_t *site;
+  uint64_t time;  // host time, nanoseconds
+  uint64_t cycle; // simulation cycle of the logging thread
+  uint8_t nargs;
+  uint8_t strlen; // bytes used in strbuf
+  uint64_t args[MAX_ARGS];
+  char strbuf[MAX_STRBUF]; // copies of string arguments
+};
+
+// runtime filter, VT_LOG_LEVEL and VT_LOG_CATS are read at load time
+extern std::atomic<uint8_t> g_level;
+extern std::atomic<uint8_t> g_cats;
+extern thread_local uint64_t t_cycle;
+
+inline bool enabled(uint8_t level, uint8_t cat) {
+  return level >= g_level.load(std::memory_order_relaxed) &&
+         (cat & g_cats.load(std::memory_order_relaxed)) != 0;
+}
+
+// simulation cycle stamped on the records of the calling thread
+inline void set_cycle(uint64_t cycle) { t_cycle = cycle; }
+
+void submit(record_t &record);
+
+// wait until every queued record has been written
+void flush();
+
+// printf-style rendering of a record, shared with the offline decoder
+int format(char *buf, uint32_t size, const char *fmt, const uint64_t *args,
+           uint32_t nargs, const char *strbuf, uint32_t strlen);
+
+inline void capture(record_t &record, const char *str) {
+  // once strbuf is full the remaining strings share its last, empty one
+  uint32_t offset = std::min<uint32_t>(record.strlen, MAX_STRBUF - 1);
+  uint32_t len = str ? strnlen(str, MAX_STRBUF - 1 - offset) : 0;
+  if (len)
+    memcpy(record.strbuf + offset, str, len);
+  record.strbuf[offset + len] = 0;
+  record.strlen = offset + len + 1;
+  record.args[record.nargs++] = offset;
+}
+
+inline void capture(record_t &record, char *str) {
+  capture(record, static_cast<const char *>(str));
+}
+
+template <typename T> inline void capture(record_t &record, T value) {
+  uint64_t arg;
+  if constexpr (std::is_floating_point<T>::value) {
+    double d = value;
+    memcpy(&arg, &d, sizeof(arg));
+  } else if constexpr (std::is_pointer<T>::value) {
+    arg = reinterpret_cast<uintptr_t>(value);
+  } else if constexpr (std::is_enum<T>::value) {
+    arg = static_cast<uint64_t>(value);
+  } else {
+    static_assert(std::is_integral<T>::value, "unsupported log argument");
+    arg = static_cast<uint64_t>(value);
+  }
+  record.args[record.nargs++] = arg;
+}
+
+template <typename... Args>
+inline void write(const site_t &site, Args... args) {
+  static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+  record_t record;
+  record.site = &site;
+  record.nargs = 0;
+  record.strlen = 0;
+  (capture(record, args), ...);
+  submit(record);
+}
+
+} // namespace vt_log
@@ -0,0 +1,111 @@
+#include "mem_alloc.h"
+
+MemoryAllocator::MemoryAllocator(uint64_t base, uint64_t size, uint64_t min_alignment)
+    : m_base(base)
+    , m_size(size & ~(min_alignment - 1))
+    , m_min_alignment(min_alignment) {
+    if (m_size != 0) {
+        insert_free(m_base, m_size);
+    }
+}
+
+void MemoryAllocator::insert_free(uint64_t addr, uint64_t size) {
+    m_free_by_addr.emplace(addr, size);
+    m_free_by_size.emplace(size, addr);
+}
+
+void MemoryAllocator::erase_free(std::map<uint64_t, uint64_t>::iterator it) {
+    m_free_by_size.erase({it->second, it->first});
+    m_free_by_addr.erase(it);
+}
+
+// carve [addr, addr + size) out of the free block at it, the leading and
+// trailing remainders stay free
+void MemoryAllocator::take(std::map<uint64_t, uint64_t>::iterator it, uint64_t addr, uint64_t size) {
+    uint64_t block_addr = it->first;
+    uint64_t block_end = it->first + it->second;
+    erase_free(it);
+    if (addr > block_addr) {
+        insert_free(block_addr, addr - block_addr);
+    }
+    if (addr + size < block_end) {
+        insert_free(addr + size, block_end - (addr + size));
+    }
+    m_used_blocks[addr] = size;
+    m_used += size;
+}
+
+bool MemoryAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t* addr) {
+    // no larger than the range, so aligning the size cannot wrap
+    if (0 == size || size > m_size || nullptr == addr)
+        return false;
+    if (alignment < m_min_alignment)
+        alignment = m_min_alignment;
+    if (alignment & (alignment - 1))
+        return false;
+    size = align_size(size);
+
+    // best fit: smallest free block that still holds the aligned request,
+    // ties go to the lowest address
+    for (auto it = m_free_by_size.lower_bound({size, 0}); it != m_free_by_size.end(); ++it) {
+        uint64_t block_size = it->first;
+        uint64_t block_addr = it->second;
+        uint64_t aligned_addr = (block_addr + alignment - 1) & ~(alignment - 1);
+        if (aligned_addr < block_addr || aligned_addr - block_addr > block_size - size)
+            continue;
+        take(m_free_by_addr.find(block_addr), aligned_addr, size);
+        *addr = aligned_addr;
+        return true;
+    }
+    return false;
+}
+
+bool MemoryAllocator::reserve(uint64_t addr, uint64_t size) {
+    if (0 == size || size > m_size || (addr & (m_min_alignment - 1)))
+        return false;
+    size = align_size(size);
+    auto it = m_free_by_addr.upper_bound(addr);
+    if (it == m_free_by_addr.begin())
+        return false;
+    --it;
+    if (size > it->second || addr - it->first > it->second - size)
+        return false;
+    take(it, addr, size);
+    return true;
+}
+
+bool MemoryAllocator::release(uint64_t addr, uint64_t* size) {
+    auto used = m_used_blocks.find(addr);
+    if (used == m_used_blocks.end())
+        return false;
+    uint64_t block_addr = addr;
+    uint64_t block_size = used->second;
+    m_used_blocks.erase(used);
+    m_used -= block_size;
+    if (size) {
+        *size = block_size;
+    }
+
+    // coalesce with the free neighbours
+    auto next = m_free_by_addr.lower_bound(block_addr);
+    if (next != m_free_by_addr.end() && next->first == block_addr + block_size) {
+        block_size += next->second;
+        erase_free(next);
+    }
+    auto prev = m_free_by_addr.lower_bound(block_addr);
+    if (prev != m_free_by_addr.begin()) {
+        --prev;
+        if (prev->first + prev->second == block_addr) {
+            block_addr = prev->first;
+            block_size += prev->second;
+            erase_free(prev);
+        }
+    }
+    insert_free(block_addr, block_size);
+    return true;
+}
+
+uint64_t MemoryAllocator::block_size(uint64_t addr) const {
+    auto it = m_used_blocks.find(addr);
+    return (it != m_used_blocks.end()) ? it->second : 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+// Device address space allocator.
+// Free blocks are kept both by address (for coalescing on release) and by
+// size (for best-fit allocation), so blocks can be released in any order.
+class MemoryAllocator {
+public:
+  MemoryAllocator(uint64_t base, uint64_t size, uint64_t min_alignment);
+
+  // allocate size bytes aligned to alignment (0 = min_alignment)
+  bool allocate(uint64_t size, uint64_t alignment, uint64_t *addr);
+
+  // claim a fixed address range, it must be entirely free
+  bool reserve(uint64_t addr, uint64_t size);
+
+  // release a block returned by allocate() or reserve()
+  bool release(uint64_t addr, uint64_t *size = nullptr);
+
+  // size of the block starting at addr, 0 if it is not allocated
+  uint64_t block_size(uint64_t addr) const;
+
+  // allocated blocks, address to size
+  const std::unordered_map<uint64_t, uint64_t> &blocks() const {
+    return m_used_blocks;
+  }
+
+  uint64_t capacity() const { return m_size; }
+  uint64_t used() const { return m_used; }
+  uint64_t available() const { return m_size - m_used; }
+
+private:
+  void insert_free(uint64_t addr, uint64_t size);
+  void erase_free(std::map<uint64_t, uint64_t>::iterator it);
+  void take(std::map<uint64_t, uint64_t>::iterator it, uint64_t addr,
+            uint64_t size);
+
+  uint64_t align_size(uint64_t size) const {
+    return (size + m_min_alignment - 1) & ~(m_min_alignment - 1);
+  }
+
+  const uint64_t m_base;
+  const uint64_t m_size;
+  const uint64_t m_min_alignment;
+  uint64_t m_used = 0;
+
+  std::map<uint64_t, uint64_t> m_free_by_addr;
+  std::set<std::pair<uint64_t, uint64_t>> m_free_by_size; // (size, addr)
+  std::unordered_map<uint64_t, uint64_t> m_used_blocks;
+};
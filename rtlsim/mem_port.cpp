@@ -0,0 +1,125 @@
+#define LOG_CAT_DEFAULT LOG_CAT_MEM
+
+#include "mem_port.h"
+#include "checkpoint.h"
+
+#include <algorithm>
+
+MemPort::MemPort(const mem_port_config_t &config, MemTimingModel *timing)
+    : config_(config), timing_(timing), ram_(nullptr) {
+    if (config_.beat_bytes == 0 || config_.beat_bytes > MEM_PORT_MAX_BEAT ||
+        (config_.beat_bytes & (config_.beat_bytes - 1))) {
+        FATAL("memory port beat of %u bytes is not supported", config_.beat_bytes);
+        config_.beat_bytes = std::min<uint32_t>(config_.beat_bytes, MEM_PORT_MAX_BEAT);
+    }
+    config_.req_queue_size = std::max<uint32_t>(config_.req_queue_size, 1);
+    config_.rsp_queue_size = std::max<uint32_t>(config_.rsp_queue_size, 1);
+    this->reset();
+}
+
+MemPort::~MemPort() {
+    delete timing_;
+}
+
+void MemPort::reset() {
+    pending_.clear();
+    responses_.clear();
+    sources_.clear();
+    stats_ = {0, 0, 0, 0, 0, 0};
+    timing_->reset();
+    seed_ = 1;
+}
+
+void MemPort::save(std::ostream &os) const {
+    ckpt_put(os, pending_);
+    ckpt_put(os, responses_);
+    ckpt_put(os, stats_);
+    ckpt_put(os, seed_);
+    timing_->save(os);
+}
+
+bool MemPort::restore(std::istream &is) {
+    if (!ckpt_get(is, pending_) || !ckpt_get(is, responses_) ||
+        !ckpt_get(is, stats_) || !ckpt_get(is, seed_) || !timing_->restore(is))
+        return false;
+    // every queued request holds its source until its response is taken
+    sources_.clear();
+    for (auto &req : pending_) {
+        sources_.insert(req.rsp.source);
+    }
+    for (auto &rsp : responses_) {
+        sources_.insert(rsp.source);
+    }
+    return true;
+}
+
+void MemPort::accept(uint64_t cycle, uint64_t addr, uint32_t source,
+                     uint8_t opcode, uint8_t size, uint8_t param,
+                     const void *data, uint64_t mask) {
+    if (!sources_.insert(source).second) {
+        ERROR("memory request with source 0x%x already outstanding", source);
+    }
+
+    bool write = (opcode != TL_A_GET);
+    uint64_t beat_addr = addr & ~uint64_t(config_.beat_bytes - 1);
+    mem_req_t req;
+    req.ready_cycle = timing_->schedule(cycle, addr, 1u << size, write) + this->jitter();
+    req.rsp.accept_cycle = cycle;
+    req.rsp.source = source;
+    req.rsp.size = size;
+    req.rsp.param = param;
+    memset(req.rsp.data, 0, sizeof(req.rsp.data));
+
+    if (!write) {
+        req.rsp.opcode = TL_D_ACCESSACKDATA;
+        ram_->read(beat_addr, req.rsp.data, config_.beat_bytes);
+        ++stats_.reads;
+        DEBUG("memory read; addr:%lx size:%d source:%x", addr, 1 << size, source);
+    } else {
+        req.rsp.opcode = TL_D_ACCESSACK;
+        ram_->write_masked(beat_addr, data, mask, config_.beat_bytes);
+        ++stats_.writes;
+        DEBUG("memory write; addr:%lx mask:%lx size:%d source:%x", addr, mask,
+              1 << size, source);
+    }
+
+    stats_.bytes += 1u << size;
+    pending_.push_back(req);
+    stats_.peak_outstanding = std::max<uint32_t>(stats_.peak_outstanding, sources_.size());
+}
+
+void MemPort::tick(uint64_t cycle) {
+    if (!config_.out_of_order) {
+        while (!pending_.empty() && responses_.size() < config_.rsp_queue_size &&
+               pending_.front().ready_cycle <= cycle) {
+            responses_.push_back(pending_.front().rsp);
+            pending_.pop_front();
+        }
+        return;
+    }
+    for (auto it = pending_.begin();
+         it != pending_.end() && responses_.size() < config_.rsp_queue_size;) {
+        if (it->ready_cycle <= cycle) {
+            responses_.push_back(it->rsp);
+            it = pending_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void MemPort::rsp_pop(uint64_t cycle) {
+    auto &rsp = responses_.front();
+    ++stats_.completed;
+    stats_.total_latency += cycle - rsp.accept_cycle;
+    sources_.erase(rsp.source);
+    responses_.pop_front();
+}
+
+uint32_t MemPort::jitter() {
+    if (!config_.out_of_order || MEM_OOO_JITTER == 0)
+        return 0;
+    // deterministic spread so reordered runs are reproducible
+    seed_ = seed_ * 1103515245 + 12345;
+    return (seed_ >> 16) % (MEM_OOO_JITTER + 1);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <unordered_set>
+
+#include "mem_timing.h"
+#include "memory.h"
+
+// default responder geometry, overridable at open through the environment
+#ifndef MEM_REQ_QUEUE_SIZE
+#define MEM_REQ_QUEUE_SIZE 32 // VT_MEM_REQ_QUEUE
+#endif
+
+#ifndef MEM_RSP_QUEUE_SIZE
+#define MEM_RSP_QUEUE_SIZE 8 // VT_MEM_RSP_QUEUE
+#endif
+
+#ifndef MEM_LATENCY
+#define MEM_LATENCY 1 // VT_MEM_LATENCY, fixed and bandwidth models
+#endif
+
+#ifndef MEM_OOO_JITTER
+#define MEM_OOO_JITTER 8 // extra latency spread when VT_MEM_OOO=1
+#endif
+
+// widest beat served, masked writes cover at most 64 bytes
+#define MEM_PORT_MAX_BEAT 64
+
+// TileLink A-channel opcodes
+#define TL_A_PUTFULL 0
+#define TL_A_PUTPART 1
+#define TL_A_GET 4
+
+// TileLink D-channel opcodes
+#define TL_D_ACCESSACK 0
+#define TL_D_ACCESSACKDATA 1
+
+struct mem_port_config_t {
+  uint32_t beat_bytes; // power of two, up to MEM_PORT_MAX_BEAT
+  uint32_t req_queue_size;
+  uint32_t rsp_queue_size;
+  uint32_t latency;
+  bool out_of_order;
+};
+
+struct mem_rsp_t {
+  uint64_t accept_cycle;
+  uint32_t source;
+  uint8_t opcode;
+  uint8_t size;
+  uint8_t param;
+  uint8_t data[MEM_PORT_MAX_BEAT];
+};
+
+struct mem_port_stats_t {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t bytes;
+  uint64_t completed;
+  uint64_t total_latency; // accept to D-channel handshake, in cycles
+  uint32_t peak_outstanding;
+};
+
+// Memory side of one L2 slice's TileLink port.
+// Requests are accepted while the request queue has room, their side effect
+// on memory happens at accept time so the data observed follows acceptance
+// order. Data lanes follow the address within the beat, as TileLink requires.
+// The timing model then decides when each request completes, after which it
+// moves to the response FIFO, in acceptance order or, with out_of_order, as
+// soon as it is ready.
+class MemPort {
+public:
+  // the port owns the timing model
+  MemPort(const mem_port_config_t &config, MemTimingModel *timing);
+  ~MemPort();
+
+  void attach_ram(PhysicalMemory *ram) { ram_ = ram; }
+
+  // drop every outstanding request and clear the statistics
+  void reset();
+
+  // queues, statistics and timing state for checkpoints, the configuration
+  // and timing model must match the ones saved
+  void save(std::ostream &os) const;
+  bool restore(std::istream &is);
+
+  bool can_accept() const { return pending_.size() < config_.req_queue_size; }
+
+  void accept(uint64_t cycle, uint64_t addr, uint32_t source, uint8_t opcode,
+              uint8_t size, uint8_t param, const void *data, uint64_t mask);
+
+  // move the requests whose latency has elapsed to the response FIFO
+  void tick(uint64_t cycle);
+
+  bool rsp_valid() const { return !responses_.empty(); }
+  const mem_rsp_t &rsp_front() const { return responses_.front(); }
+  // the head response completed its handshake at cycle
+  void rsp_pop(uint64_t cycle);
+
+  uint32_t outstanding() const { return sources_.size(); }
+
+  const mem_port_stats_t &stats() const { return stats_; }
+
+  const MemTimingModel *timing() const { return timing_; }
+
+  const mem_port_config_t &config() const { return config_; }
+
+private:
+  struct mem_req_t {
+    uint64_t ready_cycle;
+    mem_rsp_t rsp;
+  };
+
+  uint32_t jitter();
+
+  mem_port_config_t config_;
+  MemTimingModel *timing_;
+  PhysicalMemory *ram_;
+  std::deque<mem_req_t> pending_;
+  std::deque<mem_rsp_t> responses_;
+  std::unordered_set<uint32_t> sources_;
+  mem_port_stats_t stats_;
+  uint32_t seed_;
+};
@@ -0,0 +1,160 @@
+#define LOG_CAT_DEFAULT LOG_CAT_MEM
+
+#include "mem_timing.h"
+#include "checkpoint.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static uint64_t env_u64(const char *name, uint64_t default_value) {
+    const char *value = std::getenv(name);
+    if (value == nullptr || *value == 0)
+        return default_value;
+    return std::strtoull(value, nullptr, 0);
+}
+
+MemTimingModel *MemTimingModel::create_from_env(uint32_t latency) {
+    const char *model = std::getenv("VT_MEM_MODEL");
+    if (model == nullptr || *model == 0 || 0 == strcmp(model, "fixed")) {
+        return new FixedLatencyModel(latency);
+    }
+    if (0 == strcmp(model, "bandwidth")) {
+        return new BandwidthModel(latency, env_u64("VT_MEM_BANDWIDTH", MEM_BANDWIDTH));
+    }
+    if (0 == strcmp(model, "dram")) {
+        dram_config_t config;
+        config.clock_ratio = env_u64("VT_MEM_CLOCK_RATIO", MEM_CLOCK_RATIO);
+        config.num_banks = env_u64("VT_DRAM_BANKS", DRAM_NUM_BANKS);
+        config.row_size = env_u64("VT_DRAM_ROW_SIZE", DRAM_ROW_SIZE);
+        config.tCAS = env_u64("VT_DRAM_TCAS", DRAM_TCAS);
+        config.tRCD = env_u64("VT_DRAM_TRCD", DRAM_TRCD);
+        config.tRP = env_u64("VT_DRAM_TRP", DRAM_TRP);
+        config.tBURST = env_u64("VT_DRAM_TBURST", DRAM_TBURST);
+        config.tREFI = env_u64("VT_DRAM_TREFI", DRAM_TREFI);
+        config.tRFC = env_u64("VT_DRAM_TRFC", DRAM_TRFC);
+        return new DramModel(config);
+    }
+    WARN("unknown memory model '%s', using fixed latency", model);
+    return new FixedLatencyModel(latency);
+}
+
+void MemTimingModel::save(std::ostream &os) const {
+    ckpt_put(os, stats_);
+}
+
+bool MemTimingModel::restore(std::istream &is) {
+    return ckpt_get(is, stats_);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+uint64_t FixedLatencyModel::schedule(uint64_t cycle, uint64_t, uint32_t, bool) {
+    return cycle + latency_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+BandwidthModel::BandwidthModel(uint32_t latency, uint32_t bytes_per_cycle)
+    : latency_(latency), bytes_per_cycle_(std::max<uint32_t>(bytes_per_cycle, 1)) {
+    this->reset();
+}
+
+void BandwidthModel::reset() {
+    MemTimingModel::reset();
+    channel_free_ = 0;
+}
+
+void BandwidthModel::save(std::ostream &os) const {
+    MemTimingModel::save(os);
+    ckpt_put(os, channel_free_);
+}
+
+bool BandwidthModel::restore(std::istream &is) {
+    return MemTimingModel::restore(is) && ckpt_get(is, channel_free_);
+}
+
+uint64_t BandwidthModel::schedule(uint64_t cycle, uint64_t, uint32_t size, bool) {
+    uint64_t start = std::max(cycle, channel_free_);
+    channel_free_ = start + (size + bytes_per_cycle_ - 1) / bytes_per_cycle_;
+    return channel_free_ + latency_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+DramModel::DramModel(const dram_config_t &config) : config_(config) {
+    config_.clock_ratio = std::max<uint32_t>(config_.clock_ratio, 1);
+    config_.num_banks = std::max<uint32_t>(config_.num_banks, 1);
+    config_.row_size = std::max<uint32_t>(config_.row_size, 1);
+    banks_.resize(config_.num_banks);
+    this->reset();
+}
+
+void DramModel::reset() {
+    MemTimingModel::reset();
+    for (auto &bank : banks_) {
+        bank = {false, 0, 0};
+    }
+    bus_free_ = 0;
+    next_refresh_ = config_.tREFI;
+}
+
+void DramModel::save(std::ostream &os) const {
+    MemTimingModel::save(os);
+    ckpt_put(os, banks_);
+    ckpt_put(os, bus_free_);
+    ckpt_put(os, next_refresh_);
+}
+
+bool DramModel::restore(std::istream &is) {
+    std::vector<bank_t> banks;
+    if (!MemTimingModel::restore(is) || !ckpt_get(is, banks) ||
+        !ckpt_get(is, bus_free_) || !ckpt_get(is, next_refresh_))
+        return false;
+    if (banks.size() != banks_.size()) {
+        ERROR("checkpoint has %lu DRAM banks, the model %lu", banks.size(), banks_.size());
+        return false;
+    }
+    banks_ = banks;
+    return true;
+}
+
+uint64_t DramModel::schedule(uint64_t cycle, uint64_t addr, uint32_t, bool) {
+    uint64_t now = cycle / config_.clock_ratio;
+
+    // refresh closes every row and stalls all banks
+    while (config_.tREFI && now >= next_refresh_) {
+        for (auto &bank : banks_) {
+            bank.open = false;
+            bank.ready = std::max(bank.ready, next_refresh_ + config_.tRFC);
+        }
+        next_refresh_ += config_.tREFI;
+        ++stats_.refreshes;
+    }
+
+    uint64_t row_index = addr / config_.row_size;
+    auto &bank = banks_[row_index % config_.num_banks];
+    uint64_t row = row_index / config_.num_banks;
+
+    uint64_t start = std::max(now, bank.ready);
+    uint64_t latency = config_.tCAS;
+    if (bank.open && bank.row == row) {
+        ++stats_.row_hits;
+    } else if (!bank.open) {
+        latency += config_.tRCD;
+        ++stats_.row_misses;
+    } else {
+        latency += config_.tRP + config_.tRCD;
+        ++stats_.row_conflicts;
+    }
+    bank.open = true;
+    bank.row = row;
+
+    // the burst owns the shared data bus
+    uint64_t data = std::max(start + latency, bus_free_);
+    bus_free_ = data + config_.tBURST;
+    bank.ready = start + (latency - config_.tCAS) + config_.tBURST;
+
+    return std::max(cycle, bus_free_ * config_.clock_ratio);
+}
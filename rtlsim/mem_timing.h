@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// DRAM model defaults, in DRAM clock cycles unless noted
+#ifndef MEM_CLOCK_RATIO
+#define MEM_CLOCK_RATIO 1 // core cycles per DRAM cycle
+#endif
+
+#ifndef DRAM_NUM_BANKS
+#define DRAM_NUM_BANKS 8
+#endif
+
+#ifndef DRAM_ROW_SIZE
+#define DRAM_ROW_SIZE 2048 // bytes per row and bank
+#endif
+
+#ifndef DRAM_TCAS
+#define DRAM_TCAS 14
+#endif
+
+#ifndef DRAM_TRCD
+#define DRAM_TRCD 14
+#endif
+
+#ifndef DRAM_TRP
+#define DRAM_TRP 14
+#endif
+
+#ifndef DRAM_TBURST
+#define DRAM_TBURST 4
+#endif
+
+#ifndef DRAM_TREFI
+#define DRAM_TREFI 7800
+#endif
+
+#ifndef DRAM_TRFC
+#define DRAM_TRFC 260
+#endif
+
+#ifndef MEM_BANDWIDTH
+#define MEM_BANDWIDTH 8 // bytes per core cycle for the bandwidth model
+#endif
+
+struct mem_timing_stats_t {
+  uint64_t row_hits;
+  uint64_t row_misses;
+  uint64_t row_conflicts;
+  uint64_t refreshes;
+};
+
+// Decides when an accepted memory request completes.
+class MemTimingModel {
+public:
+  virtual ~MemTimingModel() {}
+
+  virtual const char *name() const = 0;
+
+  // completion cycle, in core cycles, of a request accepted at cycle
+  virtual uint64_t schedule(uint64_t cycle, uint64_t addr, uint32_t size,
+                            bool write) = 0;
+
+  virtual void reset() { stats_ = {0, 0, 0, 0}; }
+
+  // model state for checkpoints
+  virtual void save(std::ostream &os) const;
+  virtual bool restore(std::istream &is);
+
+  const mem_timing_stats_t &stats() const { return stats_; }
+
+  // model named by VT_MEM_MODEL (fixed, bandwidth or dram), parameters
+  // come from VT_MEM_* variables or the defaults above
+  static MemTimingModel *create_from_env(uint32_t latency);
+
+protected:
+  mem_timing_stats_t stats_ = {0, 0, 0, 0};
+};
+
+// every request completes latency cycles after acceptance
+class FixedLatencyModel : public MemTimingModel {
+public:
+  FixedLatencyModel(uint32_t latency) : latency_(latency) {}
+
+  const char *name() const override { return "fixed"; }
+
+  uint64_t schedule(uint64_t cycle, uint64_t addr, uint32_t size,
+                    bool write) override;
+
+private:
+  uint32_t latency_;
+};
+
+// requests share one channel of limited bandwidth, then see a fixed latency
+class BandwidthModel : public MemTimingModel {
+public:
+  BandwidthModel(uint32_t latency, uint32_t bytes_per_cycle);
+
+  const char *name() const override { return "bandwidth"; }
+
+  uint64_t schedule(uint64_t cycle, uint64_t addr, uint32_t size,
+                    bool write) override;
+
+  void reset() override;
+
+  void save(std::ostream &os) const override;
+  bool restore(std::istream &is) override;
+
+private:
+  uint32_t latency_;
+  uint32_t bytes_per_cycle_;
+  uint64_t channel_free_;
+};
+
+struct dram_config_t {
+  uint32_t clock_ratio;
+  uint32_t num_banks;
+  uint32_t row_size;
+  uint32_t tCAS;
+  uint32_t tRCD;
+  uint32_t tRP;
+  uint32_t tBURST;
+  uint32_t tREFI;
+  uint32_t tRFC;
+};
+
+// Banked DRAM with open-row policy. Rows interleave across banks, a request
+// hitting the open row pays tCAS, an idle bank tRCD + tCAS and a conflict
+// tRP + tRCD + tCAS. The data bus is shared and refresh stalls every bank
+// for tRFC each tREFI.
+class DramModel : public MemTimingModel {
+public:
+  DramModel(const dram_config_t &config);
+
+  const char *name() const override { return "dram"; }
+
+  uint64_t schedule(uint64_t cycle, uint64_t addr, uint32_t size,
+                    bool write) override;
+
+  void reset() override;
+
+  void save(std::ostream &os) const override;
+  bool restore(std::istream &is) override;
+
+private:
+  struct bank_t {
+    bool open;
+    uint64_t row;
+    uint64_t ready; // DRAM cycle the bank accepts its next command
+  };
+
+  dram_config_t config_;
+  std::vector<bank_t> banks_;
+  uint64_t bus_free_;
+  uint64_t next_refresh_;
+};
@@ -1,36 +1,126 @@
+#define LOG_CAT_DEFAULT LOG_CAT_MEM
+
 #include "memory.h"
+#include "checkpoint.h"
 #include "vt_config.h"
 
-static paddr_t g_malloc_paddr = ALLOC_BASE_ADDR;
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <sys/mman.h>
 
-bool PhysicalMemory::alloc(paddr_t *paddr, uint64_t size) {
-    unsigned page_num = (size + m_pagesize - 1) / m_pagesize;
-    for (unsigned i = 0; i < page_num; ++i) {
-        bool ret = page_alloc(g_malloc_paddr + i * m_pagesize);
-        if (!ret) { 
+#ifdef __AVX512BW__
+#include <immintrin.h>
+#endif
+
+// byte-select masks: bit i of the index expands to byte i of the mask
+static constexpr std::array<uint64_t, 256> make_byte_masks() {
+    std::array<uint64_t, 256> masks{};
+    for (uint32_t bits = 0; bits < 256; ++bits) {
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (bits & (1u << i))
+                masks[bits] |= 0xffull << (i * 8);
+        }
+    }
+    return masks;
+}
+static constexpr auto s_byte_masks = make_byte_masks();
+
+thread_local PhysicalMemory::last_page_t PhysicalMemory::s_last_page = {};
+std::atomic<uint64_t> PhysicalMemory::s_generation{0};
+
+PhysicalMemory::PhysicalMemory() : PhysicalMemory(false, RAM_PAGE_SIZE) {}
+
+PhysicalMemory::PhysicalMemory(bool auto_alloc, uint64_t pagesize)
+    : m_auto_alloc(auto_alloc)
+    , m_pagesize(pagesize)
+    , m_pageshift(__builtin_ctzll(pagesize))
+    , m_size(GLOBAL_MEM_SIZE)
+    , m_pages(GLOBAL_MEM_SIZE / pagesize, nullptr)
+    , m_generation(++s_generation)
+    , m_allocator(ALLOC_BASE_ADDR, GLOBAL_MEM_SIZE - ALLOC_BASE_ADDR, pagesize) {
+    if (0 == pagesize || (pagesize & (pagesize - 1)) != 0) {
+        FATAL("PMEM page size %lu is not a power of two", pagesize);
+        std::abort();
+    }
+    void* base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        FATAL("PMEM cannot reserve 0x%lx bytes of device memory", m_size);
+        std::abort();
+    }
+    m_base = static_cast<uint8_t*>(base);
+}
+
+PhysicalMemory::PhysicalMemory(const PhysicalMemory *parent)
+    : PhysicalMemory(parent->m_auto_alloc, parent->m_pagesize) {
+    m_parent = parent;
+    m_pages = parent->m_pages;
+    m_owned.assign(m_pages.size(), 0);
+}
+
+bool PhysicalMemory::alloc(paddr_t *paddr, uint64_t size, uint64_t alignment) {
+    if (m_parent) {
+        ERROR("PMEM views cannot allocate");
+        return false;
+    }
+    paddr_t addr;
+    if (!m_allocator.allocate(size, alignment, &addr)) {
+        ERROR("PMEM out of memory, cannot allocate 0x%lx bytes", size);
+        return false;
+    }
+    if (!block_commit(addr))
+        return false;
+    *paddr = addr;
+    return true;
+}
+
+bool PhysicalMemory::reserve(paddr_t paddr, uint64_t size) {
+    if (m_parent) {
+        ERROR("PMEM views cannot allocate");
+        return false;
+    }
+    if (!m_allocator.reserve(paddr, size)) {
+        ERROR("PMEM range at 0x%lx size 0x%lx cannot be reserved", paddr, size);
+        return false;
+    }
+    return block_commit(paddr);
+}
+
+bool PhysicalMemory::block_commit(paddr_t paddr) {
+    uint64_t size = m_allocator.block_size(paddr);
+    for (uint64_t offset = 0; offset < size; offset += m_pagesize) {
+        if (!page_alloc(paddr + offset)) {
             FATAL("alloc error\n");
+            while (offset != 0) {
+                offset -= m_pagesize;
+                page_free(paddr + offset);
+            }
+            m_allocator.release(paddr);
+            return false;
         }
     }
-    m_alloc_records[g_malloc_paddr] = page_num;
-    *paddr = g_malloc_paddr;
-    g_malloc_paddr += (page_num * m_pagesize);
     return true;
 }
 
 bool PhysicalMemory::free(paddr_t paddr) {
-    if (m_alloc_records.find(paddr) == m_alloc_records.end()) {
+    uint64_t size;
+    if (!m_allocator.release(paddr, &size)) {
         ERROR("PMEM page at 0x%lx not allocated", paddr);
         return false;
     }
-    unsigned page_num = m_alloc_records[paddr];
-    for (unsigned i = 0; i < page_num; ++i) {
-        bool ret = page_free(paddr + i * m_pagesize);
+    for (uint64_t offset = 0; offset < size; offset += m_pagesize) {
+        bool ret = page_free(paddr + offset);
         if (!ret) { 
             FATAL("free error\n");
         }
     }
-    g_malloc_paddr -= (page_num * m_pagesize);
-    return false;
+    return true;
+}
+
+void PhysicalMemory::mem_info(uint64_t* mem_free, uint64_t* mem_used) const {
+    *mem_free = m_allocator.available();
+    *mem_used = m_allocator.used();
 }
 
 bool PhysicalMemory::page_alloc(paddr_t paddr) {
@@ -38,103 +128,414 @@ bool PhysicalMemory::page_alloc(paddr_t paddr) {
         WARN("PMEM address 0x%lx is not aligned to page! Align it...", paddr);
         paddr = get_page_base(paddr);
     }
-    if (!m_auto_alloc && m_map.find(paddr) != m_map.end()) {
+    uint64_t index = paddr >> m_pageshift;
+    if (index >= m_pages.size()) {
+        ERROR("PMEM page at 0x%lx out of range", paddr);
+        return false;
+    }
+    if (m_pages[index] != nullptr) {
+        if (m_auto_alloc)
+            return true;
         ERROR("PMEM page at 0x%lx duplicate allocation", paddr);
         return false;
     }
-    m_map[paddr] = new (std::align_val_t(4096)) uint8_t[m_pagesize];
+    // backing storage is already reserved, the kernel zero-fills it on first touch
+    m_pages[index] = m_base + paddr;
+    ++m_num_pages;
+    if (m_parent) {
+        m_dirty.push_back(index);
+        m_owned[index] = m_dirty.size();
+        m_written.resize(m_dirty.size() * (m_pagesize / 64), 0);
+    }
     return true;
 }
 
+void PhysicalMemory::page_own(paddr_t page_base) {
+    uint64_t index = page_base >> m_pageshift;
+    if (m_owned[index])
+        return;
+    std::memcpy(m_base + page_base, m_pages[index], m_pagesize);
+    m_pages[index] = m_base + page_base;
+    m_dirty.push_back(index);
+    m_owned[index] = m_dirty.size();
+    m_written.resize(m_dirty.size() * (m_pagesize / 64), 0);
+    // the last-page caches may still point at the parent's copy
+    m_generation.store(++s_generation, std::memory_order_release);
+}
+
+void PhysicalMemory::mark_written(paddr_t paddr, uint64_t size) {
+    for (paddr_t end = paddr + size; paddr < end;) {
+        uint64_t* bits = written_bits(paddr >> m_pageshift);
+        uint64_t offset = paddr & (m_pagesize - 1);
+        uint64_t count = std::min(end - paddr, 64 - (offset & 63));
+        bits[offset / 64] |= ((count == 64) ? ~0ull : ((1ull << count) - 1)) << (offset & 63);
+        paddr += count;
+    }
+}
+
+void PhysicalMemory::mark_written(paddr_t paddr, uint64_t size, uint64_t byte_mask) {
+    if (size < 64) {
+        byte_mask &= (1ull << size) - 1;
+    }
+    for (; byte_mask; byte_mask &= byte_mask - 1) {
+        paddr_t addr = paddr + __builtin_ctzll(byte_mask);
+        uint64_t offset = addr & (m_pagesize - 1);
+        written_bits(addr >> m_pageshift)[offset / 64] |= 1ull << (offset & 63);
+    }
+}
+
 bool PhysicalMemory::page_free(paddr_t paddr) {
     if (paddr % m_pagesize != 0) {
         WARN("PMEM address 0x%lx is not aligned to page! Align it...", paddr);
         paddr = get_page_base(paddr);
     }
-    if (m_map.find(paddr) == m_map.end()) {
+    uint64_t index = paddr >> m_pageshift;
+    if (index >= m_pages.size() || m_pages[index] == nullptr) {
         ERROR("PMEM page at 0x%lx not allocated", paddr);
         return false;
     }
-    delete[] m_map[paddr];
-    m_map.erase(paddr);
+    if (m_parent) {
+        ERROR("PMEM views cannot free");
+        return false;
+    }
+    m_generation.store(++s_generation, std::memory_order_release);
+    // hand the page back to the kernel, it reads as zero when reallocated
+    madvise(m_pages[index], m_pagesize, MADV_DONTNEED);
+    m_pages[index] = nullptr;
+    --m_num_pages;
     return true;
 }
 
-bool PhysicalMemory::write(paddr_t paddr, const void* data_, const bool mask[], uint64_t size) {
-    const uint8_t* data = static_cast<const uint8_t*>(data_);
-    paddr_t first_page_base = get_page_base(paddr);
-    paddr_t first_page_end = first_page_base + m_pagesize - 1;
-    if (paddr + size - 1 > first_page_end) {
-        uint64_t size_this_copy = first_page_end - paddr + 1;
-        if (!write(first_page_end + 1, data + size_this_copy, mask + size_this_copy, size - size_this_copy))
-            return false;
-        size = size_this_copy;
+bool PhysicalMemory::map_range(paddr_t paddr, uint64_t size, bool alloc) {
+    if (size > m_size || paddr > m_size - size) {
+        return false;
     }
-    if (m_map.find(first_page_base) == m_map.end()) {
-        if (m_auto_alloc) {
-            page_alloc(first_page_base);
-        } else {
-            FATAL("PMEM page at 0x%lx not allocated, cannot write", paddr);
+    paddr_t page_end = paddr + size;
+    for (paddr_t page_base = get_page_base(paddr); page_base < page_end; page_base += m_pagesize) {
+        if (page_lookup(page_base) == nullptr && (!alloc || !page_alloc(page_base)))
             return false;
-        }
+        // only writes map ranges, a view copies the pages first
+        if (m_parent)
+            page_own(page_base);
+    }
+    return true;
+}
+
+bool PhysicalMemory::write(paddr_t paddr, const void* data_, const bool mask[], uint64_t size) {
+    const uint8_t* data = static_cast<const uint8_t*>(data_);
+    if (!map_range(paddr, size, m_auto_alloc)) {
+        FATAL("PMEM page at 0x%lx not allocated, cannot write", paddr);
+        return false;
     }
-    uint8_t* buf = m_map.at(first_page_base) + paddr - first_page_base;
+    uint8_t* buf = m_base + paddr;
     for (uint64_t i = 0; i < size; i++) {
         if (mask[i]) {
             buf[i] = data[i];
+            if (m_parent)
+                mark_written(paddr + i, 1);
         }
     }
     return true;
 }
 
-bool PhysicalMemory::write(paddr_t paddr, const void* data_, uint64_t size) {
+bool PhysicalMemory::write(paddr_t paddr, const void* data, uint64_t size) {
+    if (!map_range(paddr, size, m_auto_alloc)) {
+        FATAL("PMEM page at 0x%lx not allocated, cannot write", paddr);
+        return false;
+    }
+    std::memcpy(m_base + paddr, data, size);
+    if (m_parent)
+        mark_written(paddr, size);
+    return true;
+}
+
+bool PhysicalMemory::fill(paddr_t paddr, const void* pattern, uint64_t pattern_size, uint64_t size) {
+    if (0 == pattern_size || 0 != (size % pattern_size)) {
+        ERROR("PMEM fill of %lu bytes is not a multiple of its %lu byte pattern", size, pattern_size);
+        return false;
+    }
+    if (!map_range(paddr, size, m_auto_alloc)) {
+        FATAL("PMEM page at 0x%lx not allocated, cannot write", paddr);
+        return false;
+    }
+    if (m_parent)
+        mark_written(paddr, size);
+    uint8_t* buf = m_base + paddr;
+    if (1 == pattern_size) {
+        std::memset(buf, *static_cast<const uint8_t*>(pattern), size);
+        return true;
+    }
+    // lay the pattern once, then keep doubling the filled prefix
+    uint64_t done = std::min(pattern_size, size);
+    std::memcpy(buf, pattern, done);
+    while (done < size) {
+        uint64_t count = std::min(done, size - done);
+        std::memcpy(buf + done, buf, count);
+        done += count;
+    }
+    return true;
+}
+
+bool PhysicalMemory::write_masked(paddr_t paddr, const void* data_, uint64_t mask, uint64_t size) {
     const uint8_t* data = static_cast<const uint8_t*>(data_);
-    paddr_t first_page_base = get_page_base(paddr);
-    paddr_t first_page_end = first_page_base + m_pagesize - 1;
-    if (paddr + size - 1 > first_page_end) {
-        uint64_t size_this_copy = first_page_end - paddr + 1;
-        if (!write(first_page_end + 1, data + size_this_copy, size - size_this_copy))
-            return false;
-        size = size_this_copy;
+    if (size > 64) {
+        ERROR("PMEM masked write of %lu bytes exceeds 64 bytes", size);
+        return false;
     }
-    if (m_map.find(first_page_base) == m_map.end()) {
-        if (m_auto_alloc) {
-            page_alloc(first_page_base);
-        } else {
-            FATAL("PMEM page at 0x%lx not allocated, cannot write", paddr);
-            return false;
+    if (size < 64) {
+        mask &= (1ull << size) - 1;
+    }
+    if (0 == mask)
+        return true;
+    if (!map_range(paddr, size, m_auto_alloc)) {
+        FATAL("PMEM page at 0x%lx not allocated, cannot write", paddr);
+        return false;
+    }
+    if (m_parent)
+        mark_written(paddr, size, mask);
+    uint8_t* buf = m_base + paddr;
+#ifdef __AVX512BW__
+    if (64 == size) {
+        _mm512_mask_storeu_epi8(buf, mask, _mm512_loadu_si512(data));
+        return true;
+    }
+#endif
+    // blend one 64-bit word at a time
+    for (uint64_t i = 0; i < size; i += 8) {
+        uint32_t bits = (mask >> i) & 0xff;
+        if (0 == bits)
+            continue;
+        uint64_t n = (size - i < 8) ? (size - i) : 8;
+        if (0xff == bits) {
+            std::memcpy(buf + i, data + i, 8);
+            continue;
         }
+        uint64_t dst = 0, src = 0;
+        std::memcpy(&dst, buf + i, n);
+        std::memcpy(&src, data + i, n);
+        uint64_t byte_mask = s_byte_masks[bits];
+        dst = (dst & ~byte_mask) | (src & byte_mask);
+        std::memcpy(buf + i, &dst, n);
     }
-    uint8_t* buf = m_map.at(first_page_base) + paddr - first_page_base;
-    std::memcpy(buf, data, size);
     return true;
 }
 
-bool PhysicalMemory::read(paddr_t paddr, void* data_, uint64_t size) const {
-    bool success = true;
-    uint8_t* data = static_cast<uint8_t*>(data_);
-    paddr_t first_page_base = get_page_base(paddr);
-    paddr_t first_page_end = first_page_base + m_pagesize - 1;
-    if (paddr + size - 1 > first_page_end) {
-        uint64_t size_this_copy = first_page_end - paddr + 1;
-        success = read(first_page_end + 1, data + size_this_copy, size - size_this_copy);
-        size = size_this_copy;
+bool PhysicalMemory::read(paddr_t paddr, void* data, uint64_t size) const {
+    if (size > m_size || paddr > m_size - size) {
+        ERROR("PMEM address 0x%lx out of range, read as all zero", paddr);
+        std::memset(data, 0, size);
+        return false;
     }
-    if (m_map.find(first_page_base) == m_map.end()) {
+    if (m_parent) {
+        // pages not yet written are read from the parent
+        uint8_t* out = static_cast<uint8_t*>(data);
+        paddr_t page_base = get_page_base(paddr);
+        for (uint64_t done = 0; done < size;) {
+            uint64_t offset = (paddr + done) - page_base;
+            uint64_t count = std::min(size - done, m_pagesize - offset);
+            const uint8_t* page = page_lookup(page_base);
+            if (page == nullptr) {
+                ERROR("PMEM page at 0x%lx not allocated, read as all zero", page_base);
+                std::memset(out + done, 0, count);
+            } else {
+                std::memcpy(out + done, page + offset, count);
+            }
+            done += count;
+            page_base += m_pagesize;
+        }
+        return host_ptr(paddr, size) != nullptr;
+    }
+    // unallocated pages are never touched and read back as zero
+    std::memcpy(data, m_base + paddr, size);
+    if (host_ptr(paddr, size) == nullptr) {
         ERROR("PMEM page at 0x%lx not allocated, read as all zero", paddr);
-        std::memset(data, 0, size);
         return false;
     }
-    uint8_t* buf = m_map.at(first_page_base) + paddr - first_page_base;
-    std::memcpy(data, buf, size);
-    return success;
+    return true;
+}
+
+uint8_t* PhysicalMemory::host_ptr(paddr_t paddr, uint64_t size) const {
+    if (size > m_size || paddr > m_size - size) {
+        return nullptr;
+    }
+    paddr_t page_end = paddr + size;
+    for (paddr_t page_base = get_page_base(paddr); page_base < page_end; page_base += m_pagesize) {
+        if (page_lookup(page_base) == nullptr)
+            return nullptr;
+    }
+    return m_base + paddr;
 }
 
 PhysicalMemory::~PhysicalMemory() {
-    if(!m_auto_alloc && !m_map.empty()) {
+    if(!m_auto_alloc && !m_parent && m_num_pages != 0) {
         WARN("PMEM pages not freed before destruction");
     }
-    for (auto& [paddr, ptr] : m_map) {
-        delete[] ptr;
+    munmap(m_base, m_size);
+}
+
+struct mem_block_t {
+    uint64_t addr;
+    uint64_t size;
+};
+
+bool PhysicalMemory::save(std::ostream& os) const {
+    ckpt_put(os, m_pagesize);
+    std::vector<mem_block_t> blocks;
+    for (auto& block : m_allocator.blocks()) {
+        blocks.push_back({block.first, block.second});
+    }
+    ckpt_put(os, blocks);
+    // pages outside blocks come from auto_alloc, zero pages are not stored
+    ckpt_put(os, m_num_pages);
+    for (uint64_t index = 0; index < m_pages.size(); ++index) {
+        const uint8_t* page = m_pages[index];
+        if (page == nullptr)
+            continue;
+        bool zero = (page[0] == 0) && 0 == memcmp(page, page + 1, m_pagesize - 1);
+        ckpt_put(os, index);
+        ckpt_put(os, uint8_t(!zero));
+        if (!zero) {
+            os.write(reinterpret_cast<const char*>(page), m_pagesize);
+        }
+    }
+    return bool(os);
+}
+
+bool PhysicalMemory::restore(std::istream& is) {
+    // read and check the whole checkpoint first, the current contents are
+    // only replaced once it is known to be good
+    uint64_t pagesize;
+    std::vector<mem_block_t> blocks;
+    uint64_t num_pages;
+    if (!ckpt_get(is, pagesize) || !ckpt_get(is, blocks) || !ckpt_get(is, num_pages))
+        return false;
+    if (pagesize != m_pagesize) {
+        ERROR("PMEM checkpoint page size %lu, expected %lu", pagesize, m_pagesize);
+        return false;
+    }
+    if (num_pages > m_pages.size())
+        return false;
+    MemoryAllocator allocator(ALLOC_BASE_ADDR, GLOBAL_MEM_SIZE - ALLOC_BASE_ADDR, m_pagesize);
+    for (auto& block : blocks) {
+        if (!allocator.reserve(block.addr, block.size)) {
+            ERROR("PMEM checkpoint block at 0x%lx size 0x%lx is invalid", block.addr, block.size);
+            return false;
+        }
+    }
+    std::vector<std::pair<uint64_t, bool>> pages; // index, stored
+    std::vector<uint8_t> data;                    // of the stored pages
+    for (uint64_t i = 0; i < num_pages; ++i) {
+        uint64_t index;
+        uint8_t stored;
+        if (!ckpt_get(is, index) || !ckpt_get(is, stored) || index >= m_pages.size())
+            return false;
+        if (stored) {
+            data.resize(data.size() + m_pagesize);
+            if (!is.read(reinterpret_cast<char*>(data.data() + data.size() - m_pagesize), m_pagesize))
+                return false;
+        }
+        pages.push_back({index, 0 != stored});
+    }
+
+    // drop the current contents, released pages read back as zero
+    std::vector<uint64_t> used;
+    for (auto& block : m_allocator.blocks()) {
+        used.push_back(block.first);
+    }
+    for (auto addr : used) {
+        this->free(addr);
+    }
+    for (uint64_t index = 0; index < m_pages.size(); ++index) {
+        if (m_pages[index] != nullptr) {
+            this->page_free(index << m_pageshift);
+        }
+    }
+
+    for (auto& block : blocks) {
+        if (!this->reserve(block.addr, block.size))
+            return false;
+    }
+    const uint8_t* stored_data = data.data();
+    for (auto& page : pages) {
+        uint64_t index = page.first;
+        if (m_pages[index] == nullptr && !this->page_alloc(index << m_pageshift))
+            return false;
+        if (page.second) {
+            memcpy(m_pages[index], stored_data, m_pagesize);
+            stored_data += m_pagesize;
+        }
+    }
+    return true;
+}
+
+uint64_t PhysicalMemory::merge(const std::vector<PhysicalMemory*>& views,
+                               paddr_t scratch_addr, uint64_t scratch_size) {
+    // pages written by any view, with the views that wrote them
+    std::map<uint64_t, std::vector<PhysicalMemory*>> written;
+    for (auto view : views) {
+        if (view->m_parent != this) {
+            ERROR("PMEM merge of a view of another memory");
+            continue;
+        }
+        for (auto index : view->m_dirty) {
+            written[index].push_back(view);
+        }
+    }
+
+    // bytes written by more than one view, found before anything is merged
+    const uint64_t words = m_pagesize / 64;
+    uint64_t conflicts = 0;
+    for (auto& entry : written) {
+        if (entry.second.size() < 2)
+            continue;
+        uint64_t index = entry.first;
+        paddr_t page_base = index << m_pageshift;
+        for (uint64_t w = 0; w < words; ++w) {
+            uint64_t seen = 0, twice = 0;
+            for (auto view : entry.second) {
+                uint64_t bits = view->written_bits(index)[w];
+                twice |= seen & bits;
+                seen |= bits;
+            }
+            for (; twice; twice &= twice - 1) {
+                paddr_t addr = page_base + w * 64 + __builtin_ctzll(twice);
+                if (addr >= scratch_addr && addr - scratch_addr < scratch_size)
+                    continue;
+                if (0 == conflicts) {
+                    WARN("PMEM conflicting writes to 0x%lx", addr);
+                }
+                ++conflicts;
+            }
+        }
+    }
+    if (conflicts) {
+        WARN("PMEM %lu bytes written by several views, none merged", conflicts);
+        return conflicts;
+    }
+
+    for (auto& entry : written) {
+        uint64_t index = entry.first;
+        paddr_t page_base = index << m_pageshift;
+        if (m_pages[index] == nullptr && !page_alloc(page_base))
+            continue;
+        uint8_t* page = m_pages[index];
+        for (auto view : entry.second) {
+            const uint8_t* copy = view->m_pages[index];
+            const uint64_t* bits = view->written_bits(index);
+            for (uint64_t w = 0; w < words; ++w) {
+                // 64 bytes at a time, most of a page is usually untouched
+                if (0 == bits[w])
+                    continue;
+                if (~0ull == bits[w]) {
+                    std::memcpy(page + w * 64, copy + w * 64, 64);
+                    continue;
+                }
+                for (uint64_t b = bits[w]; b; b &= b - 1) {
+                    uint64_t i = w * 64 + __builtin_ctzll(b);
+                    page[i] = copy[i];
+                }
+            }
+        }
     }
+    return 0;
 }
@@ -1,46 +1,135 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <iosfwd>
 #include <map>
 #include <memory>
 #include <new>
+#include <vector>
 
-#define LOG(level, format, ...)                                                \
-  do {                                                                         \
-    printf("[" level "] %s:%d " format "\n", __FILE__, __LINE__,               \
-           ##__VA_ARGS__);                                                     \
-  } while (0)
-#define INFO(format, ...) LOG("info", format, ##__VA_ARGS__);
-#define WARN(format, ...) LOG("warn", format, ##__VA_ARGS__);
-#define ERROR(format, ...) LOG("error", format, ##__VA_ARGS__);
-#define FATAL(format, ...) LOG("fatal", format, ##__VA_ARGS__);
+#include "logger.h"
+#include "mem_alloc.h"
 
 typedef uint64_t paddr_t;
 
 class PhysicalMemory {
 public:
-  PhysicalMemory() {}
-  PhysicalMemory(bool auto_alloc, uint64_t pagesize)
-      : m_auto_alloc(auto_alloc), m_pagesize(pagesize) {}
+  PhysicalMemory();
+  PhysicalMemory(bool auto_alloc, uint64_t pagesize);
+  // copy-on-write view of parent: reads see the parent until a page is
+  // written, which copies it; the parent must not change while views of it
+  // are in use and views cannot allocate
+  explicit PhysicalMemory(const PhysicalMemory *parent);
   ~PhysicalMemory();
 
-  bool alloc(paddr_t *paddr, uint64_t size);
+  // allocate device memory, alignment 0 means page aligned
+  bool alloc(paddr_t *paddr, uint64_t size, uint64_t alignment = 0);
+  // allocate device memory at a fixed address
+  bool reserve(paddr_t paddr, uint64_t size);
   bool free(paddr_t paddr);
+  void mem_info(uint64_t *mem_free, uint64_t *mem_used) const;
   bool page_alloc(paddr_t paddr);
   bool page_free(paddr_t paddr);
   bool write(paddr_t paddr, const void *data, const bool mask[], uint64_t size);
   bool write(paddr_t paddr, const void *data, uint64_t size);
+  // byte-masked write of up to one cache line, bit i of mask enables byte i
+  bool write_masked(paddr_t paddr, const void *data, uint64_t mask,
+                    uint64_t size);
   bool read(paddr_t paddr, void *data, uint64_t size) const;
+  // repeat pattern over the range in place, size is a multiple of
+  // pattern_size
+  bool fill(paddr_t paddr, const void *pattern, uint64_t pattern_size,
+            uint64_t size);
+  // direct host pointer into device memory, nullptr if any page of the range
+  // is not allocated
+  uint8_t *host_ptr(paddr_t paddr, uint64_t size) const;
+  // allocations and contents of every allocated page, restore replaces the
+  // current ones and leaves them untouched when the checkpoint is bad
+  bool save(std::ostream &os) const;
+  bool restore(std::istream &is);
+  // write back the bytes each view wrote, whatever their value; returns the
+  // number of bytes written by several views, and then leaves this memory
+  // unchanged. Scratch bytes, reused by every view, are merged without a
+  // check, the later view wins them
+  uint64_t merge(const std::vector<PhysicalMemory *> &views,
+                 paddr_t scratch_addr = 0, uint64_t scratch_size = 0);
   inline paddr_t get_page_base(paddr_t paddr) const {
-    return paddr - paddr % m_pagesize;
+    return paddr & ~(m_pagesize - 1);
   }
 
 private:
+  // allocate the pages backing an allocator block, undo it on failure
+  bool block_commit(paddr_t paddr);
+
+  // check that every page of the range is allocated (allocating it when
+  // auto_alloc is set), returns false on the first missing page
+  bool map_range(paddr_t paddr, uint64_t size, bool alloc);
+
+  // give a view its own copy of the page before it is written
+  void page_own(paddr_t page_base);
+
+  // views: record the bytes a write stores to, byte_mask selects bytes of a
+  // write of at most 64 bytes
+  void mark_written(paddr_t paddr, uint64_t size);
+  void mark_written(paddr_t paddr, uint64_t size, uint64_t byte_mask);
+  // bit per byte of an owned page of a view
+  uint64_t *written_bits(uint64_t index) {
+    return m_written.data() + (m_owned[index] - 1) * (m_pagesize / 64);
+  }
+
+  // page lookup: one-entry per-thread cache in front of the flat page table
+  inline uint8_t *page_lookup(paddr_t page_base) const {
+    auto &last = s_last_page;
+    uint64_t gen = m_generation.load(std::memory_order_acquire);
+    if (last.owner == this && last.base == page_base && last.gen == gen)
+      return last.page;
+    uint64_t index = page_base >> m_pageshift;
+    if (index >= m_pages.size())
+      return nullptr;
+    uint8_t *page = m_pages[index];
+    if (page != nullptr) {
+      last = {this, page_base, gen, page};
+    }
+    return page;
+  }
+
+  struct last_page_t {
+    const PhysicalMemory *owner;
+    paddr_t base;
+    uint64_t gen;
+    uint8_t *page;
+  };
+  static thread_local last_page_t s_last_page;
+  static std::atomic<uint64_t> s_generation;
+
   const bool m_auto_alloc = false;
   const uint64_t m_pagesize = 4096;
+  const uint32_t m_pageshift = 12;
+
+  // whole device address space, reserved with a single MAP_NORESERVE mapping
+  // so that the kernel zero-fills pages lazily on first touch
+  uint8_t *m_base = nullptr;
+  uint64_t m_size = 0;
+
+  // flat page table covering GLOBAL_MEM_SIZE, indexed by page number
+  std::vector<uint8_t *> m_pages;
+  uint64_t m_num_pages = 0;
+  // renewed (globally unique) whenever a page is released, this invalidates
+  // the last-page caches of every thread
+  std::atomic<uint64_t> m_generation;
+
+  // views only: pages still shared with the parent are not owned, the owned
+  // ones are listed in the order they were copied and m_owned holds their
+  // position in m_dirty plus one; m_written has a bit per byte the view
+  // wrote, page after page in the same order
+  const PhysicalMemory *m_parent = nullptr;
+  std::vector<uint32_t> m_owned;
+  std::vector<uint64_t> m_dirty;
+  std::vector<uint64_t> m_written;
 
-  std::map<paddr_t, uint8_t *> m_map;
-  std::map<paddr_t, uint32_t> m_alloc_records;
+  MemoryAllocator m_allocator;
 };
@@ -13,38 +13,49 @@
 
 #include "processor.h"
 #include "Vgpgpu_top_wrapper.h"
+#include "checkpoint.h"
+#include "emulator.h"
+#include "mem_port.h"
 #include "memory.h"
+#include "vl_bits.h"
+#include "vt_config.h"
 
-#define FST_OUTPUT
+#if VM_TRACE
+#include <verilated_fst_c.h>
+#endif
 
-#ifdef FST_OUTPUT
-#include <verilated_vcd_c.h>
+#ifdef VT_SAVABLE
+#include <verilated_save.h>
 #endif
 
+#include "Vgpgpu_top_wrapper__Dpi.h"
+#include "svdpi.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 
+#include <deque>
 #include <list>
 #include <map>
 #include <ostream>
 #include <queue>
+#include <random>
+#include <set>
 #include <sstream>
 #include <tuple>
+#include <utility>
 #include <unordered_map>
 #include <vector>
 
-#ifndef MEM_CLOCK_RATIO
-#define MEM_CLOCK_RATIO 1
-#endif
-
-#ifndef TRACE_START_TIME
-#define TRACE_START_TIME 0ull
-#endif
-
-#ifndef TRACE_STOP_TIME
-#define TRACE_STOP_TIME -1ull
-#endif
+#include <pthread.h>
+#include <sched.h>
 
 #ifndef VERILATOR_RESET_VALUE
 #define VERILATOR_RESET_VALUE 2
@@ -54,120 +65,804 @@
 #define RESET_DELAY 60
 #endif
 
-#define PLATFORM_MEMORY_DATA_SIZE 8
-#define WARP_SIZE 32
-#define NUMBER_CU 1
+// hardware configuration and CTA scheduler limits, from define.v
+constexpr uint32_t WARP_SIZE = hw::NUM_THREAD;
+using hw::L2CACHE_BEATBYTES;
+using hw::NUM_L2CACHE;
+using hw::NUM_SM_IN_CLUSTER;
+using hw::NUM_WARP;
+using hw::NUMBER_CU;
+using hw::NUMBER_LDS_SLOTS;
+using hw::NUMBER_SGPR_SLOTS;
+using hw::NUMBER_VGPR_SLOTS;
+using hw::NUMBER_WF_SLOTS;
+using hw::WG_ID_WIDTH;
+using hw::WG_NUM_MAX;
+
+// workgroup resources of kernels that do not report theirs, the local
+// memory on top of the warp stacks
+#define DEFAULT_GPR_PER_WARP 64
+#define DEFAULT_LDS_SIZE 128
+
+// a warp always holds the 32 architectural registers of either file, crt0
+// gives each warp a scalar stack at the start of the workgroup's local memory
+#define MIN_GPR_PER_WARP 32
+#define WARP_STACK_SIZE 1024
+
+// event bits reported by vt_event_probe (vt_probes.sv)
+#define PERF_EVT_ICACHE_HIT   0
+#define PERF_EVT_ICACHE_MISS  1
+#define PERF_EVT_DCACHE_HIT   2
+#define PERF_EVT_DCACHE_MISS  3
+#define PERF_EVT_DCACHE_MSHR  4
+#define PERF_EVT_SMEM_ACCESS  5
+#define PERF_EVT_L2_HIT       6
+#define PERF_EVT_L2_MISS      7
+#define PERF_EVT_COUNT        8
+
+static const uint32_t s_event_counters[PERF_EVT_COUNT] = {
+    VX_PERF_ICACHE_HITS, VX_PERF_ICACHE_MISSES, VX_PERF_DCACHE_HITS,
+    VX_PERF_DCACHE_MISSES, VX_PERF_DCACHE_MSHR_STALLS, VX_PERF_SMEM_ACCESSES,
+    VX_PERF_L2_HITS, VX_PERF_L2_MISSES};
+
+static_assert(L2CACHE_BEATBYTES <= MEM_PORT_MAX_BEAT, "L2 beat too wide");
+
+// each device keeps its time in its own VerilatedContext, legacy callers
+// get the one of the model evaluating on this thread
+double sc_time_stamp() { return Verilated::threadContextp()->time(); }
+
+// device instances, numbers the default trace files
+static std::atomic<uint32_t> s_instances(0);
+
+///////////////////////////////////////////////////////////////////////////////
+
+// receiver of the events reported by the RTL probes (vt_probes.sv)
+class ProbeSink {
+public:
+  virtual ~ProbeSink() {}
+  virtual void on_register(svScope scope) = 0;
+  virtual void on_issue(uint32_t sm, uint32_t wid, uint32_t pc) = 0;
+  virtual void on_commit(uint32_t sm, int x_wid, int v_wid) = 0;
+  virtual void on_event(uint32_t unit, uint32_t events) = 0;
+};
 
-static uint64_t timestamp = 0;
+struct sm_probe_t {
+  ProbeSink *sink;
+  uint32_t sm; // SM index, or L2 slice for probes inside the L2
+};
 
-double sc_time_stamp() { return timestamp; }
+// model whose initial blocks are running, probes register with it
+static thread_local ProbeSink *s_probe_owner = nullptr;
+static int s_probe_key;
+
+// SM index from the generate blocks of GPGPU_top (A1[cluster].A2[sm])
+static bool probe_index(const char *scope, const char *block, uint32_t *index) {
+  std::string name(scope);
+  for (auto sep : {"[", "__BRA__"}) {
+    auto pos = name.find(std::string(block) + sep);
+    if (pos != std::string::npos) {
+      *index = std::atoi(name.c_str() + pos + strlen(block) + strlen(sep));
+      return true;
+    }
+  }
+  return false;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 
-static bool trace_enabled = false;
-static uint64_t trace_start_time = TRACE_START_TIME;
-static uint64_t trace_stop_time = TRACE_STOP_TIME;
+static uint64_t env_u64(const char *name, uint64_t default_value) {
+  const char *value = std::getenv(name);
+  if (value == nullptr || *value == 0)
+    return default_value;
+  return std::strtoull(value, nullptr, 0);
+}
+
+// VT_TRACE=1 turns tracing on, VT_TRACE_FILE, VT_TRACE_DEPTH,
+// VT_TRACE_START/VT_TRACE_STOP (launch cycles), VT_TRACE_WG, VT_TRACE_PC,
+// VT_TRACE_ADDR=<addr>[:<size>] and VT_TRACE_CYCLES refine it
+static void trace_config_from_env(trace_config_t *config) {
+  memset(config, 0, sizeof(trace_config_t));
+  config->enable = env_u64("VT_TRACE", 0) != 0;
+  config->depth = env_u64("VT_TRACE_DEPTH", 0);
+  config->start_cycle = env_u64("VT_TRACE_START", 0);
+  config->stop_cycle = env_u64("VT_TRACE_STOP", UINT64_MAX);
+  if (std::getenv("VT_TRACE_WG")) {
+    config->trigger_mask |= TRACE_TRIGGER_WG;
+    config->trigger_wg = env_u64("VT_TRACE_WG", 0);
+  }
+  if (std::getenv("VT_TRACE_PC")) {
+    config->trigger_mask |= TRACE_TRIGGER_PC;
+    config->trigger_pc = env_u64("VT_TRACE_PC", 0);
+  }
+  if (const char *addr = std::getenv("VT_TRACE_ADDR")) {
+    char *end;
+    config->trigger_mask |= TRACE_TRIGGER_ADDR;
+    config->watch_addr = std::strtoul(addr, &end, 0);
+    config->watch_size = (*end == ':') ? std::strtoul(end + 1, nullptr, 0) : 4;
+  }
+  config->trigger_cycles = env_u64("VT_TRACE_CYCLES", 0);
+  if (const char *filename = std::getenv("VT_TRACE_FILE")) {
+    strncpy(config->filename, filename, sizeof(config->filename) - 1);
+  }
+}
 
-bool sim_trace_enabled() {
-  if (timestamp >= trace_start_time && timestamp < trace_stop_time)
-    return true;
-  return trace_enabled;
+// VT_SAMPLE=every:<period>[:<offset>], random:<count>[:<seed>] or
+// ids:<index>,<index>,... samples the launches, unset simulates them whole
+static void sample_config_from_env(sample_config_t *config) {
+  memset(config, 0, sizeof(sample_config_t));
+  const char *value = std::getenv("VT_SAMPLE");
+  if (value == nullptr || *value == 0)
+    return;
+  char *end;
+  if (0 == strncmp(value, "every:", 6)) {
+    config->mode = SAMPLE_EVERY;
+    config->period = std::strtoul(value + 6, &end, 0);
+    config->offset = (*end == ':') ? std::strtoul(end + 1, &end, 0) : 0;
+  } else if (0 == strncmp(value, "random:", 7)) {
+    config->mode = SAMPLE_RANDOM;
+    config->count = std::strtoul(value + 7, &end, 0);
+    config->seed = (*end == ':') ? std::strtoul(end + 1, &end, 0) : 1;
+  } else if (0 == strncmp(value, "ids:", 4)) {
+    config->mode = SAMPLE_LIST;
+    end = (char *)value + 3;
+    do {
+      if (config->num_ids < SAMPLE_MAX_IDS)
+        config->ids[config->num_ids++] = std::strtoul(end + 1, &end, 0);
+    } while (*end == ',');
+  } else {
+    end = (char *)value;
+  }
+  if (*end != 0 || (config->mode == SAMPLE_EVERY && config->period == 0)) {
+    VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM, "malformed VT_SAMPLE '%s', sampling off", value);
+    config->mode = SAMPLE_OFF;
+  }
 }
 
-void sim_trace_enable(bool enable) { trace_enabled = enable; }
+// VT_SIM_AFFINITY=<cpu>[-<cpu>][,...] restricts the calling thread to the
+// listed cores, returns the first one or -1 when unset
+static int sim_affinity(bool first_only) {
+  const char *list = std::getenv("VT_SIM_AFFINITY");
+  if (list == nullptr || *list == 0)
+    return -1;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  int first = -1;
+  for (const char *p = list; *p;) {
+    char *end;
+    int lo = std::strtol(p, &end, 0);
+    int hi = (*end == '-') ? std::strtol(end + 1, &end, 0) : lo;
+    for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu) {
+      if (first < 0)
+        first = cpu;
+      if (!first_only || cpu == first)
+        CPU_SET(cpu, &set);
+    }
+    p = (*end == ',') ? end + 1 : end;
+    if (end == p && *p) {
+      VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM, "malformed VT_SIM_AFFINITY '%s'", list);
+      return -1;
+    }
+  }
+  if (first < 0 || pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+    VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM, "cannot apply VT_SIM_AFFINITY '%s'", list);
+    return -1;
+  }
+  return first;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 
-class Processor::Impl {
+// size the workgroup of info->num_warps warps after what the kernel reports,
+// the resource table then packs as many of them per SM as fit
+static void workgroup_resources(uint32_t vgprs, uint32_t sgprs, uint32_t lds_size, dispatch_info_t* info) {
+  info->vgpr_size_per_warp = vgprs ? std::max<uint32_t>(vgprs, MIN_GPR_PER_WARP) : DEFAULT_GPR_PER_WARP;
+  info->sgpr_size_per_warp = sgprs ? std::max<uint32_t>(sgprs, MIN_GPR_PER_WARP) : DEFAULT_GPR_PER_WARP;
+  info->vgpr_size_total = info->num_warps * info->vgpr_size_per_warp;
+  info->sgpr_size_total = info->num_warps * info->sgpr_size_per_warp;
+  // every workgroup carries its warps' crt0 stacks, reported or not
+  info->lds_size_total = info->num_warps * WARP_STACK_SIZE +
+                         ((vgprs || sgprs || lds_size) ? lds_size : DEFAULT_LDS_SIZE);
+}
+
+class Processor::Impl : public ProbeSink {
 public:
-  Impl() : grid_finish_(false), wg_finish_count_(0), cycles_(0) {
+  Impl()
+      : id_(s_instances++), grid_finish_(false), wg_finish_count_(0),
+        wg_dispatch_count_(0), wg_num_totals_(0), cycles_(0) {
+    // every device owns its context, devices simulate independently
+    context_ = new VerilatedContext();
+
     // force random values for uninitialized signals
-    Verilated::randReset(VERILATOR_RESET_VALUE);
-    Verilated::randSeed(50);
+    context_->randReset(VERILATOR_RESET_VALUE);
+    context_->randSeed(50);
 
     // turn off assertion before reset
-    Verilated::assertOn(false);
+    context_->assertOn(false);
+
+#if VM_TRACE
+    // tracing is attached on demand, the model must allow it from the start
+    context_->traceEverOn(true);
+    tfp_ = nullptr;
+#endif
+
+    // the thread count is fixed when the model is verilated (THREADS=N),
+    // VT_SIM_THREADS sizes the context's pool for the variant expected loaded
+    uint32_t threads = env_u64("VT_SIM_THREADS", 0);
+    if (threads) {
+      context_->threads(threads);
+    }
+
+    // the model's worker threads start with it and inherit the core set
+    sim_affinity(false);
 
     // create RTL module instance
-    device_ = new Vgpgpu_top_wrapper();
-    info_ = new dispatch_info_t();
+    device_ = new Vgpgpu_top_wrapper(context_, "TOP");
 
-#ifdef FST_OUTPUT
-    Verilated::traceEverOn(true);
-    tfp_ = new VerilatedVcdC();
-    device_->trace(tfp_, 99);
-    tfp_->open("trace.vcd");
-#endif
+    if (threads && threads != device_->threads()) {
+      VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM,
+             "VT_SIM_THREADS=%u but the loaded model runs %u threads", threads,
+             device_->threads());
+    }
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "simulation threads: %u", device_->threads());
+    info_ = new dispatch_info_t();
+    trace_config_from_env(&trace_);
+    sample_config_from_env(&sample_);
+    memset(&estimate_, 0, sizeof(estimate_));
+    grid_size_ = 0;
+    sampled_ = false;
+    max_cycles_ = env_u64("VT_MAX_CYCLES", DEFAULT_MAX_CYCLES);
+    hang_cycles_ = env_u64("VT_HANG_CYCLES", DEFAULT_HANG_CYCLES);
+    last_progress_ = 0;
+    abort_ = false;
+    cancel_ = nullptr;
+    in_launch_ = false;
+    checkpoint_cycle_ = 0;
+    trace_active_ = false;
+    trace_triggered_ = false;
+    trace_trigger_cycle_ = 0;
 
     ram_ = nullptr;
-    active_sms_ = false;
 
-    // reset the device
+    mem_port_config_t mem_config;
+    mem_config.beat_bytes = L2CACHE_BEATBYTES;
+    mem_config.req_queue_size = env_u64("VT_MEM_REQ_QUEUE", MEM_REQ_QUEUE_SIZE);
+    mem_config.rsp_queue_size = env_u64("VT_MEM_RSP_QUEUE", MEM_RSP_QUEUE_SIZE);
+    mem_config.latency = env_u64("VT_MEM_LATENCY", MEM_LATENCY);
+    mem_config.out_of_order = env_u64("VT_MEM_OOO", 0) != 0;
+    for (uint32_t i = 0; i < NUM_L2CACHE; ++i) {
+      mem_ports_.push_back(new MemPort(mem_config, MemTimingModel::create_from_env(mem_config.latency)));
+    }
+
+    this->perf_reset();
+
+    // fast-forwards the workgroups a sampled launch leaves out, unbounded:
+    // the cycle budget is for the RTL
+    emulator_ = new Emulator();
+    emulator_->limits(0);
+
+    // reset the device, the probes register on the first evaluation
+    s_probe_owner = this;
     this->reset();
+    s_probe_owner = nullptr;
 
     // Turn on assertion after reset
-    Verilated::assertOn(true);
+    context_->assertOn(true);
   }
 
   ~Impl() {
-#ifdef FST_OUTPUT
-    tfp_->close();
-    delete tfp_;
+#if VM_TRACE
+    if (tfp_) {
+      tfp_->close();
+      delete tfp_;
+    }
 #endif
+    for (auto probe : probes_) {
+      delete probe;
+    }
 
     delete device_;
+    delete context_;
     delete info_;
+    delete emulator_;
+    for (auto mem_port : mem_ports_) {
+      delete mem_port;
+    }
   }
 
-  void attach_ram(PhysicalMemory *ram) { ram_ = ram; }
+  void attach_ram(PhysicalMemory *ram) {
+    ram_ = ram;
+    emulator_->attach_ram(ram);
+    for (auto mem_port : mem_ports_) {
+      mem_port->attach_ram(ram);
+    }
+  }
 
-  void run(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
-    parse_metadata(metadata, csr_knl_addr);
-#ifndef NDEBUG
-    INFO("%lx: [sim] run() ", timestamp);
+  void trace_config(const trace_config_t &config) { trace_ = config; }
+
+  void on_register(svScope scope) override {
+    auto probe = new sm_probe_t();
+    probe->sink = this;
+    uint32_t cluster = 0, sm = 0, slice = 0;
+    const char *name = svGetNameFromScope(scope);
+    if (name && probe_index(name, "A1", &cluster) &&
+        probe_index(name, "A2", &sm)) {
+      probe->sm = cluster * NUM_SM_IN_CLUSTER + sm;
+    } else if (name && probe_index(name, "B1", &slice)) {
+      probe->sm = slice;
+    } else {
+      probe->sm = 0;
+    }
+    svPutUserData(scope, &s_probe_key, probe);
+    probes_.push_back(probe);
+  }
+
+  void on_issue(uint32_t sm, uint32_t wid, uint32_t pc) override {
+    last_progress_ = cycles_;
+    if (sm < NUMBER_CU && wid < NUM_WARP) {
+      perf_[VX_PERF_INSTRS][sm]++;
+      perf_[VX_PERF_WARP_INSTRS][sm * NUM_WARP + wid]++;
+    }
+    if ((trace_.trigger_mask & TRACE_TRIGGER_PC) && pc == trace_.trigger_pc) {
+      this->trace_trigger();
+    }
+  }
+
+  void on_commit(uint32_t sm, int x_wid, int v_wid) override {
+    last_progress_ = cycles_;
+    if (sm < NUMBER_CU) {
+      perf_[VX_PERF_WRITEBACKS][sm] += (x_wid >= 0) + (v_wid >= 0);
+    }
+  }
+
+  void on_event(uint32_t unit, uint32_t events) override {
+    for (uint32_t i = 0; i < PERF_EVT_COUNT; ++i) {
+      if (events & (1u << i)) {
+        auto &counter = perf_[s_event_counters[i]];
+        if (unit < counter.size()) {
+          counter[unit]++;
+        }
+      }
+    }
+  }
+
+  int perf_query(uint32_t counter, uint32_t index, uint64_t *value) const {
+    if (counter >= VX_PERF_COUNT)
+      return -1;
+    auto &units = perf_[counter];
+    if (index == VX_PERF_ALL) {
+      uint64_t total = 0;
+      for (auto count : units) {
+        total = (counter == VX_PERF_CTA_LATENCY_MAX) ? std::max(total, count)
+                                                     : total + count;
+      }
+      *value = total;
+      return 0;
+    }
+    if (index >= units.size())
+      return -1;
+    *value = units[index];
+    return 0;
+  }
+
+  void limits(uint64_t max_cycles, uint64_t hang_cycles) {
+    max_cycles_ = max_cycles;
+    hang_cycles_ = hang_cycles;
+  }
+
+  void private_segment(uint32_t base_addr) {
+    info_->pds_baseaddr = base_addr;
+    emulator_->private_segment(base_addr);
+  }
+
+  void abort() {
+    abort_ = true;
+    emulator_->abort();
+  }
+
+  void sample_config(const sample_config_t &config) { sample_ = config; }
+
+  int sample_estimate(sample_estimate_t *estimate) const {
+    if (estimate_.num_workgroups == 0)
+      return -1;
+    *estimate = estimate_;
+    return 0;
+  }
+
+  int run(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+    this->launch_reset(metadata, csr_knl_addr);
+
+    if (sample_.mode != SAMPLE_OFF) {
+      sampled_ = true;
+      int status = this->fast_forward(metadata, csr_knl_addr);
+      if (status != VX_LAUNCH_COMPLETED)
+        return status;
+    }
+
+    // start
+    device_->rst_n = 1;
+
+    return this->simulate();
+  }
+
+  int run(metadata_buffer_t metadata, uint64_t csr_knl_addr,
+          const std::vector<uint32_t> &workgroups, const std::atomic<bool> *cancel) {
+    this->launch_reset(metadata, csr_knl_addr);
+    wg_order_ = workgroups;
+    wg_num_totals_ = wg_order_.size();
+    cancel_ = cancel;
+
+    device_->rst_n = 1;
+
+    int status = this->simulate();
+    cancel_ = nullptr;
+    return status;
+  }
+
+  // continue a launch restored mid-flight
+  int resume() {
+    if (!in_launch_) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "no launch to resume");
+      return VX_LAUNCH_ABORTED;
+    }
+    abort_ = false;
+    return this->simulate();
+  }
+
+  // save to filename once a launch reaches cycle, 0 disarms
+  void checkpoint_at(uint64_t cycle, const char *filename) {
+    checkpoint_cycle_ = cycle;
+    checkpoint_file_ = filename ? filename : "";
+  }
+
+  int save(const char *filename) {
+    std::ofstream os(filename, std::ios::binary);
+    if (!os) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "cannot create checkpoint %s", filename);
+      return -1;
+    }
+    if (in_launch_) {
+#ifdef VT_SAVABLE
+      VerilatedSave model_os;
+      model_os.open((std::string(filename) + ".model").c_str());
+      if (!model_os.isOpen()) {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "cannot create checkpoint %s.model", filename);
+        return -1;
+      }
+      model_os << *device_;
+      model_os.close();
+#else
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM,
+             "checkpoints within a launch need the savable build (SAVABLE=1)");
+      return -1;
+#endif
+    }
+
+    os.write(CKPT_MAGIC, 8);
+    ckpt_put(os, uint32_t(NUM_L2CACHE));
+    ckpt_put(os, in_launch_);
+    if (in_launch_) {
+      ckpt_put(os, context_->time());
+      ckpt_put(os, cycles_);
+      ckpt_put(os, last_progress_);
+      ckpt_put(os, *info_);
+      ckpt_put(os, grid_finish_);
+      ckpt_put(os, wg_finish_count_);
+      ckpt_put(os, wg_dispatch_count_);
+      ckpt_put(os, wg_num_totals_);
+      ckpt_put(os, wg_inflight_);
+      ckpt_put(os, wg_free_ids_);
+      ckpt_put(os, wg_dispatch_cycle_);
+      ckpt_put(os, grid_size_);
+      ckpt_put(os, wg_order_);
+      ckpt_put(os, sampled_);
+      ckpt_put(os, wg_latency_);
+      ckpt_put(os, wg_done_cycle_);
+      for (auto &counter : perf_) {
+        ckpt_put(os, counter);
+      }
+      ckpt_put(os, trace_triggered_);
+      ckpt_put(os, trace_trigger_cycle_);
+      for (auto mem_port : mem_ports_) {
+        mem_port->save(os);
+      }
+    }
+    if (!ram_->save(os)) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "cannot write checkpoint %s", filename);
+      return -1;
+    }
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "checkpoint saved to %s at cycle %lu", filename,
+           in_launch_ ? cycles_ : 0);
+    return 0;
+  }
+
+  // returns 1 when a launch is to be resumed, 0 at a launch boundary
+  int restore(const char *filename, uint64_t *csr_knl_addr) {
+    std::ifstream is(filename, std::ios::binary);
+    char magic[8];
+    uint32_t slices;
+    bool in_launch;
+    if (!is || !is.read(magic, 8) || memcmp(magic, CKPT_MAGIC, 8) ||
+        !ckpt_get(is, slices) || !ckpt_get(is, in_launch)) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "%s is not a checkpoint", filename);
+      return -1;
+    }
+    if (slices != NUM_L2CACHE) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "checkpoint has %u L2 slices, the model %u",
+             slices, NUM_L2CACHE);
+      return -1;
+    }
+
+    bool ok = true;
+    if (in_launch) {
+#ifdef VT_SAVABLE
+      VerilatedRestore model_is;
+      model_is.open((std::string(filename) + ".model").c_str());
+      if (!model_is.isOpen()) {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "cannot open checkpoint %s.model", filename);
+        return -1;
+      }
+      model_is >> *device_;
+      model_is.close();
+#else
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM,
+             "checkpoints within a launch need the savable build (SAVABLE=1)");
+      return -1;
 #endif
+      uint64_t time = 0;
+      ok = ckpt_get(is, time) && ckpt_get(is, cycles_) &&
+           ckpt_get(is, last_progress_) && ckpt_get(is, *info_) &&
+           ckpt_get(is, grid_finish_) && ckpt_get(is, wg_finish_count_) &&
+           ckpt_get(is, wg_dispatch_count_) && ckpt_get(is, wg_num_totals_) &&
+           ckpt_get(is, wg_inflight_) && ckpt_get(is, wg_free_ids_) &&
+           ckpt_get(is, wg_dispatch_cycle_) && ckpt_get(is, grid_size_) &&
+           ckpt_get(is, wg_order_) && ckpt_get(is, sampled_) &&
+           ckpt_get(is, wg_latency_) && ckpt_get(is, wg_done_cycle_);
+      for (auto &counter : perf_) {
+        ok = ok && ckpt_get(is, counter);
+      }
+      ok = ok && ckpt_get(is, trace_triggered_) && ckpt_get(is, trace_trigger_cycle_);
+      context_->time(time);
+      for (auto mem_port : mem_ports_) {
+        ok = ok && mem_port->restore(is);
+      }
+    }
+    ok = ok && ram_->restore(is);
+    if (!ok) {
+      VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "checkpoint %s is truncated", filename);
+      in_launch_ = false;
+      return -1;
+    }
+    in_launch_ = in_launch;
+    *csr_knl_addr = in_launch ? info_->csr_knl : 0;
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "checkpoint restored from %s at cycle %lu",
+           filename, in_launch ? cycles_ : 0);
+    return in_launch ? 1 : 0;
+  }
+
+private:
+  void launch_reset(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+    parse_metadata(metadata, csr_knl_addr);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_SIM, "%lx: [sim] run() ", context_->time());
 
     // reset device
     this->reset();
+    this->reset_dispatch();
+    cycles_ = 0;
+    last_progress_ = 0;
+    abort_ = false;
+    trace_triggered_ = false;
+    this->perf_reset();
+    memset(&estimate_, 0, sizeof(estimate_));
+  }
 
-    // start
-    device_->rst_n = 1;
-    device_->host_rsp_ready_i = 1;
-    device_->out_a_ready_i = 1;
+  int simulate() {
+    int status = VX_LAUNCH_COMPLETED;
+    in_launch_ = true;
+
+    // the evaluating thread takes the first core of VT_SIM_AFFINITY
+    sim_affinity(true);
+    auto time_start = std::chrono::steady_clock::now();
+    uint64_t cycle_start = cycles_;
 
     while (!grid_finish_) {
       this->tick();
       cycles_++;
-      INFO("cycles_: %lu", cycles_);
+      this->trace_update();
+      VT_LOG(LOG_LEVEL_TRACE, LOG_CAT_SIM, "cycles_: %lu", cycles_);
+
+      if (checkpoint_cycle_ && cycles_ == checkpoint_cycle_) {
+        checkpoint_cycle_ = 0;
+        this->save(checkpoint_file_.c_str());
+      }
 
-      // TODO
-      if (cycles_ > 6000) {
+      if (max_cycles_ && cycles_ >= max_cycles_) {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "cycle budget of %lu exhausted", max_cycles_);
+        status = VX_LAUNCH_TIMEOUT;
+        break;
+      }
+      if (hang_cycles_ && cycles_ - last_progress_ >= hang_cycles_) {
+        this->report_hang();
+        status = VX_LAUNCH_HUNG;
+        break;
+      }
+      if (0 == (cycles_ & 0x3ff) &&
+          (abort_.load(std::memory_order_relaxed) ||
+           (cancel_ && cancel_->load(std::memory_order_relaxed)))) {
+        VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM, "launch aborted at cycle %lu", cycles_);
+        status = VX_LAUNCH_ABORTED;
         break;
       }
     }
 
     // stop
     device_->rst_n = 0;
+    this->trace_stop();
+    in_launch_ = false;
+
+    uint64_t simulated = cycles_ - cycle_start;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - time_start;
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM,
+           "launch: %lu cycles in %.3f s, %.0f cycles/s, %u threads", simulated,
+           elapsed.count(), simulated / std::max(elapsed.count(), 1e-9),
+           device_->threads());
+
+    this->report_memory();
+    perf_[VX_PERF_CYCLES][0] = cycles_;
+    if (status == VX_LAUNCH_COMPLETED && sampled_) {
+      this->sample_extrapolate();
+    }
+    return status;
+  }
+
+  // linear indices of the workgroups a sampled launch simulates, ascending
+  std::vector<uint32_t> sample_select() const {
+    std::set<uint32_t> picked;
+    switch (sample_.mode) {
+    case SAMPLE_EVERY:
+      for (uint64_t i = sample_.offset; i < grid_size_; i += sample_.period) {
+        picked.insert(i);
+      }
+      break;
+    case SAMPLE_RANDOM: {
+      // Floyd's draw, count distinct indices without a pass over the grid
+      std::mt19937 rng(sample_.seed);
+      uint32_t count = std::min(sample_.count, grid_size_);
+      for (uint32_t j = grid_size_ - count; j < grid_size_; ++j) {
+        uint32_t i = std::uniform_int_distribution<uint32_t>(0, j)(rng);
+        picked.insert(picked.count(i) ? j : i);
+      }
+      break;
+    }
+    case SAMPLE_LIST:
+      for (uint32_t i = 0; i < std::min<uint32_t>(sample_.num_ids, SAMPLE_MAX_IDS); ++i) {
+        if (sample_.ids[i] < grid_size_) {
+          picked.insert(sample_.ids[i]);
+        } else {
+          VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM, "sampled workgroup %u is past the grid of %u",
+                 sample_.ids[i], grid_size_);
+        }
+      }
+      break;
+    default:
+      break;
+    }
+    return std::vector<uint32_t>(picked.begin(), picked.end());
+  }
+
+  // run the workgroups left out of the sample on the functional model first,
+  // workgroups of a launch are independent so the memory the sampled ones
+  // then see is the one of some valid schedule
+  int fast_forward(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+    wg_order_ = this->sample_select();
+    wg_num_totals_ = wg_order_.size();
+    if (wg_order_.empty()) {
+      VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM, "sample selects none of the %u workgroups", grid_size_);
+    }
+
+    auto time_start = std::chrono::steady_clock::now();
+    emulator_->launch(metadata, csr_knl_addr);
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < grid_size_; ++i) {
+      if (next < wg_order_.size() && wg_order_[next] == i) {
+        ++next;
+        continue;
+      }
+      int status = emulator_->run_workgroup(i);
+      if (status != VX_LAUNCH_COMPLETED) {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM, "fast-forward of workgroup %u failed (%d)", i, status);
+        return status;
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - time_start;
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "fast-forward: %u workgroups in %.3f s, %u left to the rtl",
+           grid_size_ - wg_num_totals_, elapsed.count(), wg_num_totals_);
+    return VX_LAUNCH_COMPLETED;
+  }
+
+  // scale the cycles of the sample to the grid. The estimate is a rate,
+  // cycles per completed workgroup, so its interval comes from batch means:
+  // the completions are cut in about sqrt(n) consecutive batches whose cycles
+  // per workgroup are taken as independent draws (Student t, finite
+  // population correction). The latency statistics are reported apart, the
+  // sampled workgroups overlap and their latencies do not add up to cycles.
+  void sample_extrapolate() {
+    auto &e = estimate_;
+    e.num_workgroups = grid_size_;
+    e.num_sampled = wg_latency_.size();
+    e.sampled_cycles = cycles_;
+    if (e.num_sampled == 0)
+      return;
+    double sum = 0, sum2 = 0;
+    for (auto latency : wg_latency_) {
+      sum += latency;
+      sum2 += double(latency) * latency;
+    }
+    double n = e.num_sampled;
+    e.mean_wg_cycles = sum / n;
+    double var = (n > 1) ? std::max(0.0, (sum2 - sum * e.mean_wg_cycles) / (n - 1)) : 0;
+    e.stddev_wg_cycles = std::sqrt(var);
+
+    double est = double(cycles_) * e.num_workgroups / n;
+    double half = 0; // of the interval, relative to est
+    uint32_t batches = std::min<uint32_t>(std::lround(std::sqrt(n)), 32);
+    if (batches >= 2) {
+      // two-sided 95% quantiles of Student t by degrees of freedom
+      static const double t975[] = {12.706, 4.303, 3.182, 2.776, 2.571,
+                                    2.447,  2.365, 2.306, 2.262, 2.228};
+      std::vector<double> rates(batches);
+      double rate_sum = 0;
+      for (uint32_t b = 0; b < batches; ++b) {
+        uint32_t first = uint64_t(e.num_sampled) * b / batches;
+        uint32_t last = uint64_t(e.num_sampled) * (b + 1) / batches;
+        uint64_t start = first ? wg_done_cycle_[first - 1] : 0;
+        rates[b] = double(wg_done_cycle_[last - 1] - start) / (last - first);
+        rate_sum += rates[b];
+      }
+      double rate_mean = rate_sum / batches;
+      double rate_var = 0;
+      for (auto rate : rates) {
+        rate_var += (rate - rate_mean) * (rate - rate_mean);
+      }
+      rate_var /= batches - 1;
+      uint32_t dof = batches - 1;
+      double t = (dof <= 10) ? t975[dof - 1] : 1.96 + 2.5 / dof;
+      if (rate_mean > 0) {
+        half = t * std::sqrt(rate_var / batches) / rate_mean *
+               std::sqrt(1.0 - n / e.num_workgroups);
+      }
+    }
+    e.est_cycles = est;
+    e.est_cycles_low = std::max(0.0, est * (1.0 - half));
+    e.est_cycles_high = est * (1.0 + half);
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM,
+           "sampled %u of %u workgroups: %lu cycles, estimate %lu [%lu, %lu] cycles",
+           e.num_sampled, e.num_workgroups, e.sampled_cycles, e.est_cycles,
+           e.est_cycles_low, e.est_cycles_high);
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "sampled workgroup latency: %.0f +- %.0f cycles",
+           e.mean_wg_cycles, e.stddev_wg_cycles);
   }
 
-private:
   void parse_metadata(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
     info_->dim_grid.x = metadata.knl_gl_size_x / metadata.knl_lc_size_x;
     info_->dim_grid.y = metadata.knl_gl_size_y / metadata.knl_lc_size_y;
     info_->dim_grid.z = metadata.knl_gl_size_z / metadata.knl_lc_size_z;
 
 #ifndef NDEBUG
-    INFO("metadata.knl_gl_size_x:%u", metadata.knl_gl_size_x);
-    INFO("metadata.knl_gl_size_y:%u", metadata.knl_gl_size_y);
-    INFO("metadata.knl_gl_size_z:%u", metadata.knl_gl_size_z);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_gl_size_x:%u", metadata.knl_gl_size_x);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_gl_size_y:%u", metadata.knl_gl_size_y);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_gl_size_z:%u", metadata.knl_gl_size_z);
+
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_lc_size_x:%u", metadata.knl_lc_size_x);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_lc_size_y:%u", metadata.knl_lc_size_y);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_lc_size_z:%u", metadata.knl_lc_size_z);
 
-    INFO("metadata.knl_lc_size_x:%u", metadata.knl_lc_size_x);
-    INFO("metadata.knl_lc_size_y:%u", metadata.knl_lc_size_y);
-    INFO("metadata.knl_lc_size_z:%u", metadata.knl_lc_size_z);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "metadata.knl_vgprs:%u, knl_sgprs:%u, knl_lds_size:%u",
+           metadata.knl_vgprs, metadata.knl_sgprs, metadata.knl_lds_size);
 
     uint32_t knl_entry;
     ram_->read(csr_knl_addr, &knl_entry, 4);
-    INFO("csr_knl_addr:%x, knl_entry:%x", (uint32_t)csr_knl_addr, knl_entry);
+    VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_HOST, "csr_knl_addr:%x, knl_entry:%x",
+           (uint32_t)csr_knl_addr, knl_entry);
 #endif
 
     info_->grid_idx.x = 0; // kernel_size_x
@@ -178,17 +873,18 @@ private:
     info_->num_warps = (metadata.knl_lc_size_x / WARP_SIZE) *
                        metadata.knl_lc_size_y * metadata.knl_lc_size_z;
     info_->warp_size = WARP_SIZE;
-    info_->start_pc = 0x80000000U;
+    info_->start_pc = metadata.knl_start_pc ? metadata.knl_start_pc : USER_BASE_ADDR;
 
-    info_->pds_baseaddr = 0x80005000U;
     info_->csr_knl = (uint32_t)csr_knl_addr;
-    info_->vgpr_size_total = info_->num_warps * 64;
-    info_->sgpr_size_total = info_->num_warps * 64;
-    info_->lds_size_total = 128;
+    workgroup_resources(metadata.knl_vgprs, metadata.knl_sgprs, metadata.knl_lds_size, info_);
     info_->gds_size_total = 0;
-    info_->vgpr_size_per_warp = 64;
-    info_->sgpr_size_per_warp = 64;
     info_->gds_baseaddr = 0;
+    if (info_->vgpr_size_total > NUMBER_VGPR_SLOTS || info_->sgpr_size_total > NUMBER_SGPR_SLOTS ||
+        info_->lds_size_total > NUMBER_LDS_SLOTS) {
+      VT_LOG(LOG_LEVEL_WARN, LOG_CAT_HOST,
+             "workgroup needs %u vgprs, %u sgprs and %u lds bytes, more than an SM has",
+             info_->vgpr_size_total, info_->sgpr_size_total, info_->lds_size_total);
+    }
   }
 
   void reset() {
@@ -197,6 +893,9 @@ private:
     device_->host_rsp_ready_i = 0;
     device_->out_a_ready_i = 0;
     device_->out_d_valid_i = 0;
+    for (auto mem_port : mem_ports_) {
+      mem_port->reset();
+    }
 
     for (int i = 0; i < RESET_DELAY; ++i) {
       device_->clk = 0;
@@ -206,102 +905,237 @@ private:
     }
   }
 
+  // size the counters by unit, SMs, warps or L2 slices, and clear them
+  void perf_reset() {
+    for (uint32_t i = 0; i < VX_PERF_COUNT; ++i) {
+      uint32_t units = NUMBER_CU;
+      switch (i) {
+      case VX_PERF_CYCLES:
+      case VX_PERF_CTAS:
+      case VX_PERF_CTA_LATENCY:
+      case VX_PERF_CTA_LATENCY_MAX:
+        units = 1;
+        break;
+      case VX_PERF_WARP_INSTRS:
+        units = NUMBER_CU * NUM_WARP;
+        break;
+      case VX_PERF_L2_HITS:
+      case VX_PERF_L2_MISSES:
+        units = NUM_L2CACHE;
+        break;
+      default:
+        break;
+      }
+      perf_[i].assign(units, 0);
+    }
+  }
+
+  // clear the dispatcher for a new launch
+  void reset_dispatch() {
+    grid_finish_ = false;
+    wg_finish_count_ = 0;
+    wg_dispatch_count_ = 0;
+    grid_size_ = info_->dim_grid.x * info_->dim_grid.y * info_->dim_grid.z;
+    wg_num_totals_ = grid_size_;
+    wg_order_.clear();
+    wg_latency_.clear();
+    wg_done_cycle_.clear();
+    sampled_ = false;
+    wg_inflight_.assign(1u << WG_ID_WIDTH, -1);
+    wg_dispatch_cycle_.assign(1u << WG_ID_WIDTH, 0);
+    wg_free_ids_.clear();
+    for (uint32_t i = 0; i < (1u << WG_ID_WIDTH); ++i) {
+      wg_free_ids_.push_back(i);
+    }
+  }
+
   void handle_host() {
-    // rsp
-    if (device_->host_rsp_valid_o && device_->host_rsp_ready_i) {
-      wg_finish_count_++;
-      active_sms_ = false;
-      INFO("wg finish count: :%u", wg_finish_count_);
+    // rsp, a workgroup completed at this edge. The done FIFO pops on every
+    // handshake while host_rsp_valid_o only pulses once the L2 flush that
+    // followed wg_done finished, so a held ready would pop entries before
+    // their response and show the next one's id. Taking one entry per
+    // response leaves the rest queued, each of them flushes again.
+    device_->host_rsp_ready_i = device_->host_rsp_valid_o;
+    if (device_->host_rsp_valid_o) {
+      uint32_t wg_id = device_->host_rsp_inflight_wg_buffer_host_wf_done_wg_id_o;
+      if (wg_inflight_.at(wg_id) < 0) {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_HOST, "completion for idle workgroup id %u", wg_id);
+      } else {
+        VT_LOG(LOG_LEVEL_INFO, LOG_CAT_HOST, "wg %d done (id %u), finish count: %u",
+               wg_inflight_[wg_id], wg_id, wg_finish_count_ + 1);
+        uint64_t latency = cycles_ - wg_dispatch_cycle_[wg_id];
+        perf_[VX_PERF_CTAS][0]++;
+        perf_[VX_PERF_CTA_LATENCY][0] += latency;
+        perf_[VX_PERF_CTA_LATENCY_MAX][0] = std::max(perf_[VX_PERF_CTA_LATENCY_MAX][0], latency);
+        if (sampled_) {
+          wg_latency_.push_back(latency);
+          wg_done_cycle_.push_back(cycles_);
+        }
+        wg_inflight_[wg_id] = -1;
+        wg_free_ids_.push_back(wg_id);
+        wg_finish_count_++;
+        last_progress_ = cycles_;
+      }
     }
 
-    uint32_t wg_num_totals =
-        info_->dim_grid.x * info_->dim_grid.y * info_->dim_grid.z;
-    if (wg_finish_count_ == wg_num_totals) {
+    if (wg_finish_count_ == wg_num_totals_) {
+      device_->host_req_valid_i = 0;
       grid_finish_ = true;
       return;
     }
 
-    // req
-    if (device_->host_req_valid_i && device_->host_req_ready_o) {
+    // req, keep the next workgroup presented while the scheduler can take
+    // more, host_req_ready_o applies backpressure for SM resources
+    uint32_t wg_inflight = wg_dispatch_count_ - wg_finish_count_;
+    bool host_dispatch_finish = wg_dispatch_count_ >= wg_num_totals_;
+    if (host_dispatch_finish || wg_free_ids_.empty() || wg_inflight >= WG_NUM_MAX) {
       device_->host_req_valid_i = 0;
-      uint32_t sm_idx = device_->host_req_wg_id_i;
-      active_sms_ = true;
-      INFO("dispatch cta: x:%u y:%u z:%u", info_->grid_idx.x, info_->grid_idx.y,
-           info_->grid_idx.z);
-
-      info_->grid_idx.x++;
-      if (info_->grid_idx.x == info_->dim_grid.x) {
-        info_->grid_idx.x = 0;
-        info_->grid_idx.y++;
-        if (info_->grid_idx.y == info_->dim_grid.y) {
-          info_->grid_idx.y = 0;
-          info_->grid_idx.z++;
-        }
-      }
       return;
     }
 
-    bool host_dispatch_finish = info_->grid_idx.z >= info_->dim_grid.z;
-    bool dispatch_valid = !active_sms_;
-    if (!host_dispatch_finish && dispatch_valid && !device_->host_req_valid_i) {
-      uint32_t sm_idx = 0;
-      device_->host_req_valid_i = 1;
-      device_->host_req_wg_id_i = sm_idx;
-      device_->host_req_num_wf_i = info_->num_warps;
-      device_->host_req_wf_size_i = info_->warp_size;
-      device_->host_req_start_pc_i = info_->start_pc;
-      device_->host_req_kernel_size_x_i = info_->grid_idx.x;
-      device_->host_req_kernel_size_y_i = info_->grid_idx.y;
-      device_->host_req_kernel_size_z_i = info_->grid_idx.z;
-      device_->host_req_pds_baseaddr_i = info_->pds_baseaddr;
-      device_->host_req_csr_knl_i = info_->csr_knl;
-      device_->host_req_vgpr_size_total_i = info_->vgpr_size_total;
-      device_->host_req_sgpr_size_total_i = info_->sgpr_size_total;
-      device_->host_req_lds_size_total_i = info_->lds_size_total;
-      device_->host_req_gds_size_total_i = info_->gds_size_total;
-      device_->host_req_vgpr_size_per_wf_i = info_->vgpr_size_per_warp;
-      device_->host_req_sgpr_size_per_wf_i = info_->sgpr_size_per_warp;
-      device_->host_req_gds_baseaddr_i = info_->gds_baseaddr;
+    // a sampled launch dispatches only its sample, in grid order
+    uint32_t wg_idx = wg_order_.empty() ? wg_dispatch_count_ : wg_order_[wg_dispatch_count_];
+    info_->grid_idx.x = wg_idx % info_->dim_grid.x;
+    info_->grid_idx.y = (wg_idx / info_->dim_grid.x) % info_->dim_grid.y;
+    info_->grid_idx.z = wg_idx / (info_->dim_grid.x * info_->dim_grid.y);
+
+    uint32_t wg_id = wg_free_ids_.front();
+    device_->host_req_valid_i = 1;
+    device_->host_req_wg_id_i = wg_id;
+    device_->host_req_num_wf_i = info_->num_warps;
+    device_->host_req_wf_size_i = info_->warp_size;
+    device_->host_req_start_pc_i = info_->start_pc;
+    device_->host_req_kernel_size_x_i = info_->grid_idx.x;
+    device_->host_req_kernel_size_y_i = info_->grid_idx.y;
+    device_->host_req_kernel_size_z_i = info_->grid_idx.z;
+    device_->host_req_pds_baseaddr_i = info_->pds_baseaddr;
+    device_->host_req_csr_knl_i = info_->csr_knl;
+    device_->host_req_vgpr_size_total_i = info_->vgpr_size_total;
+    device_->host_req_sgpr_size_total_i = info_->sgpr_size_total;
+    device_->host_req_lds_size_total_i = info_->lds_size_total;
+    device_->host_req_gds_size_total_i = info_->gds_size_total;
+    device_->host_req_vgpr_size_per_wf_i = info_->vgpr_size_per_warp;
+    device_->host_req_sgpr_size_per_wf_i = info_->sgpr_size_per_warp;
+    device_->host_req_gds_baseaddr_i = info_->gds_baseaddr;
+
+    if (!device_->host_req_ready_o)
+      return;
+
+    // accepted at this edge
+    wg_free_ids_.pop_front();
+    wg_inflight_[wg_id] = wg_idx;
+    wg_dispatch_cycle_[wg_id] = cycles_;
+    wg_dispatch_count_++;
+    if ((trace_.trigger_mask & TRACE_TRIGGER_WG) && wg_idx == trace_.trigger_wg) {
+      this->trace_trigger();
     }
+    VT_LOG(LOG_LEVEL_INFO, LOG_CAT_HOST, "dispatch cta: x:%u y:%u z:%u (id %u, %u in flight)",
+           info_->grid_idx.x, info_->grid_idx.y, info_->grid_idx.z, wg_id,
+           wg_inflight + 1);
   }
 
+  // serve every L2 slice, each has its own queues and timing. Slices are
+  // template arguments so the field offsets into the wide ports fold into
+  // constants
   void handle_memory() {
-    bool read = device_->out_a_opcode_o == 4;
-    bool write = device_->out_a_opcode_o == 0 || device_->out_a_opcode_o == 1;
-    // read
-    if (device_->out_a_valid_o && device_->out_a_ready_i && read) {
-      device_->out_d_valid_i = 1;
-      device_->out_a_ready_i = 0;
-      device_->out_d_opcode_i = 1;
-      device_->out_d_size_i = device_->out_a_size_o;
-      device_->out_d_source_i = device_->out_a_source_o;
-      ram_->read(device_->out_a_address_o, &device_->out_d_data_i, 8);
-      device_->out_d_param_i = device_->out_a_param_o;
-      INFO("memory read; addr:%x size:%d data: %lx", device_->out_a_address_o,
-           device_->out_a_size_o, device_->out_d_data_i);
-    } else if (device_->out_a_valid_o && device_->out_a_ready_i && write) {
-      device_->out_d_valid_i = 1;
-      device_->out_a_ready_i = 0;
-      device_->out_d_opcode_i = 0;
-      device_->out_d_size_i = device_->out_a_size_o;
-      device_->out_d_source_i = device_->out_a_source_o;
-      device_->out_d_param_i = device_->out_a_param_o;
-      for (uint32_t i = 0; i < 8; ++i) {
-        if (device_->out_a_mask_o & (1u << i)) {
-          uint8_t val = (device_->out_a_data_o >> (i * 8)) & 0xFF;
-          ram_->write(device_->out_a_address_o + i, &val, 1);
-        }
+    this->handle_slices(std::make_index_sequence<NUM_L2CACHE>());
+  }
+
+  template <size_t... SLICES>
+  void handle_slices(std::index_sequence<SLICES...>) {
+    (this->handle_slice<SLICES>(mem_ports_[SLICES]), ...);
+  }
+
+  template <uint32_t SLICE>
+  void handle_slice(MemPort *mem_port) {
+    mem_port->tick(cycles_);
+
+    // A channel, ready while the request queue has room
+    bool a_ready = mem_port->can_accept();
+    vl_set(device_->out_a_ready_i, SLICE, 1, a_ready);
+    if (a_ready && vl_get(device_->out_a_valid_o, SLICE, 1)) {
+      uint64_t addr = vl_get(device_->out_a_address_o, SLICE * L2_ADDRESS_BITS, L2_ADDRESS_BITS);
+      if ((trace_.trigger_mask & TRACE_TRIGGER_ADDR) &&
+          addr < (uint64_t)trace_.watch_addr + trace_.watch_size &&
+          addr + L2CACHE_BEATBYTES > trace_.watch_addr) {
+        this->trace_trigger();
+      }
+      uint8_t data[L2CACHE_BEATBYTES];
+      vl_get_bytes(device_->out_a_data_o, SLICE * L2CACHE_BEATBYTES, data, L2CACHE_BEATBYTES);
+      mem_port->accept(cycles_, addr,
+                       vl_get(device_->out_a_source_o, SLICE * L2_SOURCE_BITS, L2_SOURCE_BITS),
+                       vl_get(device_->out_a_opcode_o, SLICE * L2_OP_BITS, L2_OP_BITS),
+                       vl_get(device_->out_a_size_o, SLICE * L2_SIZE_BITS, L2_SIZE_BITS),
+                       vl_get(device_->out_a_param_o, SLICE * L2_PARAM_BITS, L2_PARAM_BITS),
+                       data,
+                       vl_get(device_->out_a_mask_o, SLICE * L2_MASK_BITS, L2_MASK_BITS));
+      last_progress_ = cycles_;
+    }
+
+    // D channel, present the head of the response FIFO
+    bool d_valid = mem_port->rsp_valid();
+    vl_set(device_->out_d_valid_i, SLICE, 1, d_valid);
+    if (d_valid) {
+      auto &rsp = mem_port->rsp_front();
+      vl_set(device_->out_d_opcode_i, SLICE * L2_OP_BITS, L2_OP_BITS, rsp.opcode);
+      vl_set(device_->out_d_size_i, SLICE * L2_SIZE_BITS, L2_SIZE_BITS, rsp.size);
+      vl_set(device_->out_d_source_i, SLICE * L2_SOURCE_BITS, L2_SOURCE_BITS, rsp.source);
+      vl_set(device_->out_d_param_i, SLICE * L2_PARAM_BITS, L2_PARAM_BITS, rsp.param);
+      vl_set_bytes(device_->out_d_data_i, SLICE * L2CACHE_BEATBYTES, rsp.data, L2CACHE_BEATBYTES);
+      if (vl_get(device_->out_d_ready_o, SLICE, 1)) {
+        mem_port->rsp_pop(cycles_);
+        last_progress_ = cycles_;
+      }
+    }
+  }
+
+  void report_hang() {
+    VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM,
+           "no progress since cycle %lu, launch hung at cycle %lu",
+           last_progress_, cycles_);
+    VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_SIM,
+           "%u of %u workgroups done, %u in flight, %u memory requests outstanding",
+           wg_finish_count_, wg_num_totals_, wg_dispatch_count_ - wg_finish_count_,
+           this->mem_outstanding());
+    for (uint32_t i = 0; i < wg_inflight_.size(); ++i) {
+      if (wg_inflight_[i] >= 0) {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_HOST, "wg %d (id %u) still running",
+               wg_inflight_[i], i);
+      }
+    }
+  }
+
+  uint32_t mem_outstanding() const {
+    uint32_t count = 0;
+    for (auto mem_port : mem_ports_) {
+      count += mem_port->outstanding();
+    }
+    return count;
+  }
+
+  // per-run memory statistics, to tell memory-bound runs from pipeline-bound
+  void report_memory() {
+    for (uint32_t i = 0; i < mem_ports_.size(); ++i) {
+      auto mem_port = mem_ports_[i];
+      auto &stats = mem_port->stats();
+      auto &timing = mem_port->timing()->stats();
+      double bandwidth = cycles_ ? (double)stats.bytes / cycles_ : 0.0;
+      double latency = stats.completed ? (double)stats.total_latency / stats.completed : 0.0;
+      VT_LOG(LOG_LEVEL_INFO, LOG_CAT_MEM,
+             "memory slice %u (%s): %lu reads, %lu writes, %.3f bytes/cycle, %.1f cycles avg latency, %u peak outstanding",
+             i, mem_port->timing()->name(), stats.reads, stats.writes, bandwidth,
+             latency, stats.peak_outstanding);
+      if (timing.row_hits + timing.row_misses + timing.row_conflicts) {
+        VT_LOG(LOG_LEVEL_INFO, LOG_CAT_MEM,
+               "memory slice %u dram: %lu row hits, %lu row misses, %lu row conflicts, %lu refreshes",
+               i, timing.row_hits, timing.row_misses, timing.row_conflicts,
+               timing.refreshes);
       }
-      INFO("memory write; addr:%x mask:%x size:%d data: %lx",
-           device_->out_a_address_o, device_->out_a_mask_o,
-           (int)std::pow(2, device_->out_a_size_o), device_->out_a_data_o);
-    } else if (device_->out_d_valid_i && device_->out_d_ready_o) {
-      device_->out_d_valid_i = 0;
-      device_->out_a_ready_i = 1;
     }
   }
 
   void tick() {
+    vt_log::set_cycle(cycles_);
     device_->clk = 0;
     this->eval();
 
@@ -309,20 +1143,69 @@ private:
     handle_host();
     handle_memory();
     this->eval();
-
-#ifndef NDEBUG
-    fflush(stdout);
-#endif
   }
 
   void eval() {
     device_->eval();
-#ifdef FST_OUTPUT
-    if (sim_trace_enabled()) {
-      tfp_->dump(timestamp);
+#if VM_TRACE
+    if (trace_active_) {
+      tfp_->dump(context_->time());
+    }
+#endif
+    context_->timeInc(1);
+  }
+
+  void trace_trigger() {
+    if (!trace_triggered_ ||
+        (trace_.trigger_cycles != 0 &&
+         cycles_ >= trace_trigger_cycle_ + trace_.trigger_cycles)) {
+      trace_triggered_ = true;
+      trace_trigger_cycle_ = cycles_;
+    }
+  }
+
+  // re-evaluate the trace window once per cycle
+  void trace_update() {
+    if (!trace_.enable)
+      return;
+    bool active = cycles_ >= trace_.start_cycle && cycles_ < trace_.stop_cycle;
+    if (trace_.trigger_mask != 0) {
+      active = active && trace_triggered_ &&
+               (trace_.trigger_cycles == 0 ||
+                cycles_ < trace_trigger_cycle_ + trace_.trigger_cycles);
+    }
+    if (active == trace_active_)
+      return;
+#if VM_TRACE
+    if (active && tfp_ == nullptr) {
+      // devices opened after the first one trace to trace.<id>.fst
+      std::string filename = trace_.filename[0] ? trace_.filename
+                             : id_ ? "trace." + std::to_string(id_) + ".fst"
+                                   : "trace.fst";
+      tfp_ = new VerilatedFstC();
+      device_->trace(tfp_, trace_.depth ? trace_.depth : 99);
+      tfp_->open(filename.c_str());
+      VT_LOG(LOG_LEVEL_INFO, LOG_CAT_SIM, "trace started at cycle %lu: %s",
+             cycles_, filename.c_str());
+    }
+    if (!active) {
+      tfp_->flush();
+    }
+    trace_active_ = active;
+#else
+    VT_LOG(LOG_LEVEL_WARN, LOG_CAT_SIM,
+           "tracing requested but the model was built without trace support");
+    trace_.enable = 0;
+#endif
+  }
+
+  void trace_stop() {
+#if VM_TRACE
+    if (trace_active_) {
+      tfp_->flush();
     }
 #endif
-    ++timestamp;
+    trace_active_ = false;
   }
 
   void wait(uint32_t cycles) {
@@ -333,7 +1216,7 @@ private:
 
 private:
   // typedef struct {
-  //   std::array<uint8_t, PLATFORM_MEMORY_DATA_SIZE> data;
+  //   std::array<uint8_t, L2CACHE_BEATBYTES> data;
   //   uint32_t addr;
   //   bool write;
   //   bool cycles;
@@ -341,29 +1224,171 @@ private:
 
   // std::list<mem_req_t*> pending_mem_reqs_;
 
+  VerilatedContext *context_;
   Vgpgpu_top_wrapper *device_;
+  uint32_t id_;
 
   PhysicalMemory *ram_;
+  std::vector<MemPort *> mem_ports_; // one per L2 slice
   bool grid_finish_;
   uint32_t wg_finish_count_;
+  uint32_t wg_dispatch_count_;
+  uint32_t wg_num_totals_; // workgroups dispatched to the RTL
+  uint32_t grid_size_;
+  std::vector<int32_t> wg_inflight_; // grid index of each busy wg id, -1 if free
+  std::deque<uint32_t> wg_free_ids_;
+  std::vector<uint64_t> wg_dispatch_cycle_;
+  std::vector<uint32_t> wg_order_;   // grid indices of a partial launch, else empty
+  bool sampled_;                     // the partial launch is a sample to extrapolate
+  std::vector<uint64_t> wg_latency_; // of each sampled workgroup completed
+  std::vector<uint64_t> wg_done_cycle_; // and the cycle it completed at
+
+  Emulator *emulator_;
+  sample_config_t sample_;
+  sample_estimate_t estimate_;
+
+  std::vector<uint64_t> perf_[VX_PERF_COUNT]; // VX_PERF_* by unit
   uint64_t cycles_;
-  bool active_sms_;
+  uint64_t max_cycles_;
+  uint64_t hang_cycles_;
+  uint64_t last_progress_; // last cycle with a commit, dispatch or memory traffic
+  std::atomic<bool> abort_;
+  const std::atomic<bool> *cancel_; // abort_ of the caller, kept across launch_reset
+
+  bool in_launch_; // a launch is simulating, or restored and to be resumed
+  uint64_t checkpoint_cycle_;
+  std::string checkpoint_file_;
 
   dispatch_info_t *info_;
 
-#ifdef FST_OUTPUT
-  VerilatedVcdC *tfp_;
+  std::vector<sm_probe_t *> probes_;
+
+  trace_config_t trace_;
+  bool trace_active_;
+  bool trace_triggered_;
+  uint64_t trace_trigger_cycle_;
+#if VM_TRACE
+  VerilatedFstC *tfp_;
 #endif
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
+void vt_probe_register() {
+  if (s_probe_owner) {
+    s_probe_owner->on_register(svGetScope());
+  }
+}
+
+void vt_probe_issue(int wid, int pc) {
+  auto probe = (sm_probe_t *)svGetUserData(svGetScope(), &s_probe_key);
+  if (probe) {
+    probe->sink->on_issue(probe->sm, wid, pc);
+  }
+}
+
+void vt_probe_commit(int x_wid, int v_wid) {
+  auto probe = (sm_probe_t *)svGetUserData(svGetScope(), &s_probe_key);
+  if (probe) {
+    probe->sink->on_commit(probe->sm, x_wid, v_wid);
+  }
+}
+
+void vt_probe_event(int events) {
+  auto probe = (sm_probe_t *)svGetUserData(svGetScope(), &s_probe_key);
+  if (probe) {
+    probe->sink->on_event(probe->sm, events);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 Processor::Processor() : impl_(new Impl()) {}
 
 Processor::~Processor() { delete impl_; }
 
 void Processor::attach_ram(PhysicalMemory *mem) { impl_->attach_ram(mem); }
 
-void Processor::run(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
-  impl_->run(metadata, csr_knl_addr);
+void Processor::trace_config(const trace_config_t &config) {
+  impl_->trace_config(config);
+}
+
+void Processor::limits(uint64_t max_cycles, uint64_t hang_cycles) {
+  impl_->limits(max_cycles, hang_cycles);
+}
+
+void Processor::private_segment(uint32_t base_addr) {
+  impl_->private_segment(base_addr);
+}
+
+int Processor::run(metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+  return impl_->run(metadata, csr_knl_addr);
+}
+
+int Processor::run(metadata_buffer_t metadata, uint64_t csr_knl_addr,
+                   const std::vector<uint32_t> &workgroups,
+                   const std::atomic<bool> *cancel) {
+  return impl_->run(metadata, csr_knl_addr, workgroups, cancel);
+}
+
+void Processor::abort() { impl_->abort(); }
+
+int Processor::resume() { return impl_->resume(); }
+
+void Processor::checkpoint_at(uint64_t cycle, const char *filename) {
+  impl_->checkpoint_at(cycle, filename);
+}
+
+int Processor::save(const char *filename) { return impl_->save(filename); }
+
+int Processor::restore(const char *filename, uint64_t *csr_knl_addr) {
+  return impl_->restore(filename, csr_knl_addr);
+}
+
+void Processor::sample_config(const sample_config_t &config) {
+  impl_->sample_config(config);
+}
+
+int Processor::sample_estimate(sample_estimate_t *estimate) const {
+  return impl_->sample_estimate(estimate);
+}
+
+int Processor::perf_query(uint32_t counter, uint32_t index,
+                          uint64_t *value) const {
+  return impl_->perf_query(counter, index, value);
+}
+
+int Processor::occupancy(dim3 block, const kernel_resource_t* resources,
+                         occupancy_t* occupancy) {
+  if (0 == block.x || 0 != (block.x % WARP_SIZE) || 0 == block.y || 0 == block.z)
+    return -1;
+  dispatch_info_t info;
+  info.num_warps = (block.x / WARP_SIZE) * block.y * block.z;
+  workgroup_resources(resources ? resources->vgpr_usage : 0, resources ? resources->sgpr_usage : 0,
+                      resources ? resources->lds_usage : 0, &info);
+
+  // the scarcest resource decides, the first listed wins a tie
+  struct {
+    uint32_t limiter;
+    uint32_t wgs;
+  } limits[] = {
+    {OCCUPANCY_LIMIT_WARPS, NUM_WARP / info.num_warps},
+    {OCCUPANCY_LIMIT_WGS, NUMBER_WF_SLOTS},
+    {OCCUPANCY_LIMIT_VGPRS, NUMBER_VGPR_SLOTS / info.vgpr_size_total},
+    {OCCUPANCY_LIMIT_SGPRS, NUMBER_SGPR_SLOTS / info.sgpr_size_total},
+    {OCCUPANCY_LIMIT_LDS, NUMBER_LDS_SLOTS / info.lds_size_total},
+  };
+  occupancy->wgs_per_sm = UINT32_MAX;
+  for (auto& limit : limits) {
+    if (limit.wgs < occupancy->wgs_per_sm) {
+      occupancy->wgs_per_sm = limit.wgs;
+      occupancy->limiter = limit.limiter;
+    }
+  }
+  occupancy->warp_size = WARP_SIZE;
+  occupancy->warps_per_wg = info.num_warps;
+  occupancy->warps_per_sm = occupancy->wgs_per_sm * info.num_warps;
+  occupancy->max_warps_per_sm = NUM_WARP;
+  occupancy->num_sms = NUMBER_CU;
+  return 0;
 }
@@ -14,7 +14,9 @@
 #ifndef PROCESSOR_H
 #define PROCESSOR_H
 
+#include <atomic>
 #include <stdint.h>
+#include <vector>
 
 #include "memory.h"
 #include "common.h"
@@ -26,7 +28,55 @@ public:
 
   void attach_ram(PhysicalMemory* ram);
 
-  void run(metadata_buffer_t metadata, uint64_t csr_knl_addr);
+  void trace_config(const trace_config_t& config);
+
+  // cycle budget and hang watchdog for the next launches, 0 disables either
+  void limits(uint64_t max_cycles, uint64_t hang_cycles);
+
+  // base of the private segment handed to the workgroups (pds_baseaddr)
+  void private_segment(uint32_t base_addr);
+
+  // returns the launch status, VX_LAUNCH_*
+  int run(metadata_buffer_t metadata, uint64_t csr_knl_addr);
+
+  // launch only the listed workgroups (linear grid indices, ascending) and
+  // leave the others out, without sampling; the launch is aborted once
+  // cancel is set, including before it started
+  int run(metadata_buffer_t metadata, uint64_t csr_knl_addr,
+          const std::vector<uint32_t>& workgroups,
+          const std::atomic<bool>* cancel = nullptr);
+
+  // stop a running launch from another thread
+  void abort();
+
+  // checkpoint of the memory and, within a launch, of the model and the
+  // dispatcher; a launch in flight can only be saved by the savable build
+  int save(const char* filename);
+
+  // returns 1 when the checkpoint was taken within a launch, resume() then
+  // continues it and csr_knl_addr receives its metadata address, 0 at a
+  // launch boundary
+  int restore(const char* filename, uint64_t* csr_knl_addr);
+
+  // save to filename once the next launch reaches cycle, 0 disarms
+  void checkpoint_at(uint64_t cycle, const char* filename);
+
+  // continue a restored launch, returns its status, VX_LAUNCH_*
+  int resume();
+
+  // sampling of the next launches, SAMPLE_OFF simulates every workgroup
+  void sample_config(const sample_config_t& config);
+
+  // extrapolation of the last launch, -1 unless it was sampled
+  int sample_estimate(sample_estimate_t* estimate) const;
+
+  // counter VX_PERF_* of the last launch, index selects the unit
+  int perf_query(uint32_t counter, uint32_t index, uint64_t* value) const;
+
+  // workgroups of block threads resident on an SM at once, resources is
+  // nullptr for a kernel that reports none
+  static int occupancy(dim3 block, const kernel_resource_t* resources,
+                       occupancy_t* occupancy);
 
 private:
   class Impl;
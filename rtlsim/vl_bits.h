@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <verilated.h>
+
+// Bit-field access to Verilator ports of any width.
+// Scalar ports (CData .. QData) and VlWide words are both stored little
+// endian, so a packed vector is addressed as a byte array. Fields of a
+// NUM_L2CACHE-wide port sit at slice * field_width.
+
+template <typename T> inline uint8_t *vl_bytes(T &port) {
+  return reinterpret_cast<uint8_t *>(&port);
+}
+
+template <typename T> inline const uint8_t *vl_bytes(const T &port) {
+  return reinterpret_cast<const uint8_t *>(&port);
+}
+
+template <std::size_t N> inline uint8_t *vl_bytes(VlWide<N> &port) {
+  return reinterpret_cast<uint8_t *>(port.data());
+}
+
+template <std::size_t N> inline const uint8_t *vl_bytes(const VlWide<N> &port) {
+  return reinterpret_cast<const uint8_t *>(port.data());
+}
+
+// read a field of up to 64 bits starting at bit lsb
+template <typename T>
+inline uint64_t vl_get(const T &port, uint32_t lsb, uint32_t width) {
+  const uint8_t *bytes = vl_bytes(port);
+  uint32_t first = lsb / 8;
+  uint32_t shift = lsb % 8;
+  uint32_t nbytes = (shift + width + 7) / 8;
+  uint64_t value = 0;
+  for (uint32_t i = 0; i < nbytes && i < 8; ++i) {
+    value |= uint64_t(bytes[first + i]) << (i * 8);
+  }
+  value >>= shift;
+  if (nbytes > 8) {
+    value |= uint64_t(bytes[first + 8]) << (64 - shift);
+  }
+  return (width < 64) ? (value & ((1ull << width) - 1)) : value;
+}
+
+// write a field of up to 64 bits starting at bit lsb
+template <typename T>
+inline void vl_set(T &port, uint32_t lsb, uint32_t width, uint64_t value) {
+  uint8_t *bytes = vl_bytes(port);
+  for (uint32_t bit = 0; bit < width;) {
+    uint32_t pos = lsb + bit;
+    uint32_t shift = pos % 8;
+    uint32_t count = std::min<uint32_t>(8 - shift, width - bit);
+    uint8_t mask = uint8_t(((1u << count) - 1) << shift);
+    uint8_t field = uint8_t(((value >> bit) << shift) & mask);
+    bytes[pos / 8] = (bytes[pos / 8] & ~mask) | field;
+    bit += count;
+  }
+}
+
+// byte-aligned field copies, for data lanes
+template <typename T>
+inline void vl_get_bytes(const T &port, uint32_t offset, void *dst, uint32_t size) {
+  memcpy(dst, vl_bytes(port) + offset, size);
+}
+
+template <typename T>
+inline void vl_set_bytes(T &port, uint32_t offset, const void *src, uint32_t size) {
+  memcpy(vl_bytes(port) + offset, src, size);
+}
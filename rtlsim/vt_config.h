@@ -1,10 +1,28 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "vt_hw_config.h"
+
 #define CACHE_BLOCK_SIZE  64
 #define RAM_PAGE_SIZE     4096
 #define USER_BASE_ADDR    0x80000000
 #define ALLOC_BASE_ADDR   USER_BASE_ADDR
 #define GLOBAL_MEM_SIZE    0x100000000UL  // 4 GB
 
+// private memory segment handed to every workgroup (pds_baseaddr), at the
+// top of global memory so the allocations from ALLOC_BASE_ADDR, the kernel
+// image first, stay contiguous; reserved when the device is opened
+#define PDS_MEM_SIZE      0x100000       // 1 MB
+#define PDS_BASE_ADDR     (GLOBAL_MEM_SIZE - PDS_MEM_SIZE)
+
+// TileLink field widths of the L2 memory ports of gpgpu_top_wrapper.v, every
+// one of the hw::NUM_L2CACHE slices has its own
+#define L2_OP_BITS         hw::OP_BITS
+#define L2_PARAM_BITS      3
+#define L2_SIZE_BITS       hw::SIZE_BITS
+#define L2_SOURCE_BITS     hw::SOURCE_BITS
+#define L2_ADDRESS_BITS    hw::ADDRESS_BITS
+#define L2_DATA_BITS       hw::DATA_BITS
+#define L2_MASK_BITS       hw::MASK_BITS
+
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+`timescale 1ns/10ps
+
+`include "define.v"
+
+// Simulation-only probes. They are bound into the RTL so that the C++ model
+// can observe internal events through DPI without touching the design sources.
+// Cache and shared memory probes report one event mask per cycle, the bits
+// match the PERF_EVT_* values of processor.cpp.
+
+`define PERF_EVT_ICACHE_HIT   0
+`define PERF_EVT_ICACHE_MISS  1
+`define PERF_EVT_DCACHE_HIT   2
+`define PERF_EVT_DCACHE_MISS  3
+`define PERF_EVT_DCACHE_MSHR  4
+`define PERF_EVT_SMEM_ACCESS  5
+`define PERF_EVT_L2_HIT       6
+`define PERF_EVT_L2_MISS      7
+
+module vt_pipe_probe (
+  input                   clk,
+  input                   rst_n,
+
+  input                   issue_fire_i,
+  input [`DEPTH_WARP-1:0] issue_wid_i,
+  input [   `INSTLEN-1:0] issue_pc_i,
+
+  input                   wb_x_fire_i,
+  input [`DEPTH_WARP-1:0] wb_x_wid_i,
+  input                   wb_v_fire_i,
+  input [`DEPTH_WARP-1:0] wb_v_wid_i
+);
+  import "DPI-C" context function void vt_probe_register();
+  import "DPI-C" context function void vt_probe_issue(input int wid, input int pc);
+  import "DPI-C" context function void vt_probe_commit(input int x_wid, input int v_wid);
+
+  initial vt_probe_register();
+
+  always @(posedge clk) begin
+    if (rst_n && issue_fire_i) begin
+      vt_probe_issue(int'(issue_wid_i), int'(issue_pc_i));
+    end
+    if (rst_n && (wb_x_fire_i || wb_v_fire_i)) begin
+      vt_probe_commit(wb_x_fire_i ? int'(wb_x_wid_i) : -1,
+                      wb_v_fire_i ? int'(wb_v_wid_i) : -1);
+    end
+  end
+
+endmodule
+
+bind pipe vt_pipe_probe u_vt_probe (
+  .clk          (clk                                    ),
+  .rst_n        (rst_n                                  ),
+  .issue_fire_i (ibuffer2issue_out_fire                 ),
+  .issue_wid_i  (ibuffer2issue_warps_control_Signals_wid),
+  .issue_pc_i   (ibuffer2issue_warps_control_Signals_pc ),
+  .wb_x_fire_i  (wb_out_x_fire                          ),
+  .wb_x_wid_i   (wb_out_x_warp_id                       ),
+  .wb_v_fire_i  (wb_out_v_fire                          ),
+  .wb_v_wid_i   (wb_out_v_warp_id                       )
+);
+
+// reports a non-empty event mask once per cycle
+module vt_event_probe (
+  input       clk,
+  input       rst_n,
+  input [7:0] events_i
+);
+  import "DPI-C" context function void vt_probe_register();
+  import "DPI-C" context function void vt_probe_event(input int events);
+
+  initial vt_probe_register();
+
+  always @(posedge clk) begin
+    if (rst_n && (events_i != 8'b0)) begin
+      vt_probe_event(int'(events_i));
+    end
+  end
+
+endmodule
+
+bind instruction_cache vt_event_probe u_vt_probe (
+  .clk      (clk  ),
+  .rst_n    (rst_n),
+  .events_i ((8'(core_req_fire_st1 && tagAccess_hit_st1) << `PERF_EVT_ICACHE_HIT)
+           | (8'(cacheMiss_st1) << `PERF_EVT_ICACHE_MISS))
+);
+
+bind l1_dcache vt_event_probe u_vt_probe (
+  .clk      (clk  ),
+  .rst_n    (rst_n),
+  .events_i ((8'(read_hit_st1 || write_hit_st1) << `PERF_EVT_DCACHE_HIT)
+           | (8'(read_miss_st1 || write_miss_st1) << `PERF_EVT_DCACHE_MISS)
+           | (8'(mshr_missreq_valid && !mshr_missreq_ready) << `PERF_EVT_DCACHE_MSHR))
+);
+
+bind shared_mem vt_event_probe u_vt_probe (
+  .clk      (clk  ),
+  .rst_n    (rst_n),
+  .events_i ((8'(core_req_valid_i && core_req_ready_o) << `PERF_EVT_SMEM_ACCESS))
+);
+
+bind Scheduler vt_event_probe u_vt_probe (
+  .clk      (clk  ),
+  .rst_n    (rst_n),
+  .events_i ((8'(dir_result_valid_o && dir_result_ready_i && dir_result_hit_o) << `PERF_EVT_L2_HIT)
+           | (8'(dir_result_valid_o && dir_result_ready_i && !dir_result_hit_o) << `PERF_EVT_L2_MISS))
+);
@@ -24,7 +24,10 @@ int vx_dev_init(callbacks_t* callbacks) {
     auto device = new vt_device();
     if (device == nullptr)
       return -1;
-    device->init();
+    CHECK_ERR(device->init(), {
+      delete device;
+      return err;
+      });
     DBGPRINT("DEV_OPEN: hdevice=%p\n", (void*)device);
     *hdevice = device;
     return 0;
@@ -67,6 +70,31 @@ int vx_dev_init(callbacks_t* callbacks) {
     return 0;
     };
 
+  callbacks->mem_alloc_aligned = [](vx_device_h hdevice, uint64_t size, uint64_t alignment, uint64_t* addr)->int {
+    if (nullptr == hdevice
+      || nullptr == addr
+      || 0 == size
+      || 0 != (alignment & (alignment - 1)))
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    uint64_t dev_addr;
+    CHECK_ERR(device->mem_alloc(&dev_addr, size, alignment), {
+      return err;
+      });
+    DBGPRINT("MEM_ALLOC_ALIGNED: hdevice=%p, size=%ld, alignment=%ld, addr=%lx\n", hdevice, size, alignment, dev_addr);
+    *addr = dev_addr;
+    return 0;
+    };
+
+  callbacks->mem_reserve = [](vx_device_h hdevice, uint64_t addr, uint64_t size) {
+    if (nullptr == hdevice
+      || 0 == size)
+      return -1;
+    DBGPRINT("MEM_RESERVE: hdevice=%p, addr=%lx, size=%ld\n", hdevice, addr, size);
+    auto device = ((vt_device*)hdevice);
+    return device->mem_reserve(addr, size);
+    };
+
   callbacks->mem_free = [](vx_device_h hdevice, uint64_t addr) {
     if (0 == addr)
       return 0;
@@ -77,20 +105,35 @@ int vx_dev_init(callbacks_t* callbacks) {
     };
 
   callbacks->mem_info = [](vx_device_h hdevice, uint64_t* mem_free, uint64_t* mem_used) {
-    // if (nullptr == hdevice)
-    //   return -1;
-    // auto device = ((vt_device*)hdevice);
-    // uint64_t _mem_free, _mem_used;
-    // CHECK_ERR(device->mem_info(&_mem_free, &_mem_used), {
-    //   return err;
-    //   });
-    // DBGPRINT("MEM_INFO: hdevice=%p, mem_free=%ld, mem_used=%ld\n", hdevice, _mem_free, _mem_used);
-    // if (mem_free) {
-    //   *mem_free = _mem_free;
-    // }
-    // if (mem_used) {
-    //   *mem_used = _mem_used;
-    // }
+    if (nullptr == hdevice)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    uint64_t _mem_free, _mem_used;
+    CHECK_ERR(device->mem_info(&_mem_free, &_mem_used), {
+      return err;
+      });
+    DBGPRINT("MEM_INFO: hdevice=%p, mem_free=%ld, mem_used=%ld\n", hdevice, _mem_free, _mem_used);
+    if (mem_free) {
+      *mem_free = _mem_free;
+    }
+    if (mem_used) {
+      *mem_used = _mem_used;
+    }
+    return 0;
+    };
+
+  callbacks->mem_map = [](vx_device_h hdevice, uint64_t dev_addr, uint64_t size, void** host_ptr) {
+    if (nullptr == hdevice
+      || nullptr == host_ptr
+      || 0 == size)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    void* _host_ptr;
+    CHECK_ERR(device->mem_map(dev_addr, size, &_host_ptr), {
+      return err;
+      });
+    DBGPRINT("MEM_MAP: hdevice=%p, addr=%lx, size=%ld, host_ptr=%p\n", hdevice, dev_addr, size, _host_ptr);
+    *host_ptr = _host_ptr;
     return 0;
     };
 
@@ -110,12 +153,57 @@ int vx_dev_init(callbacks_t* callbacks) {
     return device->download(host_ptr, addr, size);
     };
 
-  callbacks->start = [](vx_device_h hdevice, metadata_buffer_t metadata, uint64_t csr_knl_addr) {
+  callbacks->copy_to_dev_batch = [](vx_device_h hdevice, const copy_desc_t* descs, uint32_t count) {
+    if (nullptr == hdevice
+      || (count && nullptr == descs))
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    DBGPRINT("COPY_TO_DEV_BATCH: count=%u\n", count);
+    return device->upload_batch(descs, count);
+    };
+
+  callbacks->copy_from_dev_batch = [](vx_device_h hdevice, const copy_desc_t* descs, uint32_t count) {
+    if (nullptr == hdevice
+      || (count && nullptr == descs))
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    DBGPRINT("COPY_FROM_DEV_BATCH: count=%u\n", count);
+    return device->download_batch(descs, count);
+    };
+
+  callbacks->mem_fill = [](vx_device_h hdevice, uint64_t addr, const void* pattern, uint32_t pattern_size, uint64_t size) {
+    if (nullptr == hdevice
+      || nullptr == pattern)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    DBGPRINT("MEM_FILL: addr=%lx, pattern_size=%u, size=%ld\n", addr, pattern_size, size);
+    return device->fill(addr, pattern, pattern_size, size);
+    };
+
+  callbacks->trace = [](vx_device_h hdevice, const trace_config_t* config) {
+    if (nullptr == hdevice
+      || nullptr == config)
+      return -1;
+    DBGPRINT("TRACE: hdevice=%p, enable=%d, trigger_mask=%x\n", hdevice, config->enable, config->trigger_mask);
+    auto device = ((vt_device*)hdevice);
+    return device->trace_config(*config);
+    };
+
+  callbacks->limits = [](vx_device_h hdevice, uint64_t max_cycles, uint64_t hang_cycles) {
+    if (nullptr == hdevice)
+      return -1;
+    DBGPRINT("LIMITS: hdevice=%p, max_cycles=%ld, hang_cycles=%ld\n", hdevice, max_cycles, hang_cycles);
+    auto device = ((vt_device*)hdevice);
+    return device->limits(max_cycles, hang_cycles);
+    };
+
+  callbacks->start = [](vx_device_h hdevice, metadata_buffer_t metadata, uint64_t csr_knl_addr,
+                        std::shared_future<int>* launch) {
     if (nullptr == hdevice)
       return -1;
     DBGPRINT("START: hdevice=%p, knl_entry=%x, knl_args=%x\n", hdevice, metadata.knl_entry, metadata.knl_arg_base);
     auto device = ((vt_device*)hdevice);
-    return device->start(metadata, csr_knl_addr);
+    return device->start(metadata, csr_knl_addr, launch);
     };
 
   callbacks->ready_wait = [](vx_device_h hdevice, uint64_t timeout) {
@@ -126,5 +214,89 @@ int vx_dev_init(callbacks_t* callbacks) {
     return device->ready_wait(timeout);
     };
 
+  callbacks->launch_callback = [](vx_device_h hdevice, vx_launch_callback_t callback, void* arg) {
+    if (nullptr == hdevice)
+      return -1;
+    DBGPRINT("LAUNCH_CALLBACK: hdevice=%p, callback=%p\n", hdevice, (void*)callback);
+    auto device = ((vt_device*)hdevice);
+    return device->launch_callback(callback, arg);
+    };
+
+  callbacks->launch_status = [](vx_device_h hdevice, int* status) {
+    if (nullptr == hdevice
+      || nullptr == status)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    return device->launch_status(status);
+    };
+
+  callbacks->perf_query = [](vx_device_h hdevice, uint32_t counter, uint32_t index, uint64_t* value) {
+    if (nullptr == hdevice
+      || nullptr == value)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    return device->perf_query(counter, index, value);
+    };
+
+  callbacks->checkpoint = [](vx_device_h hdevice, const char* filename) {
+    if (nullptr == hdevice
+      || nullptr == filename)
+      return -1;
+    DBGPRINT("CHECKPOINT: hdevice=%p, filename=%s\n", hdevice, filename);
+    auto device = ((vt_device*)hdevice);
+    return device->checkpoint(filename);
+    };
+
+  callbacks->checkpoint_at = [](vx_device_h hdevice, uint64_t cycle, const char* filename) {
+    if (nullptr == hdevice
+      || (cycle != 0 && nullptr == filename))
+      return -1;
+    DBGPRINT("CHECKPOINT_AT: hdevice=%p, cycle=%ld, filename=%s\n", hdevice, cycle, filename ? filename : "");
+    auto device = ((vt_device*)hdevice);
+    return device->checkpoint_at(cycle, filename);
+    };
+
+  callbacks->restore = [](vx_device_h hdevice, const char* filename) {
+    if (nullptr == hdevice
+      || nullptr == filename)
+      return -1;
+    DBGPRINT("RESTORE: hdevice=%p, filename=%s\n", hdevice, filename);
+    auto device = ((vt_device*)hdevice);
+    return device->restore(filename);
+    };
+
+  callbacks->sample = [](vx_device_h hdevice, const sample_config_t* config) {
+    if (nullptr == hdevice
+      || nullptr == config)
+      return -1;
+    DBGPRINT("SAMPLE: hdevice=%p, mode=%u\n", hdevice, config->mode);
+    auto device = ((vt_device*)hdevice);
+    return device->sample(*config);
+    };
+
+  callbacks->sample_estimate = [](vx_device_h hdevice, sample_estimate_t* estimate) {
+    if (nullptr == hdevice
+      || nullptr == estimate)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    return device->sample_estimate(estimate);
+    };
+
+  callbacks->parallel = [](vx_device_h hdevice, uint32_t num_models) {
+    if (nullptr == hdevice)
+      return -1;
+    DBGPRINT("PARALLEL: hdevice=%p, num_models=%u\n", hdevice, num_models);
+    auto device = ((vt_device*)hdevice);
+    return device->parallel(num_models);
+    };
+
+  callbacks->occupancy = [](vx_device_h hdevice, dim3 block, const kernel_resource_t* resources, occupancy_t* occupancy) {
+    if (nullptr == hdevice
+      || nullptr == occupancy)
+      return -1;
+    auto device = ((vt_device*)hdevice);
+    return device->occupancy(block, resources, occupancy);
+    };
+
   return 0;
 }
@@ -17,22 +17,20 @@
 #include <iostream>
 #include <cassert>
 #include <fstream>
+#include <future>
 #include <vector>
 
 #include <ventus_runtime.h>
+#include <logger.h>
 
-#ifndef NDEBUG
-#define DBGPRINT(format, ...) do { printf("[VXDRV] " format "", ##__VA_ARGS__); } while (0)
-#else
-#define DBGPRINT(format, ...) ((void)0)
-#endif
+#define DBGPRINT(format, ...) VT_LOG(LOG_LEVEL_DEBUG, LOG_CAT_RT, "[VXDRV] " format, ##__VA_ARGS__)
 
 #define CHECK_ERR(_expr, _cleanup) \
   do { \
     auto err = _expr; \
     if (err == 0) \
       break; \
-    printf("[VXDRV] Error: '%s' returned %d!\n", #_expr, (int)err); \
+    VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_RT, "[VXDRV] Error: '%s' returned %d!", #_expr, (int)err); \
     _cleanup \
   } while (false)
 
@@ -63,24 +61,80 @@ typedef struct {
   // allocate device memory and return address
   int (*mem_alloc) (vx_device_h hdevice, uint64_t size, uint64_t* addr);
 
+  // allocate device memory with a power of two alignment
+  int (*mem_alloc_aligned) (vx_device_h hdevice, uint64_t size, uint64_t alignment, uint64_t* addr);
+
+  // allocate device memory at a fixed address
+  int (*mem_reserve) (vx_device_h hdevice, uint64_t addr, uint64_t size);
+
   // release device memory
   int (*mem_free) (vx_device_h hdevice, uint64_t addr);
 
   // get device memory info
   int (*mem_info) (vx_device_h hdevice, uint64_t* mem_free, uint64_t* mem_used);
 
+  // map device memory into the host address space
+  int (*mem_map) (vx_device_h hdevice, uint64_t dev_addr, uint64_t size, void** host_ptr);
+
   // Copy bytes from host to device memory
   int (*copy_to_dev) (vx_device_h hdevice, uint64_t addr, const void* host_ptr, uint64_t size);
 
   // Copy bytes from device memory to host
   int (*copy_from_dev) (vx_device_h hdevice, void* host_ptr, uint64_t addr, uint64_t size);
 
-  // Start device execution
-  int (*start) (vx_device_h hdevice, metadata_buffer_t metadata, uint64_t csr_knl_addr);
+  // Copy many ranges from host to device memory
+  int (*copy_to_dev_batch) (vx_device_h hdevice, const copy_desc_t* descs, uint32_t count);
+
+  // Copy many ranges from device memory to host
+  int (*copy_from_dev_batch) (vx_device_h hdevice, const copy_desc_t* descs, uint32_t count);
+
+  // repeat a pattern over device memory
+  int (*mem_fill) (vx_device_h hdevice, uint64_t addr, const void* pattern, uint32_t pattern_size, uint64_t size);
+
+  // configure waveform tracing for the next launches
+  int (*trace) (vx_device_h hdevice, const trace_config_t* config);
+
+  // set the cycle budget and hang watchdog of the next launches
+  int (*limits) (vx_device_h hdevice, uint64_t max_cycles, uint64_t hang_cycles);
+
+  // Start device execution, the device releases the metadata block once
+  // the launch is collected; launch, when not null, receives the status of
+  // this launch once it ends
+  int (*start) (vx_device_h hdevice, metadata_buffer_t metadata, uint64_t csr_knl_addr, std::shared_future<int>* launch);
 
   // Wait for device ready with milliseconds timeout
   int (*ready_wait) (vx_device_h hdevice, uint64_t timeout);
 
+  // completion callback of the next launch
+  int (*launch_callback) (vx_device_h hdevice, vx_launch_callback_t callback, void* arg);
+
+  // status of the last launch
+  int (*launch_status) (vx_device_h hdevice, int* status);
+
+  // performance counter of the last launch
+  int (*perf_query) (vx_device_h hdevice, uint32_t counter, uint32_t index, uint64_t* value);
+
+  // save the device state between launches
+  int (*checkpoint) (vx_device_h hdevice, const char* filename);
+
+  // save the device state once the next launch reaches cycle
+  int (*checkpoint_at) (vx_device_h hdevice, uint64_t cycle, const char* filename);
+
+  // load a checkpoint, resuming the launch it was taken in if any
+  int (*restore) (vx_device_h hdevice, const char* filename);
+
+  // workgroups of the next launches simulated on the RTL
+  int (*sample) (vx_device_h hdevice, const sample_config_t* config);
+
+  // whole-grid estimate of the last sampled launch
+  int (*sample_estimate) (vx_device_h hdevice, sample_estimate_t* estimate);
+
+  // RTL models the workgroups of the next launches are split over
+  int (*parallel) (vx_device_h hdevice, uint32_t num_models);
+
+  // workgroups of a block resident on an SM at once
+  int (*occupancy) (vx_device_h hdevice, dim3 block, const kernel_resource_t* resources, occupancy_t* occupancy);
+
 } callbacks_t;
 
 int vx_dev_init(callbacks_t* callbacks);
@@ -89,4 +143,9 @@ int vx_dev_init(callbacks_t* callbacks);
 }
 #endif
 
+// vx_start that hands back the completion of its own launch, the command
+// queues wait on it rather than on whichever launch the device runs last
+int vt_start_launch(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base,
+                    std::shared_future<int>* launch);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,272 @@
+// Copyright © 2019-2023
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define LOG_CAT_DEFAULT LOG_CAT_RT
+
+#include "callbacks.h"
+#include "ventus_runtime.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+
+class vt_event {
+public:
+  vt_event() : status_(VX_EVENT_QUEUED), refs_(1) {}
+
+  void retain() { ++refs_; }
+
+  void release() {
+    if (0 == --refs_)
+      delete this;
+  }
+
+  void set_status(int status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+    cv_.notify_all();
+  }
+
+  int status() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+  }
+
+  // returns the final status, VX_EVENT_COMPLETE or VX_EVENT_ERROR
+  int wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] {
+      return status_ == VX_EVENT_COMPLETE || status_ == VX_EVENT_ERROR;
+    });
+    return status_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int status_;
+  std::atomic<uint32_t> refs_;
+};
+
+// In-order command queue, a worker thread runs the commands of one queue one
+// after the other while the host keeps enqueueing. Commands of different
+// queues run concurrently, launches on one device still take turns.
+class vt_queue {
+public:
+  vt_queue(vx_device_h hdevice) : hdevice_(hdevice), stop_(false), busy_(false) {
+    worker_ = std::thread(&vt_queue::run, this);
+  }
+
+  ~vt_queue() {
+    this->finish();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      cv_.notify_all();
+    }
+    worker_.join();
+  }
+
+  int enqueue(std::function<int()> &&func, uint32_t num_events,
+              const vx_event_h *wait_list, vx_event_h *event) {
+    for (uint32_t i = 0; i < num_events; ++i) {
+      if (nullptr == wait_list || nullptr == wait_list[i])
+        return -1;
+    }
+    command_t command;
+    command.func = std::move(func);
+    for (uint32_t i = 0; i < num_events; ++i) {
+      auto wait_event = (vt_event *)wait_list[i];
+      wait_event->retain();
+      command.wait_list.push_back(wait_event);
+    }
+    command.event = new vt_event();
+    if (event) {
+      command.event->retain();
+      *event = command.event;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_.push_back(std::move(command));
+    cv_.notify_all();
+    return 0;
+  }
+
+  vx_device_h device() const { return hdevice_; }
+
+  // wait for every command enqueued so far
+  void finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return commands_.empty() && !busy_; });
+  }
+
+private:
+  struct command_t {
+    std::function<int()> func;
+    std::vector<vt_event *> wait_list;
+    vt_event *event;
+  };
+
+  void run() {
+    for (;;) {
+      command_t command;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || !commands_.empty(); });
+        if (commands_.empty())
+          return;
+        command = std::move(commands_.front());
+        commands_.pop_front();
+        busy_ = true;
+      }
+
+      // a failed dependency fails the command without running it
+      bool ready = true;
+      for (auto wait_event : command.wait_list) {
+        ready = (wait_event->wait() == VX_EVENT_COMPLETE) && ready;
+        wait_event->release();
+      }
+      int status = VX_EVENT_ERROR;
+      if (ready) {
+        command.event->set_status(VX_EVENT_RUNNING);
+        int ret = command.func();
+        if (ret != 0) {
+          VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_RT, "[VXDRV] queue %p: command returned %d", (void *)this, ret);
+        } else {
+          status = VX_EVENT_COMPLETE;
+        }
+      } else {
+        VT_LOG(LOG_LEVEL_ERROR, LOG_CAT_RT, "[VXDRV] queue %p: command skipped, a dependency failed", (void *)this);
+      }
+      command.event->set_status(status);
+      command.event->release();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      busy_ = false;
+      done_cv_.notify_all();
+    }
+  }
+
+  vx_device_h hdevice_;
+  std::deque<command_t> commands_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  bool stop_;
+  bool busy_;
+  std::thread worker_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+int vx_queue_create(vx_device_h hdevice, vx_queue_h* hqueue) {
+  if (nullptr == hdevice || nullptr == hqueue)
+    return -1;
+  auto queue = new vt_queue(hdevice);
+  DBGPRINT("QUEUE_CREATE: hdevice=%p, hqueue=%p\n", hdevice, (void*)queue);
+  *hqueue = queue;
+  return 0;
+}
+
+int vx_queue_destroy(vx_queue_h hqueue) {
+  if (nullptr == hqueue)
+    return -1;
+  DBGPRINT("QUEUE_DESTROY: hqueue=%p\n", hqueue);
+  delete (vt_queue*)hqueue;
+  return 0;
+}
+
+int vx_queue_finish(vx_queue_h hqueue) {
+  if (nullptr == hqueue)
+    return -1;
+  ((vt_queue*)hqueue)->finish();
+  return 0;
+}
+
+int vx_enqueue_copy_to_dev(vx_queue_h hqueue, uint64_t addr, const void* host_ptr, uint64_t size,
+                           uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event) {
+  if (nullptr == hqueue || nullptr == host_ptr)
+    return -1;
+  auto queue = (vt_queue*)hqueue;
+  auto hdevice = queue->device();
+  return queue->enqueue([=] {
+    return vx_copy_to_dev(hdevice, addr, host_ptr, size);
+  }, num_events, wait_list, event);
+}
+
+int vx_enqueue_copy_from_dev(vx_queue_h hqueue, void* host_ptr, uint64_t addr, uint64_t size,
+                             uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event) {
+  if (nullptr == hqueue || nullptr == host_ptr)
+    return -1;
+  auto queue = (vt_queue*)hqueue;
+  auto hdevice = queue->device();
+  return queue->enqueue([=] {
+    return vx_copy_from_dev(hdevice, host_ptr, addr, size);
+  }, num_events, wait_list, event);
+}
+
+int vx_enqueue_fill(vx_queue_h hqueue, uint64_t addr, const void* pattern, uint32_t pattern_size, uint64_t size,
+                    uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event) {
+  if (nullptr == hqueue || nullptr == pattern || 0 == pattern_size
+   || 0 != (size % pattern_size))
+    return -1;
+  auto queue = (vt_queue*)hqueue;
+  auto hdevice = queue->device();
+  // the pattern is captured now, the caller's copy may go away
+  std::vector<uint8_t> bytes((const uint8_t*)pattern, (const uint8_t*)pattern + pattern_size);
+  return queue->enqueue([=] {
+    return vx_mem_fill(hdevice, addr, bytes.data(), pattern_size, size);
+  }, num_events, wait_list, event);
+}
+
+int vx_enqueue_launch(vx_queue_h hqueue, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base,
+                      uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event) {
+  if (nullptr == hqueue)
+    return -1;
+  auto queue = (vt_queue*)hqueue;
+  auto hdevice = queue->device();
+  return queue->enqueue([=] {
+    // wait for this launch only, another queue of the device may start the
+    // next one before the device-wide vx_ready_wait would see this one end
+    std::shared_future<int> launch;
+    CHECK_ERR(vt_start_launch(hdevice, grid, block, knl_entry, knl_arg_base, &launch), {
+      return err;
+      });
+    return (launch.get() == VX_LAUNCH_COMPLETED) ? 0 : -1;
+  }, num_events, wait_list, event);
+}
+
+int vx_event_wait(vx_event_h hevent) {
+  if (nullptr == hevent)
+    return -1;
+  return (((vt_event*)hevent)->wait() == VX_EVENT_COMPLETE) ? 0 : -1;
+}
+
+int vx_event_status(vx_event_h hevent, int* status) {
+  if (nullptr == hevent || nullptr == status)
+    return -1;
+  *status = ((vt_event*)hevent)->status();
+  return 0;
+}
+
+int vx_event_release(vx_event_h hevent) {
+  if (nullptr == hevent)
+    return -1;
+  ((vt_event*)hevent)->release();
+  return 0;
+}
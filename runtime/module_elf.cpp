@@ -0,0 +1,125 @@
+// Copyright © 2019-2023
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define LOG_CAT_DEFAULT LOG_CAT_RT
+
+#include "module_elf.h"
+#include "logger.h"
+#include "vt_config.h"
+
+#include <algorithm>
+#include <elf.h>
+#include <string.h>
+
+template <typename T>
+static bool elf_get(const std::vector<uint8_t>& image, uint64_t offset, T* value) {
+  if (offset > image.size() || image.size() - offset < sizeof(T))
+    return false;
+  memcpy(value, image.data() + offset, sizeof(T));
+  return true;
+}
+
+bool elf_parse(const std::vector<uint8_t>& image, vt_elf* elf) {
+  Elf32_Ehdr ehdr;
+  if (!elf_get(image, 0, &ehdr) || memcmp(ehdr.e_ident, ELFMAG, SELFMAG)
+   || ehdr.e_ident[EI_CLASS] != ELFCLASS32 || ehdr.e_ident[EI_DATA] != ELFDATA2LSB
+   || ehdr.e_machine != EM_RISCV || ehdr.e_type != ET_EXEC) {
+    ERROR("image of %lu bytes is not a RISC-V ELF32 executable", image.size());
+    return false;
+  }
+  elf->entry = ehdr.e_entry;
+
+  for (uint32_t i = 0; i < ehdr.e_phnum; ++i) {
+    Elf32_Phdr phdr;
+    if (!elf_get(image, ehdr.e_phoff + uint64_t(i) * ehdr.e_phentsize, &phdr))
+      return false;
+    if (phdr.p_type != PT_LOAD || 0 == phdr.p_memsz)
+      continue;
+    if (phdr.p_filesz > phdr.p_memsz || phdr.p_offset > image.size()
+     || image.size() - phdr.p_offset < phdr.p_filesz
+     || uint64_t(phdr.p_vaddr) + phdr.p_memsz > GLOBAL_MEM_SIZE) {
+      ERROR("malformed ELF segment %u", i);
+      return false;
+    }
+    elf->segments.push_back({phdr.p_vaddr, phdr.p_memsz, phdr.p_offset, phdr.p_filesz,
+                                0 != (phdr.p_flags & PF_W)});
+  }
+  if (elf->segments.empty()) {
+    ERROR("ELF image of %lu bytes has nothing to load", image.size());
+    return false;
+  }
+
+  // the pages the segments cover, merged where they touch
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (auto& segment : elf->segments) {
+    uint64_t begin = segment.addr & ~uint64_t(RAM_PAGE_SIZE - 1);
+    uint64_t end = (segment.addr + segment.mem_size + RAM_PAGE_SIZE - 1) & ~uint64_t(RAM_PAGE_SIZE - 1);
+    ranges.push_back({begin, end});
+  }
+  std::sort(ranges.begin(), ranges.end());
+  for (auto& range : ranges) {
+    auto& blocks = elf->blocks;
+    if (!blocks.empty() && range.first <= blocks.back().first + blocks.back().second) {
+      blocks.back().second = std::max(blocks.back().second, range.second - blocks.back().first);
+    } else {
+      blocks.push_back({range.first, range.second - range.first});
+    }
+  }
+
+  for (uint32_t i = 0; i < ehdr.e_shnum; ++i) {
+    Elf32_Shdr shdr, strtab;
+    if (!elf_get(image, ehdr.e_shoff + uint64_t(i) * ehdr.e_shentsize, &shdr))
+      return false;
+    if (shdr.sh_type != SHT_SYMTAB)
+      continue;
+    if (!elf_get(image, ehdr.e_shoff + uint64_t(shdr.sh_link) * ehdr.e_shentsize, &strtab)
+     || strtab.sh_offset > image.size() || image.size() - strtab.sh_offset < strtab.sh_size)
+      return false;
+    const char* names = (const char*)image.data() + strtab.sh_offset;
+    for (uint64_t offset = 0; offset + sizeof(Elf32_Sym) <= shdr.sh_size; offset += sizeof(Elf32_Sym)) {
+      Elf32_Sym sym;
+      if (!elf_get(image, shdr.sh_offset + offset, &sym))
+        return false;
+      if (ELF32_ST_BIND(sym.st_info) == STB_LOCAL || sym.st_shndx == SHN_UNDEF
+       || sym.st_name >= strtab.sh_size)
+        continue;
+      elf->symbols[std::string(names + sym.st_name, strnlen(names + sym.st_name, strtab.sh_size - sym.st_name))] = sym.st_value;
+    }
+  }
+
+  // .ventus.resource.<kernel> sections, kernels without one get the defaults
+  Elf32_Shdr shstrtab;
+  if (ehdr.e_shstrndx == SHN_UNDEF
+   || !elf_get(image, ehdr.e_shoff + uint64_t(ehdr.e_shstrndx) * ehdr.e_shentsize, &shstrtab)
+   || shstrtab.sh_offset > image.size() || image.size() - shstrtab.sh_offset < shstrtab.sh_size)
+    return true;
+  static const char prefix[] = ".ventus.resource.";
+  const char* section_names = (const char*)image.data() + shstrtab.sh_offset;
+  for (uint32_t i = 0; i < ehdr.e_shnum; ++i) {
+    Elf32_Shdr shdr;
+    if (!elf_get(image, ehdr.e_shoff + uint64_t(i) * ehdr.e_shentsize, &shdr))
+      return false;
+    if (shdr.sh_name >= shstrtab.sh_size)
+      continue;
+    std::string name(section_names + shdr.sh_name, strnlen(section_names + shdr.sh_name, shstrtab.sh_size - shdr.sh_name));
+    if (name.compare(0, sizeof(prefix) - 1, prefix) || shdr.sh_type == SHT_NOBITS)
+      continue;
+    kernel_resource_t resource;
+    if (shdr.sh_size < sizeof(resource) || !elf_get(image, shdr.sh_offset, &resource)) {
+      WARN("malformed %s section", name.c_str());
+      continue;
+    }
+    elf->resources[name.substr(sizeof(prefix) - 1)] = resource;
+  }
+  return true;
+}
@@ -0,0 +1,47 @@
+// Copyright © 2019-2023
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MODULE_ELF_H
+#define MODULE_ELF_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// one loadable segment of a module image
+struct vt_segment {
+  uint64_t addr;
+  uint64_t mem_size;
+  uint64_t offset;    // in the image
+  uint64_t file_size; // the rest up to mem_size is zero
+  bool writable;
+};
+
+// what a kernel module image, a RISC-V ELF32 executable, loads and exports
+struct vt_elf {
+  uint32_t entry;
+  std::vector<vt_segment> segments;
+  std::vector<std::pair<uint64_t, uint64_t>> blocks; // reserved, page aligned
+  std::unordered_map<std::string, uint64_t> symbols; // global ones
+  std::unordered_map<std::string, kernel_resource_t> resources; // by kernel
+};
+
+// segments, global symbols and kernel resources of the image, false when it
+// is not a well-formed executable
+bool elf_parse(const std::vector<uint8_t>& image, vt_elf* elf);
+
+#endif
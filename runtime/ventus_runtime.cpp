@@ -11,25 +11,39 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#define LOG_CAT_DEFAULT LOG_CAT_RT
+
 #include "callbacks.h"
 #include "memory.h"
+#include "module_elf.h"
 #include "ventus_runtime.h"
+#include "vt_config.h"
 
+#include <algorithm>
 #include <unistd.h>
 #include <string.h>
 #include <string>
 #include <cstdlib>
 #include <dlfcn.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <tuple>
+#include <unordered_map>
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// filled once, device state lives behind each handle
 static callbacks_t g_callbacks;
-static uint64_t g_csr_knl_addr;
+static std::once_flag g_callbacks_init;
 
 typedef int (*vx_dev_init_t)(callbacks_t*);
 
+static void module_cache_release(vx_device_h hdevice, bool restored);
+
 int vx_dev_open(vx_device_h* hdevice) {
-  vx_dev_init(&g_callbacks);
+  std::call_once(g_callbacks_init, [] { vx_dev_init(&g_callbacks); });
 
   vx_device_h _hdevice;
   CHECK_ERR((g_callbacks.dev_open)(&_hdevice), {
@@ -42,6 +56,7 @@ int vx_dev_open(vx_device_h* hdevice) {
 }
 
 int vx_dev_close(vx_device_h hdevice) {
+  module_cache_release(hdevice, false);
   int ret = (g_callbacks.dev_close)(hdevice);
   return ret;
 }
@@ -54,6 +69,14 @@ int vx_mem_alloc(vx_device_h hdevice, uint64_t size, uint64_t* addr) {
   return (g_callbacks.mem_alloc)(hdevice, size, addr);
 }
 
+int vx_mem_alloc_aligned(vx_device_h hdevice, uint64_t size, uint64_t alignment, uint64_t* addr) {
+  return (g_callbacks.mem_alloc_aligned)(hdevice, size, alignment, addr);
+}
+
+int vx_mem_reserve(vx_device_h hdevice, uint64_t addr, uint64_t size) {
+  return (g_callbacks.mem_reserve)(hdevice, addr, size);
+}
+
 int vx_mem_free(vx_device_h hdevice, uint64_t addr) {
   return (g_callbacks.mem_free)(hdevice, addr);
 }
@@ -62,6 +85,10 @@ int vx_mem_info(vx_device_h hdevice, uint64_t* mem_free, uint64_t* mem_used) {
   return (g_callbacks.mem_info)(hdevice, mem_free, mem_used);
 }
 
+int vx_mem_map(vx_device_h hdevice, uint64_t dev_addr, uint64_t size, void** host_ptr) {
+  return (g_callbacks.mem_map)(hdevice, dev_addr, size, host_ptr);
+}
+
 int vx_copy_to_dev(vx_device_h hdevice, uint64_t addr, const void* host_ptr, uint64_t size) {
   return (g_callbacks.copy_to_dev)(hdevice, addr, host_ptr, size);
 }
@@ -70,7 +97,29 @@ int vx_copy_from_dev(vx_device_h hdevice, void* host_ptr, uint64_t addr, uint64_
   return (g_callbacks.copy_from_dev)(hdevice, host_ptr, addr, size);
 }
 
-int vx_start(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base) {
+int vx_copy_to_dev_batch(vx_device_h hdevice, const copy_desc_t* descs, uint32_t count) {
+  return (g_callbacks.copy_to_dev_batch)(hdevice, descs, count);
+}
+
+int vx_copy_from_dev_batch(vx_device_h hdevice, const copy_desc_t* descs, uint32_t count) {
+  return (g_callbacks.copy_from_dev_batch)(hdevice, descs, count);
+}
+
+int vx_mem_fill(vx_device_h hdevice, uint64_t addr, const void* pattern, uint32_t pattern_size, uint64_t size) {
+  return (g_callbacks.mem_fill)(hdevice, addr, pattern, pattern_size, size);
+}
+
+int vx_dev_trace(vx_device_h hdevice, const trace_config_t* config) {
+  return (g_callbacks.trace)(hdevice, config);
+}
+
+int vx_dev_limits(vx_device_h hdevice, uint64_t max_cycles, uint64_t hang_cycles) {
+  return (g_callbacks.limits)(hdevice, max_cycles, hang_cycles);
+}
+
+static int start_kernel(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry,
+                        uint64_t knl_arg_base, uint32_t start_pc, const kernel_resource_t* resources,
+                        std::shared_future<int>* launch = nullptr) {
   metadata_buffer_t metadata;
   metadata.knl_entry = (uint32_t)knl_entry;
   metadata.knl_arg_base = (uint32_t)knl_arg_base;
@@ -86,26 +135,84 @@ int vx_start(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry, uin
   metadata.knl_gl_offset_z = 0;
   metadata.knl_print_addr = 0;
   metadata.knl_print_size = 0;
+  metadata.knl_start_pc = start_pc;
+  metadata.knl_vgprs = resources ? resources->vgpr_usage : 0;
+  metadata.knl_sgprs = resources ? resources->sgpr_usage : 0;
+  metadata.knl_lds_size = resources ? resources->lds_usage : 0;
 
+  uint64_t csr_knl_addr;
   uint32_t metadata_size = sizeof(metadata);
-  CHECK_ERR(vx_mem_alloc(hdevice, metadata_size, &g_csr_knl_addr), {
+  CHECK_ERR(vx_mem_alloc(hdevice, metadata_size, &csr_knl_addr), {
     return err;
     });
 
-  CHECK_ERR(vx_copy_to_dev(hdevice, g_csr_knl_addr, &metadata, metadata_size), {
-    vx_mem_free(hdevice, g_csr_knl_addr);
+  CHECK_ERR(vx_copy_to_dev(hdevice, csr_knl_addr, &metadata, metadata_size), {
+    vx_mem_free(hdevice, csr_knl_addr);
     return err;
     });
 
-  INFO("metadata dev addr: %lx, size: %u", g_csr_knl_addr, metadata_size);
+  INFO("metadata dev addr: %lx, size: %u", csr_knl_addr, metadata_size);
 
-  return (g_callbacks.start)(hdevice, metadata, g_csr_knl_addr);
+  return (g_callbacks.start)(hdevice, metadata, csr_knl_addr, launch);
+}
+
+int vx_start(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base) {
+  return start_kernel(hdevice, grid, block, knl_entry, knl_arg_base, 0, nullptr);
+}
+
+int vt_start_launch(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base,
+                    std::shared_future<int>* launch) {
+  return start_kernel(hdevice, grid, block, knl_entry, knl_arg_base, 0, nullptr, launch);
 }
 
 int vx_ready_wait(vx_device_h hdevice, uint64_t timeout) {
-  int ret = (g_callbacks.ready_wait)(hdevice, timeout);
-  vx_mem_free(hdevice, g_csr_knl_addr);
-  return ret;
+  return (g_callbacks.ready_wait)(hdevice, timeout);
+}
+
+int vx_launch_callback(vx_device_h hdevice, vx_launch_callback_t callback, void* arg) {
+  return (g_callbacks.launch_callback)(hdevice, callback, arg);
+}
+
+int vx_launch_status(vx_device_h hdevice, int* status) {
+  return (g_callbacks.launch_status)(hdevice, status);
+}
+
+int vx_perf_query(vx_device_h hdevice, uint32_t counter, uint32_t index, uint64_t* value) {
+  return (g_callbacks.perf_query)(hdevice, counter, index, value);
+}
+
+int vx_checkpoint(vx_device_h hdevice, const char* filename) {
+  return (g_callbacks.checkpoint)(hdevice, filename);
+}
+
+int vx_checkpoint_at(vx_device_h hdevice, uint64_t cycle, const char* filename) {
+  return (g_callbacks.checkpoint_at)(hdevice, cycle, filename);
+}
+
+int vx_restore(vx_device_h hdevice, const char* filename) {
+  CHECK_ERR((g_callbacks.restore)(hdevice, filename), {
+    return err;
+    });
+  // the checkpoint owns the device memory now, modules loaded since adopt
+  // their ranges from it
+  module_cache_release(hdevice, true);
+  return 0;
+}
+
+int vx_dev_sample(vx_device_h hdevice, const sample_config_t* config) {
+  return (g_callbacks.sample)(hdevice, config);
+}
+
+int vx_sample_estimate(vx_device_h hdevice, sample_estimate_t* estimate) {
+  return (g_callbacks.sample_estimate)(hdevice, estimate);
+}
+
+int vx_dev_parallel(vx_device_h hdevice, uint32_t num_models) {
+  return (g_callbacks.parallel)(hdevice, num_models);
+}
+
+int vx_occupancy(vx_device_h hdevice, dim3 block, const kernel_resource_t* resources, occupancy_t* occupancy) {
+  return (g_callbacks.occupancy)(hdevice, block, resources, occupancy);
 }
 
 int vx_upload_bytes(vx_device_h hdevice, const void* content, uint64_t size, uint64_t* addr) {
@@ -154,3 +261,383 @@ int vx_upload_file(vx_device_h hdevice, const char* filename, uint64_t* addr) {
 
   return 0;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Kernel modules, RISC-V ELF32 executables. The loadable segments sit at
+// their link addresses for as long as the module is cached.
+
+struct vt_module : vt_elf {
+  vx_device_h hdevice;
+  uint64_t hash;
+  std::vector<uint8_t> image;
+  uint32_t refs; // cached and unreferenced at 0
+};
+
+// what a file looked like when it was last read, an unchanged file is not
+// read again
+struct vt_module_file {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint64_t hash;
+};
+
+static std::mutex g_modules_mutex;
+static std::unordered_map<vx_device_h, std::list<vt_module*>> g_modules;
+static std::unordered_map<std::string, vt_module_file> g_module_files;
+
+// FNV-1a, the cache key of an image
+static uint64_t module_hash(const uint8_t* data, uint64_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (uint64_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static bool module_in_block(const vt_segment& segment, const std::pair<uint64_t, uint64_t>& block) {
+  return segment.addr >= block.first && segment.addr - block.first < block.second;
+}
+
+// copy the segments to the device, writable_only puts the data back as the
+// image has it; segments of the adopted blocks are on the device already
+static int module_upload(vt_module* module, bool writable_only, const std::vector<bool>& adopted = {}) {
+  for (auto& segment : module->segments) {
+    if (writable_only && !segment.writable)
+      continue;
+    bool resident = false;
+    for (uint32_t i = 0; i < adopted.size(); ++i) {
+      resident |= adopted[i] && module_in_block(segment, module->blocks[i]);
+    }
+    if (resident)
+      continue;
+    if (segment.file_size) {
+      CHECK_ERR(vx_copy_to_dev(module->hdevice, segment.addr, module->image.data() + segment.offset, segment.file_size), {
+        return err;
+        });
+    }
+    if (segment.mem_size > segment.file_size) {
+      std::vector<uint8_t> zeros(segment.mem_size - segment.file_size, 0);
+      CHECK_ERR(vx_copy_to_dev(module->hdevice, segment.addr + segment.file_size, zeros.data(), zeros.size()), {
+        return err;
+        });
+    }
+  }
+  return 0;
+}
+
+static void module_evict(vt_module* module) {
+  for (auto& block : module->blocks) {
+    vx_mem_free(module->hdevice, block.first);
+  }
+  delete module;
+}
+
+// a cached module referenced again gets its initial data back
+static void module_acquire(vt_module* module, vx_module_h* hmodule) {
+  if (0 == module->refs++) {
+    module_upload(module, true);
+  }
+  *hmodule = module;
+}
+
+// a block reserved already holds the module when the image's bytes are there,
+// as a restored checkpoint of a process that loaded it leaves them
+static bool module_resident(vt_module* module, const std::pair<uint64_t, uint64_t>& block) {
+  bool found = false;
+  std::vector<uint8_t> data;
+  for (auto& segment : module->segments) {
+    if (!module_in_block(segment, block) || 0 == segment.file_size)
+      continue;
+    data.resize(segment.file_size);
+    if (vx_copy_from_dev(module->hdevice, data.data(), segment.addr, data.size())
+     || memcmp(data.data(), module->image.data() + segment.offset, data.size()))
+      return false;
+    found = true;
+  }
+  return found;
+}
+
+// place a parsed module on its device, unreferenced cached modules in its way
+// are evicted and ranges already holding it are adopted; the modules mutex is
+// held
+static int module_place(vt_module* module) {
+  auto& cached = g_modules[module->hdevice];
+  for (auto it = cached.begin(); it != cached.end();) {
+    bool overlap = false;
+    for (auto& a : module->blocks) {
+      for (auto& b : (*it)->blocks) {
+        overlap |= (a.first < b.first + b.second) && (b.first < a.first + a.second);
+      }
+    }
+    if (!overlap) {
+      ++it;
+      continue;
+    }
+    if ((*it)->refs) {
+      ERROR("module at 0x%lx is in use", (*it)->blocks.front().first);
+      return -1;
+    }
+    module_evict(*it);
+    it = cached.erase(it);
+  }
+
+  std::vector<bool> adopted(module->blocks.size(), false);
+  auto release = [&](uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!adopted[i])
+        vx_mem_free(module->hdevice, module->blocks[i].first);
+    }
+  };
+  for (uint32_t i = 0; i < module->blocks.size(); ++i) {
+    auto& block = module->blocks[i];
+    if (0 == vx_mem_reserve(module->hdevice, block.first, block.second))
+      continue;
+    if (module_resident(module, block)) {
+      adopted[i] = true;
+      continue;
+    }
+    ERROR("module range 0x%lx size 0x%lx is taken, load modules before allocating", block.first, block.second);
+    release(i);
+    return -1;
+  }
+  CHECK_ERR(module_upload(module, false, adopted), {
+    release(module->blocks.size());
+    return err;
+    });
+  cached.push_back(module);
+  return 0;
+}
+
+static vt_module* module_find(vx_device_h hdevice, uint64_t hash, const void* image, uint64_t size) {
+  auto cached = g_modules.find(hdevice);
+  if (cached == g_modules.end())
+    return nullptr;
+  for (auto module : cached->second) {
+    if (module->hash == hash
+     && (nullptr == image || (module->image.size() == size && 0 == memcmp(module->image.data(), image, size))))
+      return module;
+  }
+  return nullptr;
+}
+
+static int module_load_image(vx_device_h hdevice, std::vector<uint8_t>&& image, uint64_t hash, vx_module_h* hmodule) {
+  auto module = new vt_module();
+  module->hdevice = hdevice;
+  module->hash = hash;
+  module->image = std::move(image);
+  module->refs = 0;
+  if (!elf_parse(module->image, module)) {
+    delete module;
+    return -1;
+  }
+  CHECK_ERR(module_place(module), {
+    delete module;
+    return err;
+    });
+  ++module->refs;
+  *hmodule = module;
+  return 0;
+}
+
+// drop the modules cached for the device, after a restore their ranges belong
+// to the checkpoint and stay reserved
+static void module_cache_release(vx_device_h hdevice, bool restored) {
+  std::lock_guard<std::mutex> lock(g_modules_mutex);
+  auto cached = g_modules.find(hdevice);
+  if (cached == g_modules.end())
+    return;
+  for (auto module : cached->second) {
+    if (module->refs) {
+      WARN("module at 0x%lx still loaded at %s", module->blocks.front().first, restored ? "restore" : "close");
+    }
+    if (restored) {
+      delete module;
+    } else {
+      module_evict(module);
+    }
+  }
+  g_modules.erase(cached);
+}
+
+int vx_module_load(vx_device_h hdevice, const char* filename, vx_module_h* hmodule) {
+  if (nullptr == hdevice || nullptr == filename || nullptr == hmodule)
+    return -1;
+
+  struct stat st;
+  if (stat(filename, &st)) {
+    ERROR("%s not found", filename);
+    return -1;
+  }
+  vt_module_file file = {(uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size,
+                         (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec, 0};
+
+  std::lock_guard<std::mutex> lock(g_modules_mutex);
+  auto known = g_module_files.find(filename);
+  if (known != g_module_files.end() && known->second.dev == file.dev && known->second.ino == file.ino
+   && known->second.size == file.size && known->second.mtime_ns == file.mtime_ns) {
+    auto module = module_find(hdevice, known->second.hash, nullptr, 0);
+    if (module) {
+      module_acquire(module, hmodule);
+      return 0;
+    }
+  }
+
+  std::ifstream ifs(filename, std::ios::binary);
+  std::vector<uint8_t> image(file.size);
+  if (!ifs || !ifs.read((char*)image.data(), image.size())) {
+    ERROR("cannot read %s", filename);
+    return -1;
+  }
+  file.hash = module_hash(image.data(), image.size());
+  g_module_files[filename] = file;
+
+  // the same image may be cached under another name
+  auto module = module_find(hdevice, file.hash, image.data(), image.size());
+  if (module) {
+    module_acquire(module, hmodule);
+    return 0;
+  }
+  return module_load_image(hdevice, std::move(image), file.hash, hmodule);
+}
+
+int vx_module_load_bytes(vx_device_h hdevice, const void* image, uint64_t size, vx_module_h* hmodule) {
+  if (nullptr == hdevice || nullptr == image || 0 == size || nullptr == hmodule)
+    return -1;
+  uint64_t hash = module_hash((const uint8_t*)image, size);
+  std::lock_guard<std::mutex> lock(g_modules_mutex);
+  auto module = module_find(hdevice, hash, image, size);
+  if (module) {
+    module_acquire(module, hmodule);
+    return 0;
+  }
+  std::vector<uint8_t> copy((const uint8_t*)image, (const uint8_t*)image + size);
+  return module_load_image(hdevice, std::move(copy), hash, hmodule);
+}
+
+int vx_module_symbol(vx_module_h hmodule, const char* name, uint64_t* addr) {
+  if (nullptr == hmodule || nullptr == name || nullptr == addr)
+    return -1;
+  auto module = (vt_module*)hmodule;
+  auto symbol = module->symbols.find(name);
+  if (symbol == module->symbols.end()) {
+    ERROR("symbol %s not found", name);
+    return -1;
+  }
+  *addr = symbol->second;
+  return 0;
+}
+
+int vx_module_resources(vx_module_h hmodule, const char* kernel, kernel_resource_t* resources) {
+  if (nullptr == hmodule || nullptr == kernel || nullptr == resources)
+    return -1;
+  auto module = (vt_module*)hmodule;
+  auto resource = module->resources.find(kernel);
+  if (resource == module->resources.end())
+    return -1;
+  *resources = resource->second;
+  return 0;
+}
+
+int vx_module_unload(vx_module_h hmodule) {
+  if (nullptr == hmodule)
+    return -1;
+  std::lock_guard<std::mutex> lock(g_modules_mutex);
+  auto module = (vt_module*)hmodule;
+  if (0 == module->refs)
+    return -1;
+  --module->refs;
+  return 0;
+}
+
+int vx_module_start(vx_module_h hmodule, const char* kernel, dim3 grid, dim3 block, uint64_t knl_arg_base) {
+  uint64_t knl_entry;
+  CHECK_ERR(vx_module_symbol(hmodule, kernel, &knl_entry), {
+    return err;
+    });
+  auto module = (vt_module*)hmodule;
+  auto resource = module->resources.find(kernel);
+  return start_kernel(module->hdevice, grid, block, knl_entry, knl_arg_base, module->entry,
+                      resource != module->resources.end() ? &resource->second : nullptr);
+}
+
+// fastest block by module image, kernel and problem size
+static std::mutex g_tune_mutex;
+static std::map<std::tuple<uint64_t, std::string, uint32_t, uint32_t, uint32_t>, dim3> g_tuned;
+
+int vx_module_tune(vx_module_h hmodule, const char* kernel, dim3 global, uint64_t knl_arg_base, dim3* block) {
+  if (nullptr == hmodule || nullptr == kernel || nullptr == block
+   || 0 == global.x || 0 == global.y || 0 == global.z)
+    return -1;
+  auto module = (vt_module*)hmodule;
+  auto hdevice = module->hdevice;
+  auto key = std::make_tuple(module->hash, std::string(kernel), global.x, global.y, global.z);
+  {
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    auto tuned = g_tuned.find(key);
+    if (tuned != g_tuned.end()) {
+      *block = tuned->second;
+      return 0;
+    }
+  }
+
+  kernel_resource_t resources;
+  bool reported = (0 == vx_module_resources(hmodule, kernel, &resources));
+
+  // power of two widths that split the rows evenly and fit an SM
+  dim3 best(0);
+  uint64_t best_cycles = UINT64_MAX;
+  uint32_t best_warps = 0;
+  for (uint64_t width = 1; width <= global.x; width *= 2) {
+    occupancy_t occupancy;
+    if (0 != (global.x % width)
+     || vx_occupancy(hdevice, dim3(width), reported ? &resources : nullptr, &occupancy)
+     || 0 == occupancy.wgs_per_sm)
+      continue;
+
+    CHECK_ERR(vx_module_start(hmodule, kernel, dim3(global.x / width, global.y, global.z), dim3(width), knl_arg_base), {
+      return err;
+      });
+    // -1 for a launch that did not complete, its status tells why
+    vx_ready_wait(hdevice, VX_MAX_TIMEOUT);
+    int status;
+    CHECK_ERR(vx_launch_status(hdevice, &status), {
+      return err;
+      });
+    if (status != VX_LAUNCH_COMPLETED) {
+      WARN("%s with blocks of %lu: launch status %d", kernel, width, status);
+      continue;
+    }
+    uint64_t cycles;
+    CHECK_ERR(vx_perf_query(hdevice, VX_PERF_CYCLES, VX_PERF_ALL, &cycles), {
+      return err;
+      });
+    INFO("%s with blocks of %lu: %lu cycles, %u warps per SM", kernel, width, cycles, occupancy.warps_per_sm);
+
+    // the functional backend counts no cycles, occupancy decides then
+    if (cycles < best_cycles || (cycles == best_cycles && occupancy.warps_per_sm > best_warps)) {
+      best = dim3(width);
+      best_cycles = cycles;
+      best_warps = occupancy.warps_per_sm;
+    }
+  }
+  if (0 == best.x) {
+    ERROR("no block size of %s completed for %u threads per row", kernel, global.x);
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> lock(g_tune_mutex);
+  g_tuned[key] = best;
+  *block = best;
+  return 0;
+}
+
+int vx_module_start_tuned(vx_module_h hmodule, const char* kernel, dim3 global, uint64_t knl_arg_base) {
+  dim3 block;
+  CHECK_ERR(vx_module_tune(hmodule, kernel, global, knl_arg_base, &block), {
+    return err;
+    });
+  return vx_module_start(hmodule, kernel, dim3(global.x / block.x, global.y, global.z), block, knl_arg_base);
+}
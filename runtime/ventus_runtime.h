@@ -22,6 +22,12 @@
 
 typedef void* vx_device_h;
 typedef void* vx_buffer_h;
+typedef void* vx_queue_h;
+typedef void* vx_event_h;
+typedef void* vx_module_h;
+
+// launch completion callback, status is VX_LAUNCH_*
+typedef void (*vx_launch_callback_t)(vx_device_h hdevice, int status, void* arg);
 
 // device caps ids
 #define VX_CAPS_VERSION             0x0
@@ -59,10 +65,17 @@ typedef void* vx_buffer_h;
 #define VX_ISA_EXT_OM               (1ull << (32+ISA_EXT_OM))
 #define VX_ISA_EXT_TCU              (1ull << (32+ISA_EXT_TCU))
 
+// command event status
+#define VX_EVENT_QUEUED             0
+#define VX_EVENT_RUNNING            1
+#define VX_EVENT_COMPLETE           2
+#define VX_EVENT_ERROR              3   // the command or one it waited for failed
+
 // ready wait timeout
 #define VX_MAX_TIMEOUT              (24*60*60*1000)   // 24 Hr
 
-  // open the device and connect to it
+  // open the device and connect to it, VT_BACKEND=func runs its launches on
+  // the functional emulator instead of the RTL model (VT_BACKEND=rtl)
 int vx_dev_open(vx_device_h* hdevice);
 
 // Close the device when all the operations are done
@@ -74,28 +87,182 @@ int vx_dev_caps(vx_device_h hdevice, uint32_t caps_id, uint64_t* value);
 // allocate device memory and return address
 int vx_mem_alloc(vx_device_h hdevice, uint64_t size, uint64_t* addr);
 
+// allocate device memory with a power of two alignment (0 = page aligned)
+int vx_mem_alloc_aligned(vx_device_h hdevice, uint64_t size, uint64_t alignment, uint64_t* addr);
+
 // release device memory
 int vx_mem_free(vx_device_h hdevice, uint64_t addr);
 
+// allocate [addr, addr + size) of device memory, for contents linked there;
+// addr must be page aligned
+int vx_mem_reserve(vx_device_h hdevice, uint64_t addr, uint64_t size);
+
 // get device memory info
 int vx_mem_info(vx_device_h hdevice, uint64_t* mem_free, uint64_t* mem_used);
 
+// map allocated device memory into the host address space (zero-copy),
+// the pointer stays valid until the buffer is released
+int vx_mem_map(vx_device_h hdevice, uint64_t dev_addr, uint64_t size, void** host_ptr);
+
 // Copy bytes from host to device memory
 int vx_copy_to_dev(vx_device_h hdevice, uint64_t addr, const void* host_ptr, uint64_t size);
 
 // Copy bytes from device memory to host
 int vx_copy_from_dev(vx_device_h hdevice, void* host_ptr, uint64_t addr, uint64_t size);
 
+// copy count ranges in one call, every range is checked before any byte
+// moves; large transfers are split over host threads
+int vx_copy_to_dev_batch(vx_device_h hdevice, const copy_desc_t* descs, uint32_t count);
+
+int vx_copy_from_dev_batch(vx_device_h hdevice, const copy_desc_t* descs, uint32_t count);
+
+// repeat pattern over size bytes of device memory, size is a multiple of
+// pattern_size
+int vx_mem_fill(vx_device_h hdevice, uint64_t addr, const void* pattern, uint32_t pattern_size, uint64_t size);
+
+// configure waveform tracing (FST) for the next launches, tracing is off
+// unless enabled here or through the VT_TRACE environment variables
+int vx_dev_trace(vx_device_h hdevice, const trace_config_t* config);
+
+// set the cycle budget and the hang watchdog of the next launches, a launch
+// that runs out of either stops with VX_LAUNCH_TIMEOUT or VX_LAUNCH_HUNG
+// (0 disables a limit, VT_MAX_CYCLES and VT_HANG_CYCLES set the defaults)
+int vx_dev_limits(vx_device_h hdevice, uint64_t max_cycles, uint64_t hang_cycles);
+
 // Start device execution
 int vx_start(vx_device_h hdevice, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base);
 
-// Wait for device ready with milliseconds timeout
+// Wait for device ready with milliseconds timeout, VX_MAX_TIMEOUT or more
+// waits without limit
 int vx_ready_wait(vx_device_h hdevice, uint64_t timeout);
 
+// call callback when the next launch ends, from the simulation thread; it
+// must not wait on the device
+int vx_launch_callback(vx_device_h hdevice, vx_launch_callback_t callback, void* arg);
+
+// status of the last launch, VX_LAUNCH_*
+int vx_launch_status(vx_device_h hdevice, int* status);
+
+// performance counter VX_PERF_* of the last launch, waits for it to finish.
+// index selects the SM, warp or L2 slice the counter is kept for, or
+// VX_PERF_ALL for the device total
+int vx_perf_query(vx_device_h hdevice, uint32_t counter, uint32_t index, uint64_t* value);
+
+// save memory and allocations to filename, waits for the running launch;
+// restoring it in a new process after vx_dev_open skips every prior launch
+int vx_checkpoint(vx_device_h hdevice, const char* filename);
+
+// save the whole simulator state once the next launch reaches cycle (0
+// disarms), this needs rtlsim built with SAVABLE=1
+int vx_checkpoint_at(vx_device_h hdevice, uint64_t cycle, const char* filename);
+
+// replace the device state with a checkpoint, one taken within a launch
+// resumes that launch, wait for it with vx_ready_wait. Cached modules are
+// dropped, loading one again adopts its ranges from the checkpoint
+int vx_restore(vx_device_h hdevice, const char* filename);
+
+// simulate only a sample of the workgroups of the next launches on the RTL,
+// the others run on the functional model beforehand so memory ends up as
+// after a full launch; VT_SAMPLE sets the default at open. The cycle
+// counters then cover the sample only, see vx_sample_estimate
+int vx_dev_sample(vx_device_h hdevice, const sample_config_t* config);
+
+// cycles of the whole grid extrapolated from the last sampled launch, with a
+// 95% interval from batch means of its cycles per completed workgroup; the
+// sample should keep the device busy, at least as many workgroups as it holds
+// at once
+int vx_sample_estimate(vx_device_h hdevice, sample_estimate_t* estimate);
+
+// split the workgroups of the next launches over num_models RTL models, each
+// simulated on its own host thread (VT_PARALLEL sets the default at open, 1
+// runs one model). The models see the memory as before the launch and their
+// writes are merged at the end, so the workgroups must not communicate
+// through memory; bytes written differently by two models fail the launch
+// with VX_LAUNCH_CONFLICT. Cycle counters add up over the models, sampling
+// and checkpoints within a launch do not apply
+int vx_dev_parallel(vx_device_h hdevice, uint32_t num_models);
+
+// theoretical workgroups and warps resident per SM for blocks of block
+// threads of a kernel using resources (see vx_module_resources, nullptr for
+// one that reports none), and which hardware limit bounds them; block.x must
+// be a multiple of the warp size
+int vx_occupancy(vx_device_h hdevice, dim3 block, const kernel_resource_t* resources, occupancy_t* occupancy);
+
+// create an in-order command queue, its commands run on a worker thread
+// while the host goes on; commands of different queues overlap
+int vx_queue_create(vx_device_h hdevice, vx_queue_h* hqueue);
+
+// wait for the pending commands and release the queue
+int vx_queue_destroy(vx_queue_h hqueue);
+
+// wait for every command enqueued so far
+int vx_queue_finish(vx_queue_h hqueue);
+
+// Enqueued commands start once the num_events events of wait_list have
+// completed and return an event of their own when event is not null, to be
+// released with vx_event_release. Host buffers are accessed when the command
+// runs and must stay valid until its event completes.
+int vx_enqueue_copy_to_dev(vx_queue_h hqueue, uint64_t addr, const void* host_ptr, uint64_t size,
+                           uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event);
+
+int vx_enqueue_copy_from_dev(vx_queue_h hqueue, void* host_ptr, uint64_t addr, uint64_t size,
+                             uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event);
+
+// fill size bytes with a repeated pattern, size is a multiple of pattern_size
+int vx_enqueue_fill(vx_queue_h hqueue, uint64_t addr, const void* pattern, uint32_t pattern_size, uint64_t size,
+                    uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event);
+
+// start a kernel and wait for it, launches on one device take turns
+int vx_enqueue_launch(vx_queue_h hqueue, dim3 grid, dim3 block, uint64_t knl_entry, uint64_t knl_arg_base,
+                      uint32_t num_events, const vx_event_h* wait_list, vx_event_h* event);
+
+// wait for an event, fails if its command failed
+int vx_event_wait(vx_event_h hevent);
+
+// event status, VX_EVENT_*
+int vx_event_status(vx_event_h hevent, int* status);
+
+int vx_event_release(vx_event_h hevent);
+
 // upload bytes to device
 int vx_upload_bytes(vx_device_h hdevice, const void* content, uint64_t size, uint64_t* addr);
 
 // upload file to device
 int vx_upload_file(vx_device_h hdevice, const char* filename, uint64_t* addr);
 
+// Load an ELF kernel module, its segments go to their link addresses so load
+// it before allocating buffers. Modules stay cached per device by content:
+// loading one again costs no file read nor upload, only its writable data is
+// put back when no handle to it was left. A cached module is dropped when
+// another one needs its addresses or the device closes
+int vx_module_load(vx_device_h hdevice, const char* filename, vx_module_h* hmodule);
+
+int vx_module_load_bytes(vx_device_h hdevice, const void* image, uint64_t size, vx_module_h* hmodule);
+
+// address of a global symbol of the module
+int vx_module_symbol(vx_module_h hmodule, const char* name, uint64_t* addr);
+
+// registers and local memory the compiler reported for kernel, fails when
+// the module carries no .ventus.resource section for it
+int vx_module_resources(vx_module_h hmodule, const char* kernel, kernel_resource_t* resources);
+
+// release the handle, the module stays cached
+int vx_module_unload(vx_module_h hmodule);
+
+// launch kernel of the module by name, the warps start at the module entry
+// and its workgroups take only the resources the kernel reports
+int vx_module_start(vx_module_h hmodule, const char* kernel, dim3 grid, dim3 block, uint64_t knl_arg_base);
+
+// fastest block for global threads of kernel: every power of two width that
+// divides global.x and fits an SM is launched to completion and the one
+// taking the fewest cycles wins (the highest occupancy on the functional
+// backend). The kernel runs once per candidate, so it must give the same
+// result when repeated. The choice is cached per module image, kernel and
+// global size for the rest of the process
+int vx_module_tune(vx_module_h hmodule, const char* kernel, dim3 global, uint64_t knl_arg_base, dim3* block);
+
+// launch kernel over global threads with the tuned block, tuning first
+// when the problem size is new
+int vx_module_start_tuned(vx_module_h hmodule, const char* kernel, dim3 global, uint64_t knl_arg_base);
+
 #endif // __VX_VORTEX_H__
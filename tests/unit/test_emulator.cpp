@@ -0,0 +1,386 @@
+#include "emulator.h"
+#include "module_elf.h"
+#include "unit.h"
+#include "vt_config.h"
+
+#include <fstream>
+#include <iterator>
+#include <string.h>
+#include <vector>
+
+static const uint32_t W = hw::NUM_THREAD;
+
+static float as_f32(uint32_t value) {
+  float f;
+  memcpy(&f, &value, 4);
+  return f;
+}
+
+// Hand assembler for the kernels below, the encodings the emulator decodes.
+// Labels are resolved when they are bound.
+class kernel_t {
+public:
+  struct label_t {
+    int32_t offset = -1;
+    std::vector<size_t> uses;
+  };
+
+  // scalar
+  void lui(uint32_t rd, uint32_t imm20) { emit((imm20 << 12) | (rd << 7) | 0x37); }
+  void addi(uint32_t rd, uint32_t rs1, int32_t imm) { emit(i_type(0x13, rd, 0, rs1, imm)); }
+  void slli(uint32_t rd, uint32_t rs1, uint32_t shamt) { emit(i_type(0x13, rd, 1, rs1, shamt)); }
+  void xori(uint32_t rd, uint32_t rs1, int32_t imm) { emit(i_type(0x13, rd, 4, rs1, imm)); }
+  void add(uint32_t rd, uint32_t rs1, uint32_t rs2) { emit(r_type(0x33, rd, 0, rs1, rs2, 0)); }
+  void sw(uint32_t rs2, uint32_t rs1, int32_t imm) {
+    emit(((uint32_t(imm) >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (2 << 12) | ((imm & 0x1f) << 7) | 0x23);
+  }
+  void csrr(uint32_t rd, uint32_t csr) { emit(i_type(0x73, rd, 2, 0, csr)); }
+  void csrwi(uint32_t csr, uint32_t uimm) { emit(i_type(0x73, 0, 5, uimm, csr)); }
+  void jal(label_t &target) { use(target); emit(0x6f); }
+
+  // scalar single precision on the integer registers
+  void fop(uint32_t funct7, uint32_t rd, uint32_t rs1, uint32_t rs2, uint32_t rm = 7) {
+    emit(r_type(0x53, rd, rm, rs1, rs2, funct7));
+  }
+  void fmadd(uint32_t rd, uint32_t rs1, uint32_t rs2, uint32_t rs3) {
+    emit((rs3 << 27) | r_type(0x43, rd, 7, rs1, rs2, 0));
+  }
+
+  // vector, one element per lane
+  void opv(uint32_t funct6, uint32_t funct3, uint32_t vd, uint32_t vs2, uint32_t rs1) {
+    emit((funct6 << 26) | (1 << 25) | (vs2 << 20) | (rs1 << 15) | (funct3 << 12) | (vd << 7) | 0x57);
+  }
+  void vid(uint32_t vd) { opv(0x14, 2, vd, 0, 0x11); }
+  void vadd_vx(uint32_t vd, uint32_t vs2, uint32_t rs1) { opv(0x00, 4, vd, vs2, rs1); }
+  void vadd_vi(uint32_t vd, uint32_t vs2, int32_t imm) { opv(0x00, 3, vd, vs2, imm & 0x1f); }
+  void vand_vi(uint32_t vd, uint32_t vs2, int32_t imm) { opv(0x09, 3, vd, vs2, imm & 0x1f); }
+  void vmv_v_x(uint32_t vd, uint32_t rs1) { opv(0x17, 4, vd, 0, rs1); }
+  void vse32(uint32_t vs3, uint32_t rs1) { emit((1 << 25) | (rs1 << 15) | (6 << 12) | (vs3 << 7) | 0x27); }
+  void vle32(uint32_t vd, uint32_t rs1) { emit((1 << 25) | (rs1 << 15) | (6 << 12) | (vd << 7) | 0x07); }
+
+  // SIMT control: setrpc takes the join the next divergent branch meets
+  void setrpc(label_t &join) {
+    use(join);
+    emit(0x17 | (31 << 7)); // auipc x31, 0
+    emit(i_type(0x5b, 0, 3, 31, 0));
+  }
+  void vbranch(uint32_t funct3, uint32_t vs1, uint32_t vs2, label_t &target) {
+    use(target);
+    emit(r_type(0x5b, 0, funct3, vs1, vs2, 0));
+  }
+  void join() { emit(r_type(0x5b, 0, 2, 0, 0, 0)); }
+  void barrier() { emit(r_type(0x0b, 0, 4, 0, 0, 0x02)); }
+  void endprg() { emit(r_type(0x0b, 0, 4, 0, 0, 0x00)); }
+
+  void bind(label_t &label) {
+    label.offset = here();
+    for (auto index : label.uses) {
+      patch(index, label.offset);
+    }
+  }
+
+  const std::vector<uint32_t> &code() const { return code_; }
+
+private:
+  static uint32_t r_type(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1,
+                         uint32_t rs2, uint32_t funct7) {
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+  }
+
+  static uint32_t i_type(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, int32_t imm) {
+    return (uint32_t(imm) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+  }
+
+  int32_t here() const { return code_.size() * 4; }
+
+  void emit(uint32_t inst) { code_.push_back(inst); }
+
+  void use(label_t &label) { label.uses.push_back(code_.size()); }
+
+  void patch(size_t index, int32_t target) {
+    uint32_t &inst = code_[index];
+    uint32_t imm = target - int32_t(index * 4);
+    if ((inst & 0x7f) == 0x6f) {
+      inst |= (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+              (((imm >> 11) & 1) << 20) | (((imm >> 12) & 0xff) << 12);
+    } else if ((inst & 0x7f) == 0x17) {
+      // the setrpc after the auipc, relative to the auipc
+      code_[index + 1] |= imm << 20;
+    } else {
+      inst |= (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+              (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7);
+    }
+  }
+
+  std::vector<uint32_t> code_;
+};
+
+// CSRs, define.v
+static const uint32_t CSR_TID = hw::CSR_THREADID;
+static const uint32_t CSR_KNL = hw::CSR_KNL_BASE;
+static const uint32_t CSR_LDS = hw::CSR_LDS_BASE_DISPATCH;
+static const uint32_t CSR_FRM = hw::CSR_FRM;
+
+// a device memory with the private segment and the code of a kernel loaded
+class device_t {
+public:
+  device_t() {
+    emulator_.attach_ram(&ram_);
+    emulator_.private_segment(PDS_BASE_ADDR);
+    CHECK(ram_.reserve(PDS_BASE_ADDR, PDS_MEM_SIZE));
+    blocks_.push_back(PDS_BASE_ADDR);
+  }
+
+  ~device_t() {
+    for (auto addr : blocks_) {
+      ram_.free(addr);
+    }
+  }
+
+  uint64_t alloc(uint64_t size) {
+    paddr_t addr = 0;
+    CHECK(ram_.alloc(&addr, size));
+    blocks_.push_back(addr);
+    return addr;
+  }
+
+  void write(uint64_t addr, const void *data, uint64_t size) { CHECK(ram_.write(addr, data, size)); }
+
+  std::vector<uint32_t> read(uint64_t addr, uint32_t count) {
+    std::vector<uint32_t> values(count);
+    CHECK(ram_.read(addr, values.data(), count * 4));
+    return values;
+  }
+
+  uint32_t load(const kernel_t &kernel) {
+    auto &code = kernel.code();
+    uint64_t addr = this->alloc(code.size() * 4);
+    this->write(addr, code.data(), code.size() * 4);
+    return addr;
+  }
+
+  bool load(const std::vector<uint8_t> &image, vt_elf *elf) {
+    if (!elf_parse(image, elf))
+      return false;
+    for (auto &block : elf->blocks) {
+      CHECK(ram_.reserve(block.first, block.second));
+      blocks_.push_back(block.first);
+    }
+    for (auto &segment : elf->segments) {
+      this->write(segment.addr, image.data() + segment.offset, segment.file_size);
+    }
+    return true;
+  }
+
+  // a hand-assembled kernel, grid and block along x; csr_knl reads back as
+  // given
+  int run(uint32_t start_pc, uint32_t grid, uint32_t block, uint64_t csr_knl) {
+    return emulator_.run(metadata(start_pc, grid, block), csr_knl);
+  }
+
+  // a kernel of a module through its crt0, which reads the metadata from
+  // device memory like the runtime puts it
+  int start(const vt_elf &elf, const char *kernel, uint32_t grid, uint32_t block,
+            uint64_t arg_base) {
+    metadata_buffer_t metadata = this->metadata(elf.entry, grid, block);
+    metadata.knl_entry = elf.symbols.at(kernel);
+    metadata.knl_arg_base = arg_base;
+    uint64_t csr_knl = this->alloc(sizeof(metadata));
+    this->write(csr_knl, &metadata, sizeof(metadata));
+    return emulator_.run(metadata, csr_knl);
+  }
+
+  Emulator &emulator() { return emulator_; }
+
+private:
+  static metadata_buffer_t metadata(uint32_t start_pc, uint32_t grid, uint32_t block) {
+    metadata_buffer_t metadata = {};
+    metadata.knl_work_dim = 1;
+    metadata.knl_gl_size_x = grid * block;
+    metadata.knl_gl_size_y = metadata.knl_gl_size_z = 1;
+    metadata.knl_lc_size_x = block;
+    metadata.knl_lc_size_y = metadata.knl_lc_size_z = 1;
+    metadata.knl_start_pc = start_pc;
+    return metadata;
+  }
+
+  PhysicalMemory ram_;
+  Emulator emulator_;
+  std::vector<uint64_t> blocks_;
+};
+
+TEST(divergence) {
+  // two warps; in the first the lanes below W/2 take the branch and split
+  // again on odd lanes, the second runs the fall-through path only
+  kernel_t k;
+  kernel_t::label_t taken, join1, odd, join2;
+  k.csrr(8, CSR_KNL);
+  k.csrr(5, CSR_TID);
+  k.vid(1);
+  k.vadd_vx(1, 1, 5); // thread id
+  k.slli(6, 5, 2);
+  k.add(8, 8, 6);
+  k.addi(7, 0, W / 2);
+  k.vmv_v_x(2, 7);
+  k.vmv_v_x(5, 0);
+  k.setrpc(join1);
+  k.vbranch(4, 1, 2, taken); // vblt
+  k.addi(10, 0, 200);
+  k.vmv_v_x(3, 10);
+  k.jal(join1);
+  k.bind(taken);
+  k.addi(10, 0, 100);
+  k.vmv_v_x(3, 10);
+  k.vand_vi(4, 1, 1);
+  k.setrpc(join2);
+  k.vbranch(1, 4, 5, odd); // vbne
+  k.vadd_vi(3, 3, 10);
+  k.jal(join2);
+  k.bind(odd);
+  k.vadd_vi(3, 3, 15);
+  k.bind(join2);
+  k.join();
+  k.bind(join1);
+  k.join();
+  // reconverged, every lane again
+  k.vadd_vi(3, 3, 1);
+  k.vse32(3, 8);
+  k.endprg();
+
+  device_t dev;
+  uint64_t out = dev.alloc(2 * W * 4);
+  CHECK(dev.run(dev.load(k), 1, 2 * W, out) == VX_LAUNCH_COMPLETED);
+  auto values = dev.read(out, 2 * W);
+  for (uint32_t t = 0; t < 2 * W; ++t) {
+    uint32_t expected = (t >= W / 2) ? 201 : ((t & 1) ? 116 : 111);
+    CHECK(values[t] == expected);
+  }
+}
+
+TEST(barrier) {
+  // each warp writes its slots of local memory, then reads those of the
+  // other warp; the first warp runs first and only sees them past the barrier
+  kernel_t k;
+  k.csrr(5, CSR_TID);
+  k.csrr(6, CSR_LDS);
+  k.csrr(8, CSR_KNL);
+  k.vid(1);
+  k.vadd_vx(1, 1, 5);
+  k.vadd_vi(2, 1, 1);
+  k.slli(7, 5, 2);
+  k.add(10, 6, 7);
+  k.vse32(2, 10);
+  k.barrier();
+  k.xori(11, 5, W);
+  k.slli(11, 11, 2);
+  k.add(11, 6, 11);
+  k.vle32(3, 11);
+  k.add(12, 8, 7);
+  k.vse32(3, 12);
+  k.endprg();
+
+  device_t dev;
+  uint64_t out = dev.alloc(2 * W * 4);
+  CHECK(dev.run(dev.load(k), 1, 2 * W, out) == VX_LAUNCH_COMPLETED);
+  auto values = dev.read(out, 2 * W);
+  for (uint32_t t = 0; t < 2 * W; ++t) {
+    CHECK(values[t] == (t ^ W) + 1);
+  }
+}
+
+TEST(fp) {
+  kernel_t k;
+  k.csrr(8, CSR_KNL);
+  // vector: 3.5 * lane, converted with the nearest-even and towards-zero
+  // rounding modes of frm
+  k.vid(1);
+  k.opv(0x12, 1, 1, 1, 0x02); // vfcvt.f.xu.v
+  k.lui(5, 0x3f000);          // 0.5f
+  k.opv(0x24, 5, 2, 1, 5);    // vfmul.vf
+  k.opv(0x00, 1, 3, 2, 1);    // vfadd.vv
+  k.lui(6, 0x40000);          // 2.0f
+  k.opv(0x2c, 5, 3, 1, 6);    // vfmacc.vf
+  k.vse32(3, 8);
+  k.opv(0x12, 1, 4, 3, 0x01); // vfcvt.x.f.v
+  k.addi(9, 8, 4 * W);
+  k.vse32(4, 9);
+  k.csrwi(CSR_FRM, 1);
+  k.opv(0x12, 1, 5, 3, 0x01);
+  k.addi(9, 9, 4 * W);
+  k.vse32(5, 9);
+  // scalar, on the integer registers
+  k.lui(10, 0x41800);         // 16.0f
+  k.fop(0x2c, 11, 10, 0);     // fsqrt.s
+  k.lui(12, 0x41000);         // 8.0f
+  k.fop(0x0c, 13, 11, 12);    // fdiv.s
+  k.fmadd(14, 11, 13, 11);
+  k.fop(0x60, 15, 14, 0);     // fcvt.w.s
+  k.fop(0x50, 16, 13, 11, 1); // flt.s
+  k.fop(0x14, 17, 13, 11, 1); // fmax.s
+  k.addi(9, 9, 4 * W);
+  k.sw(11, 9, 0);
+  k.sw(13, 9, 4);
+  k.sw(14, 9, 8);
+  k.sw(15, 9, 12);
+  k.sw(16, 9, 16);
+  k.sw(17, 9, 20);
+  k.endprg();
+
+  device_t dev;
+  uint64_t out = dev.alloc(3 * W * 4 + 24);
+  CHECK(dev.run(dev.load(k), 1, W, out) == VX_LAUNCH_COMPLETED);
+  auto values = dev.read(out, 3 * W + 6);
+  for (uint32_t l = 0; l < W; ++l) {
+    uint32_t half = 7 * l / 2; // 3.5 * l rounded down
+    uint32_t nearest_even = half + ((l & 1) && (half & 1));
+    CHECK(as_f32(values[l]) == 3.5f * l);
+    CHECK(values[W + l] == nearest_even);
+    CHECK(values[2 * W + l] == half);
+  }
+  const uint32_t *scalar = &values[3 * W];
+  CHECK(as_f32(scalar[0]) == 4.0f);
+  CHECK(as_f32(scalar[1]) == 0.5f);
+  CHECK(as_f32(scalar[2]) == 6.0f);
+  CHECK(scalar[3] == 6);
+  CHECK(scalar[4] == 1);
+  CHECK(as_f32(scalar[5]) == 4.0f);
+}
+
+// the compiled vecadd.elf through its crt0; its vecadd(src, dst) kernel
+// copies src[gid] to dst[gid]
+static void run_vecadd(uint32_t grid, uint32_t block) {
+  std::ifstream file(VECADD_ELF, std::ios::binary);
+  std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  device_t dev;
+  vt_elf elf;
+  CHECK(dev.load(image, &elf));
+  CHECK(elf.symbols.count("vecadd") == 1);
+
+  uint32_t count = grid * block;
+  std::vector<uint32_t> src(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    src[i] = 0x1000 + 3 * i;
+  }
+  uint32_t args[2] = {(uint32_t)dev.alloc(count * 4), (uint32_t)dev.alloc(count * 4)};
+  dev.write(args[0], src.data(), count * 4);
+  uint64_t arg_base = dev.alloc(sizeof(args));
+  dev.write(arg_base, args, sizeof(args));
+
+  CHECK(dev.start(elf, "vecadd", grid, block, arg_base) == VX_LAUNCH_COMPLETED);
+  CHECK(dev.read(args[1], count) == src);
+  uint64_t ctas = 0;
+  CHECK(dev.emulator().perf_query(VX_PERF_CTAS, 0, &ctas) == 0 && ctas == grid);
+}
+
+TEST(vecadd) {
+  run_vecadd(1, 32);
+  run_vecadd(4, 64);
+}
+
+int main() {
+  RUN(divergence);
+  RUN(barrier);
+  RUN(fp);
+  RUN(vecadd);
+  return g_failures;
+}
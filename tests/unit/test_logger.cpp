@@ -0,0 +1,72 @@
+#include "logger.h"
+#include "unit.h"
+
+#include <string.h>
+#include <string>
+
+static std::string render(const vt_log::record_t &record, const char *fmt) {
+  char buf[256];
+  vt_log::format(buf, sizeof(buf), fmt, record.args, record.nargs,
+                 record.strbuf, record.strlen);
+  return buf;
+}
+
+TEST(capture_numbers) {
+  vt_log::record_t record = {};
+  vt_log::capture(record, -5);
+  vt_log::capture(record, 0x1234u);
+  vt_log::capture(record, 2.5);
+  vt_log::capture(record, 'x');
+  CHECK(record.nargs == 4 && record.strlen == 0);
+  CHECK(render(record, "%d %x %.1f %c %%\n") == "-5 1234 2.5 x %");
+}
+
+TEST(capture_strings) {
+  vt_log::record_t record = {};
+  vt_log::capture(record, "ab");
+  vt_log::capture(record, (const char *)nullptr);
+  vt_log::capture(record, "cd");
+  CHECK(record.strlen == 7);
+  CHECK(render(record, "%s|%s|%s") == "ab||cd");
+}
+
+TEST(capture_overflow) {
+  // strings past a full strbuf are captured empty, nothing is written out of
+  // the record
+  struct {
+    vt_log::record_t record;
+    char guard[16];
+  } s;
+  memset(&s, 0, sizeof(s));
+  memset(s.guard, 0x5a, sizeof(s.guard));
+  std::string longest(2 * vt_log::MAX_STRBUF, 'a');
+  vt_log::capture(s.record, longest.c_str());
+  vt_log::capture(s.record, "bb");
+  vt_log::capture(s.record, "cc");
+  vt_log::capture(s.record, 7);
+  CHECK(s.record.strlen == vt_log::MAX_STRBUF);
+  for (char c : s.guard) {
+    CHECK(c == 0x5a);
+  }
+  std::string expected(vt_log::MAX_STRBUF - 1, 'a');
+  CHECK(render(s.record, "%s|%s|%s|%d") == expected + "|||7");
+}
+
+TEST(filter) {
+  uint8_t level = vt_log::g_level, cats = vt_log::g_cats;
+  vt_log::g_level = LOG_LEVEL_WARN;
+  vt_log::g_cats = LOG_CAT_MEM;
+  CHECK(vt_log::enabled(LOG_LEVEL_ERROR, LOG_CAT_MEM));
+  CHECK(!vt_log::enabled(LOG_LEVEL_INFO, LOG_CAT_MEM));
+  CHECK(!vt_log::enabled(LOG_LEVEL_ERROR, LOG_CAT_SIM));
+  vt_log::g_level = level;
+  vt_log::g_cats = cats;
+}
+
+int main() {
+  RUN(capture_numbers);
+  RUN(capture_strings);
+  RUN(capture_overflow);
+  RUN(filter);
+  return g_failures;
+}
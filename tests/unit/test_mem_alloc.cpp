@@ -0,0 +1,113 @@
+#include "mem_alloc.h"
+#include "unit.h"
+
+static const uint64_t BASE = 0x80000000;
+static const uint64_t SIZE = 0x100000;
+static const uint64_t PAGE = 0x1000;
+
+TEST(allocate_free_out_of_order) {
+  MemoryAllocator alloc(BASE, SIZE, PAGE);
+  uint64_t a, b, c;
+  CHECK(alloc.allocate(PAGE, 0, &a));
+  CHECK(alloc.allocate(3 * PAGE, 0, &b));
+  CHECK(alloc.allocate(1, 0, &c));
+  CHECK(a == BASE && b == BASE + PAGE && c == BASE + 4 * PAGE);
+  CHECK(alloc.block_size(c) == PAGE); // rounded up to the minimum alignment
+  CHECK(alloc.used() == 5 * PAGE);
+
+  uint64_t size = 0;
+  CHECK(alloc.release(b, &size) && size == 3 * PAGE);
+  CHECK(!alloc.release(b));
+  CHECK(!alloc.release(BASE + 0x123));
+  CHECK(alloc.release(a));
+  CHECK(alloc.release(c));
+  CHECK(alloc.used() == 0);
+  CHECK(alloc.blocks().empty());
+}
+
+TEST(coalesce) {
+  MemoryAllocator alloc(BASE, 4 * PAGE, PAGE);
+  uint64_t addr[4];
+  for (auto &a : addr) {
+    CHECK(alloc.allocate(PAGE, 0, &a));
+  }
+  uint64_t full;
+  CHECK(!alloc.allocate(PAGE, 0, &full));
+
+  // free blocks on both sides merge with the one released last
+  CHECK(alloc.release(addr[0]));
+  CHECK(alloc.release(addr[2]));
+  CHECK(alloc.release(addr[1]));
+  uint64_t big;
+  CHECK(alloc.allocate(3 * PAGE, 0, &big) && big == BASE);
+  CHECK(alloc.release(big));
+  CHECK(alloc.release(addr[3]));
+  CHECK(alloc.allocate(4 * PAGE, 0, &big) && big == BASE);
+}
+
+TEST(best_fit) {
+  MemoryAllocator alloc(BASE, 8 * PAGE, PAGE);
+  uint64_t a, b, c, d;
+  CHECK(alloc.allocate(2 * PAGE, 0, &a));
+  CHECK(alloc.allocate(PAGE, 0, &b));
+  CHECK(alloc.allocate(PAGE, 0, &c));
+  CHECK(alloc.allocate(PAGE, 0, &d));
+  CHECK(alloc.release(a)); // 2 pages free at the start, 3 at the end
+  CHECK(alloc.release(c)); // 1 page free in the middle
+  uint64_t e;
+  CHECK(alloc.allocate(PAGE, 0, &e) && e == c);
+  CHECK(alloc.allocate(2 * PAGE, 0, &e) && e == a);
+}
+
+TEST(alignment) {
+  MemoryAllocator alloc(BASE, SIZE, PAGE);
+  uint64_t a, b;
+  CHECK(alloc.allocate(PAGE, 0, &a));
+  CHECK(alloc.allocate(PAGE, 0x10000, &b));
+  CHECK(b == BASE + 0x10000);
+  // the gap left in front of the aligned block is still usable
+  uint64_t c;
+  CHECK(alloc.allocate(PAGE, 0, &c) && c == BASE + PAGE);
+  CHECK(!alloc.allocate(PAGE, 0x3000, &c)); // not a power of two
+  CHECK(!alloc.allocate(0, 0, &c));
+}
+
+TEST(reserve) {
+  MemoryAllocator alloc(BASE, SIZE, PAGE);
+  CHECK(alloc.reserve(BASE + 4 * PAGE, 2 * PAGE));
+  CHECK(!alloc.reserve(BASE + 5 * PAGE, PAGE));     // inside the reservation
+  CHECK(!alloc.reserve(BASE + 3 * PAGE, 2 * PAGE)); // overlaps its start
+  CHECK(!alloc.reserve(BASE + 0x10, PAGE));         // misaligned
+  CHECK(!alloc.reserve(BASE - PAGE, PAGE));         // below the range
+  CHECK(!alloc.reserve(BASE + SIZE - PAGE, 2 * PAGE)); // past its end
+
+  // allocations go around the reservation
+  uint64_t a, b;
+  CHECK(alloc.allocate(4 * PAGE, 0, &a) && a == BASE);
+  CHECK(alloc.allocate(PAGE, 0, &b) && b == BASE + 6 * PAGE);
+  CHECK(alloc.release(BASE + 4 * PAGE));
+  CHECK(alloc.reserve(BASE + 4 * PAGE, 2 * PAGE));
+}
+
+TEST(oversized) {
+  // sizes that wrap when rounded up to the alignment are rejected, not
+  // turned into empty blocks
+  MemoryAllocator alloc(BASE, SIZE, PAGE);
+  uint64_t a;
+  CHECK(!alloc.allocate(~0ull - 0x10, 0, &a));
+  CHECK(!alloc.allocate(SIZE + 1, 0, &a));
+  CHECK(!alloc.reserve(BASE + 2 * PAGE, ~0ull - 0x10));
+  CHECK(!alloc.reserve(BASE + 2 * PAGE, SIZE));
+  CHECK(alloc.used() == 0);
+  CHECK(alloc.allocate(SIZE, 0, &a) && a == BASE && alloc.block_size(a) == SIZE);
+}
+
+int main() {
+  RUN(allocate_free_out_of_order);
+  RUN(coalesce);
+  RUN(best_fit);
+  RUN(alignment);
+  RUN(reserve);
+  RUN(oversized);
+  return g_failures;
+}
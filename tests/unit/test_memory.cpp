@@ -0,0 +1,163 @@
+#include "memory.h"
+#include "unit.h"
+#include "vt_config.h"
+
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+TEST(write_masked) {
+  PhysicalMemory ram;
+  paddr_t addr;
+  CHECK(ram.alloc(&addr, RAM_PAGE_SIZE));
+  std::vector<uint8_t> zero(64, 0), data(64), out(64);
+  for (uint32_t i = 0; i < 64; ++i) {
+    data[i] = 0x80 + i;
+  }
+
+  // every eighth byte, across all the 64-bit words of the line
+  CHECK(ram.write(addr, zero.data(), 64));
+  CHECK(ram.write_masked(addr, data.data(), 0x0101010101010101ull, 64));
+  CHECK(ram.read(addr, out.data(), 64));
+  for (uint32_t i = 0; i < 64; ++i) {
+    CHECK(out[i] == ((i % 8) ? 0 : data[i]));
+  }
+
+  // full words and an empty mask
+  CHECK(ram.write(addr, zero.data(), 64));
+  CHECK(ram.write_masked(addr, data.data(), 0xff000000000000ffull, 64));
+  CHECK(ram.write_masked(addr, data.data(), 0, 64));
+  CHECK(ram.read(addr, out.data(), 64));
+  for (uint32_t i = 0; i < 64; ++i) {
+    CHECK(out[i] == ((i < 8 || i >= 56) ? data[i] : 0));
+  }
+
+  // mask bits past size are ignored, a partial last word stays in bounds
+  CHECK(ram.write(addr, zero.data(), 64));
+  CHECK(ram.write_masked(addr + 1, data.data(), ~0ull, 11));
+  CHECK(ram.read(addr, out.data(), 64));
+  for (uint32_t i = 0; i < 64; ++i) {
+    CHECK(out[i] == ((i >= 1 && i < 12) ? data[i - 1] : 0));
+  }
+
+  CHECK(!ram.write_masked(addr, data.data(), ~0ull, 65));
+  CHECK(ram.free(addr));
+}
+
+TEST(fill) {
+  PhysicalMemory ram;
+  paddr_t addr;
+  CHECK(ram.alloc(&addr, 2 * RAM_PAGE_SIZE));
+  uint32_t pattern = 0xdeadbeef;
+  CHECK(ram.fill(addr + 4, &pattern, 4, RAM_PAGE_SIZE));
+  std::vector<uint32_t> out(RAM_PAGE_SIZE / 4 + 2);
+  CHECK(ram.read(addr, out.data(), out.size() * 4));
+  CHECK(out.front() == 0 && out.back() == 0);
+  for (size_t i = 1; i + 1 < out.size(); ++i) {
+    CHECK(out[i] == pattern);
+  }
+  CHECK(!ram.fill(addr, &pattern, 4, 6));
+  CHECK(ram.free(addr));
+}
+
+TEST(merge) {
+  PhysicalMemory ram;
+  paddr_t addr;
+  CHECK(ram.alloc(&addr, 2 * RAM_PAGE_SIZE));
+  std::vector<uint8_t> data(64, 0x11), out(64);
+  CHECK(ram.write(addr, data.data(), 64));
+
+  // disjoint bytes of one page merge, whatever their value
+  {
+    PhysicalMemory a(&ram), b(&ram);
+    uint8_t x = 0x22, y = 0x11;
+    CHECK(a.write(addr, &x, 1));
+    CHECK(b.write_masked(addr, data.data(), 0x2, 2)); // byte 1, unchanged value
+    CHECK(b.write(addr + RAM_PAGE_SIZE, &y, 1));
+    CHECK(ram.merge({&a, &b}) == 0);
+    CHECK(ram.read(addr, out.data(), 2) && out[0] == 0x22 && out[1] == 0x11);
+    CHECK(ram.read(addr + RAM_PAGE_SIZE, out.data(), 1) && out[0] == 0x11);
+  }
+
+  // the same byte written by two views conflicts, even with equal values or
+  // with the one it had, and nothing is merged
+  {
+    PhysicalMemory a(&ram), b(&ram);
+    uint8_t x = 0x33, same = 0x22;
+    CHECK(a.write(addr + 8, &x, 1));
+    CHECK(a.write(addr, &same, 1));
+    CHECK(b.write(addr, &same, 1));
+    CHECK(ram.merge({&a, &b}) == 1);
+    CHECK(ram.read(addr + 8, out.data(), 1) && out[0] == 0x11);
+  }
+  {
+    PhysicalMemory a(&ram), b(&ram);
+    uint8_t x = 0x44, same = 0x22;
+    CHECK(a.write(addr, &x, 1));
+    CHECK(b.fill(addr, &same, 1, 4));
+    CHECK(ram.merge({&a, &b}) == 1);
+    CHECK(ram.read(addr, out.data(), 1) && out[0] == 0x22);
+  }
+
+  // scratch bytes are not checked, the later view wins
+  {
+    PhysicalMemory a(&ram), b(&ram);
+    uint8_t x = 0x55, y = 0x66;
+    CHECK(a.write(addr + 16, &x, 1));
+    CHECK(b.write(addr + 16, &y, 1));
+    CHECK(ram.merge({&a, &b}, addr + 16, 16) == 0);
+    CHECK(ram.read(addr + 16, out.data(), 1) && out[0] == 0x66);
+  }
+  CHECK(ram.free(addr));
+}
+
+TEST(out_of_range) {
+  // ranges whose end wraps past 2^64 are rejected, not wrapped into memory
+  PhysicalMemory ram;
+  uint8_t buf[16] = {1};
+  CHECK(!ram.read(~0ull - 7, buf, sizeof(buf)) && buf[0] == 0);
+  CHECK(!ram.write(~0ull - 7, buf, sizeof(buf)));
+  CHECK(ram.host_ptr(~0ull - 7, sizeof(buf)) == nullptr);
+  CHECK(!ram.read(GLOBAL_MEM_SIZE - 8, buf, sizeof(buf)));
+}
+
+TEST(restore) {
+  PhysicalMemory ram;
+  paddr_t addr;
+  uint32_t value = 0x12345678, out = 0;
+  CHECK(ram.alloc(&addr, RAM_PAGE_SIZE));
+  CHECK(ram.write(addr + 8, &value, 4));
+  std::stringstream ss;
+  CHECK(ram.save(ss));
+  std::string image = ss.str();
+
+  PhysicalMemory copy;
+  std::istringstream is(image);
+  CHECK(copy.restore(is));
+  CHECK(copy.read(addr + 8, &out, 4) && out == value);
+
+  // a truncated checkpoint leaves the contents as they were
+  value = 0x9abcdef0;
+  CHECK(copy.write(addr + 8, &value, 4));
+  std::istringstream truncated(image.substr(0, image.size() - 16));
+  CHECK(!copy.restore(truncated));
+  CHECK(copy.read(addr + 8, &out, 4) && out == value);
+
+  // a block count past the end of the stream is rejected before allocating
+  std::string corrupt = image;
+  uint64_t count = ~0ull / 2;
+  memcpy(&corrupt[sizeof(uint64_t)], &count, sizeof(count));
+  std::istringstream bad_count(corrupt);
+  CHECK(!copy.restore(bad_count));
+  CHECK(copy.read(addr + 8, &out, 4) && out == value);
+  CHECK(ram.free(addr));
+}
+
+int main() {
+  RUN(write_masked);
+  RUN(fill);
+  RUN(merge);
+  RUN(out_of_range);
+  RUN(restore);
+  return g_failures;
+}
@@ -0,0 +1,153 @@
+#include "module_elf.h"
+#include "unit.h"
+#include "vt_config.h"
+
+#include <elf.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// a RISC-V executable with a text and a data segment, two symbols and the
+// resource section of kernel "vecadd"
+class image_builder {
+public:
+  image_builder() : image_(sizeof(Elf32_Ehdr), 0) {
+    memset(&ehdr_, 0, sizeof(ehdr_));
+    memcpy(ehdr_.e_ident, ELFMAG, SELFMAG);
+    ehdr_.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr_.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr_.e_type = ET_EXEC;
+    ehdr_.e_machine = EM_RISCV;
+    ehdr_.e_entry = 0x80000000;
+    ehdr_.e_ehsize = sizeof(Elf32_Ehdr);
+  }
+
+  std::vector<uint8_t> build() {
+    uint32_t text = append(std::string(0x100, '\x13'));
+    uint32_t data = append(std::string(0x10, '\x01'));
+    kernel_resource_t resource = {12, 6, 2048};
+    uint32_t res = append(std::string((const char *)&resource, sizeof(resource)));
+
+    std::string strtab("\0vecadd\0local\0", 14);
+    Elf32_Sym syms[3];
+    memset(syms, 0, sizeof(syms));
+    syms[1] = sym(1, 0x80000040, STB_GLOBAL, 1);
+    syms[2] = sym(8, 0x80000080, STB_LOCAL, 1);
+    uint32_t symtab = append(std::string((const char *)syms, sizeof(syms)));
+    uint32_t strs = append(strtab);
+    std::string shstrtab("\0.text\0.symtab\0.strtab\0.shstrtab\0.ventus.resource.vecadd\0", 57);
+    uint32_t shstrs = append(shstrtab);
+
+    Elf32_Phdr phdrs[2];
+    phdrs[0] = phdr(text, 0x80000000, 0x100, 0x100, PF_R | PF_X);
+    phdrs[1] = phdr(data, 0x80001000, 0x10, 0x40, PF_R | PF_W);
+    ehdr_.e_phoff = append(std::string((const char *)phdrs, sizeof(phdrs)));
+    ehdr_.e_phnum = 2;
+    ehdr_.e_phentsize = sizeof(Elf32_Phdr);
+
+    Elf32_Shdr shdrs[6];
+    memset(shdrs, 0, sizeof(shdrs));
+    shdrs[1] = shdr(1, SHT_PROGBITS, text, 0x100, 0);
+    shdrs[2] = shdr(7, SHT_SYMTAB, symtab, sizeof(syms), 3);
+    shdrs[3] = shdr(15, SHT_STRTAB, strs, strtab.size(), 0);
+    shdrs[4] = shdr(23, SHT_STRTAB, shstrs, shstrtab.size(), 0);
+    shdrs[5] = shdr(33, SHT_PROGBITS, res, sizeof(resource), 0);
+    ehdr_.e_shoff = append(std::string((const char *)shdrs, sizeof(shdrs)));
+    ehdr_.e_shnum = 6;
+    ehdr_.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr_.e_shstrndx = 4;
+
+    memcpy(image_.data(), &ehdr_, sizeof(ehdr_));
+    return image_;
+  }
+
+private:
+  uint32_t append(const std::string &bytes) {
+    uint32_t offset = (image_.size() + 3) & ~3u;
+    image_.resize(offset);
+    image_.insert(image_.end(), bytes.begin(), bytes.end());
+    return offset;
+  }
+
+  static Elf32_Phdr phdr(uint32_t offset, uint32_t vaddr, uint32_t filesz,
+                         uint32_t memsz, uint32_t flags) {
+    Elf32_Phdr p;
+    memset(&p, 0, sizeof(p));
+    p.p_type = PT_LOAD;
+    p.p_offset = offset;
+    p.p_vaddr = p.p_paddr = vaddr;
+    p.p_filesz = filesz;
+    p.p_memsz = memsz;
+    p.p_flags = flags;
+    return p;
+  }
+
+  static Elf32_Shdr shdr(uint32_t name, uint32_t type, uint32_t offset,
+                         uint32_t size, uint32_t link) {
+    Elf32_Shdr s;
+    memset(&s, 0, sizeof(s));
+    s.sh_name = name;
+    s.sh_type = type;
+    s.sh_offset = offset;
+    s.sh_size = size;
+    s.sh_link = link;
+    return s;
+  }
+
+  static Elf32_Sym sym(uint32_t name, uint32_t value, uint32_t bind,
+                       uint16_t shndx) {
+    Elf32_Sym s;
+    memset(&s, 0, sizeof(s));
+    s.st_name = name;
+    s.st_value = value;
+    s.st_info = ELF32_ST_INFO(bind, STT_FUNC);
+    s.st_shndx = shndx;
+    return s;
+  }
+
+  Elf32_Ehdr ehdr_;
+  std::vector<uint8_t> image_;
+};
+
+TEST(parse) {
+  vt_elf elf;
+  CHECK(elf_parse(image_builder().build(), &elf));
+  CHECK(elf.entry == 0x80000000);
+  CHECK(elf.segments.size() == 2);
+  CHECK(elf.segments[0].addr == 0x80000000 && !elf.segments[0].writable);
+  CHECK(elf.segments[1].mem_size == 0x40 && elf.segments[1].file_size == 0x10);
+  CHECK(elf.segments[1].writable);
+  // the two pages touch and are reserved as one block
+  CHECK(elf.blocks.size() == 1);
+  CHECK(elf.blocks[0].first == 0x80000000 && elf.blocks[0].second == 2 * RAM_PAGE_SIZE);
+  CHECK(elf.symbols.size() == 1 && elf.symbols["vecadd"] == 0x80000040);
+  CHECK(elf.resources.count("vecadd") == 1);
+  CHECK(elf.resources["vecadd"].vgpr_usage == 12);
+  CHECK(elf.resources["vecadd"].lds_usage == 2048);
+}
+
+TEST(reject_malformed) {
+  auto image = image_builder().build();
+  vt_elf elf;
+  CHECK(!elf_parse(std::vector<uint8_t>(image.begin(), image.begin() + 20), &elf));
+
+  auto bad_class = image;
+  bad_class[EI_CLASS] = ELFCLASS64;
+  CHECK(!elf_parse(bad_class, &elf));
+
+  // segment data past the end of the image
+  auto bad_segment = image;
+  Elf32_Ehdr ehdr;
+  memcpy(&ehdr, image.data(), sizeof(ehdr));
+  Elf32_Phdr phdr;
+  memcpy(&phdr, image.data() + ehdr.e_phoff, sizeof(phdr));
+  phdr.p_filesz = phdr.p_memsz = image.size();
+  memcpy(bad_segment.data() + ehdr.e_phoff, &phdr, sizeof(phdr));
+  CHECK(!elf_parse(bad_segment, &elf));
+}
+
+int main() {
+  RUN(parse);
+  RUN(reject_malformed);
+  return g_failures;
+}
@@ -0,0 +1,27 @@
+#ifndef UNIT_H
+#define UNIT_H
+
+#include <stdio.h>
+
+// checks of the host-side components that build without the RTL model, each
+// test program returns the number of failed checks
+static int g_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);          \
+      ++g_failures;                                                            \
+    }                                                                          \
+  } while (0)
+
+#define TEST(name) static void name()
+
+#define RUN(name)                                                              \
+  do {                                                                         \
+    int failures = g_failures;                                                 \
+    name();                                                                    \
+    printf("%s %s\n", (failures == g_failures) ? "PASSED" : "FAILED", #name); \
+  } while (0)
+
+#endif
@@ -26,13 +26,13 @@ typedef struct {
   uint32_t dst_addr;
 } kernel_arg_t;
 
-const char *kernel_file = "vecadd.bin";
+const char *kernel_file = "vecadd.elf";
 int test = 1;
 
 vx_device_h device = nullptr;
 uint64_t src_buffer;
 uint64_t dst_buffer;
-uint64_t knl_entry;
+vx_module_h module = nullptr;
 uint64_t knl_arg_base;
 kernel_arg_t kernel_arg = {};
 
@@ -40,7 +40,7 @@ void cleanup() {
   if (device) {
     vx_mem_free(device, src_buffer);
     vx_mem_free(device, dst_buffer);
-    vx_mem_free(device, knl_entry);
+    vx_module_unload(module);
     vx_mem_free(device, knl_arg_base);
     vx_dev_close(device);
   }
@@ -140,7 +140,7 @@ int run_kernel_test(const kernel_arg_t &kernel_arg) {
   std::cout << std::dec << "block.x:" << block.x << ", block.y:" << block.y
             << ", block.z:" << block.z << std::endl;
 
-  RT_CHECK(vx_start(device, grid, block, 0x8000019cu, knl_arg_base));
+  RT_CHECK(vx_module_start(module, "vecadd", grid, block, knl_arg_base));
   RT_CHECK(vx_ready_wait(device, VX_MAX_TIMEOUT));
   auto t3 = std::chrono::high_resolution_clock::now();
 
@@ -198,7 +198,7 @@ int main(int argc, char *argv[]) {
 
   // Upload kernel binary
   std::cout << "Upload kernel binary" << std::endl;
-  RT_CHECK(vx_upload_file(device, kernel_file, &knl_entry));
+  RT_CHECK(vx_module_load(device, kernel_file, &module));
 
   // allocate device memory
   std::cout << "allocate device memory" << std::endl;